@@ -6,7 +6,7 @@ using namespace std;
 using namespace proto;
 
 Server::Server(Mode mode, uint64_t skew, uint64_t error, int index, bool sp, int timeout) :
-    mode(mode), stored_procedure(sp)
+    mode(mode), stored_procedure(sp), restoreParts(0), restoreBytes(0)
 {
     timeServer = TrueTime(skew, error);
     std::string db_path = "/tmp/replica" + std::to_string(index) + ".store";
@@ -14,6 +14,7 @@ Server::Server(Mode mode, uint64_t skew, uint64_t error, int index, bool sp, int
     switch (mode) {
     case MODE_LOCK:
     case MODE_SPAN_LOCK:
+        store = new strongstore::LockStore(db_path, timeout);
         break;
     case MODE_OCC:
     case MODE_SPAN_OCC:
@@ -43,13 +44,18 @@ Server::LeaderUpcall(opnum_t opnum, const string &str1, bool &replicate, string
     case strongstore::proto::Request::PREPARE:
     {
         //std::cout << "prepare ";
-        status = store->Prepare(request.txnid(),
-                                Transaction(request.prepare().txn()));
+        Transaction txn(request.prepare().txn());
+        status = store->Prepare(request.txnid(), txn,
+                                Timestamp(request.prepare().timestamp()));
         if (status == 0) {
             replicate = true;
             if (mode == MODE_SPAN_LOCK || mode == MODE_SPAN_OCC) {
                 // request.mutable_prepare()->set_timestamp(timeServer.GetTime());
                 reply.set_timestamp(timeServer.GetTime());
+            } else if (mode == MODE_OCC || mode == MODE_LOCK) {
+                // clients lease timestamps ahead of time, so tell them
+                // what the commit timestamp has to clear
+                reply.set_timestamp(store->LastCommitted(txn));
             }
         } else {
             replicate = false;
@@ -62,18 +68,31 @@ Server::LeaderUpcall(opnum_t opnum, const string &str1, bool &replicate, string
     {
         //std::cout << "commit ";
         replicate = true;
-
-        auto ver_msg = request.version();
-        std::vector<std::pair<std::string, size_t>> ver_keys;
-        for (size_t i = 0; i < ver_msg.versionedkeys_size(); ++i) {
-          auto k_ver = ver_msg.versionedkeys(i);
-          ver_keys.emplace_back(std::make_pair(k_ver.key(), k_ver.nversions()));
-        }
-        if (stored_procedure) {
-          store->Commit(request.txnid(), request.commit().timestamp(), ver_keys,
-              &reply);
+        Commit(request, &reply);
+        reply.set_status(status);
+        reply.SerializeToString(&str2);
+        break;
+    }
+    case strongstore::proto::Request::PREPARE_COMMIT:
+    {
+        // A transaction on this shard alone, validated and committed in
+        // one replicated operation
+        Transaction txn(request.prepare().txn());
+        uint64_t last = store->LastCommitted(txn);
+        if ((mode == MODE_OCC || mode == MODE_LOCK) &&
+            request.commit().timestamp() <= last) {
+            // the client's lease trails what is committed here, it
+            // retries with a timestamp above last
+            replicate = false;
+            status = REPLY_RETRY;
+            reply.set_timestamp(last);
         } else {
-          store->Commit(request.txnid(), request.commit().timestamp(), &reply);
+            status = store->Prepare(request.txnid(), txn,
+                                    Timestamp(request.prepare().timestamp()));
+            replicate = (status == 0);
+            if (replicate) {
+                Commit(request, &reply);
+            }
         }
         reply.set_status(status);
         reply.SerializeToString(&str2);
@@ -93,7 +112,8 @@ Server::LeaderUpcall(opnum_t opnum, const string &str1, bool &replicate, string
 }
 
 /*
- * Dummy function. No replication supported for now
+ * Applies an operation the leader has committed, so that backups hold
+ * the same state and can serve unlogged reads.
  */
 void
 Server::ReplicaUpcall(opnum_t opnum,
@@ -110,10 +130,35 @@ Server::ReplicaUpcall(opnum_t opnum,
     case strongstore::proto::Request::GET:
         return;
     case strongstore::proto::Request::PREPARE:
+    {
+        // the leader only replicates prepares that succeeded there, so
+        // a failure here means this store has diverged from it
+        status = store->Prepare(request.txnid(),
+                                Transaction(request.prepare().txn()),
+                                Timestamp(request.prepare().timestamp()));
+        if (status != 0) {
+            Panic("Replicated prepare of txn %lu failed at op %lu",
+                  request.txnid(), opnum);
+        }
         break;
+    }
     case strongstore::proto::Request::COMMIT:
+        Commit(request, &reply);
         break;
+    case strongstore::proto::Request::PREPARE_COMMIT:
+    {
+        status = store->Prepare(request.txnid(),
+                                Transaction(request.prepare().txn()),
+                                Timestamp(request.prepare().timestamp()));
+        if (status != 0) {
+            Panic("Replicated prepare of txn %lu failed at op %lu",
+                  request.txnid(), opnum);
+        }
+        Commit(request, &reply);
+        break;
+    }
     case strongstore::proto::Request::ABORT:
+        store->Abort(request.txnid(), Transaction(request.abort().txn()));
         break;
     default:
         Panic("Unrecognized operation.");
@@ -122,6 +167,24 @@ Server::ReplicaUpcall(opnum_t opnum,
     reply.SerializeToString(&str2);
 }
 
+/* Commits a prepared transaction, for COMMIT and PREPARE_COMMIT. */
+void
+Server::Commit(const Request &request, Reply *reply)
+{
+    auto ver_msg = request.version();
+    std::vector<std::pair<std::string, size_t>> ver_keys;
+    for (size_t i = 0; i < ver_msg.versionedkeys_size(); ++i) {
+      auto k_ver = ver_msg.versionedkeys(i);
+      ver_keys.emplace_back(std::make_pair(k_ver.key(), k_ver.nversions()));
+    }
+    if (stored_procedure) {
+      store->Commit(request.txnid(), request.commit().timestamp(), ver_keys,
+          reply);
+    } else {
+      store->Commit(request.txnid(), request.commit().timestamp(), reply);
+    }
+}
+
 void
 Server::UnloggedUpcall(const string &str1, string &str2)
 {
@@ -157,6 +220,50 @@ Server::UnloggedUpcall(const string &str1, string &str2)
   reply.SerializeToString(&str2);
 }
 
+bool
+Server::Checkpoint(opnum_t opnum)
+{
+    // The ledger keeps everything up to here, note where it stood
+    Reply reply;
+    store->GetDigest(&reply);
+    Notice("Checkpoint at op %lu: ledger block %ld", opnum,
+           reply.digest().block());
+    return true;
+}
+
+void
+Server::SnapshotBase(string &base)
+{
+    store->SnapshotBase(base);
+}
+
+void
+Server::Snapshot(const string &base,
+                 const std::function<void (string &part)> &send)
+{
+    store->Snapshot(base, send);
+}
+
+void
+Server::RestorePart(opnum_t opnum, size_t part, const string &data)
+{
+    if (part == 0) {
+        restoreParts = 0;
+        restoreBytes = 0;
+    }
+    restoreParts++;
+    restoreBytes += data.size();
+    store->RestorePart(part, data);
+}
+
+void
+Server::Restore(opnum_t opnum)
+{
+    Notice("Restoring store from snapshot at op %lu (%zu parts, %zu bytes)",
+           opnum, restoreParts, restoreBytes);
+    store->Restore();
+}
+
 void
 Server::Load(const std::vector<std::string> &keys,
              const std::vector<std::string> &values,
@@ -172,6 +279,8 @@ main(int argc, char **argv)
 {
     int index = -1, timeout;
     unsigned int myShard=0, maxShard=1, nKeys=1, version=1;
+    unsigned int nLoops=1, nWorkers=0, batchSize=64;
+    uint64_t batchDelay=500, checkpointInterval=10000;
     std::string workload;
     bool stored_procedure = false;
     const char *configPath = NULL;
@@ -181,7 +290,7 @@ main(int argc, char **argv)
 
     // Parse arguments
     int opt;
-    while ((opt = getopt(argc, argv, "c:i:m:e:s:f:n:N:k:w:t:v:")) != -1) {
+    while ((opt = getopt(argc, argv, "c:i:m:e:s:f:n:N:k:w:t:v:l:r:b:d:p:")) != -1) {
         switch (opt) {
         case 'c':
             configPath = optarg;
@@ -305,6 +414,61 @@ main(int argc, char **argv)
             break;
         }
 
+        case 'l':   // Event loops for client connections
+        {
+            char *strtolPtr;
+            nLoops = strtoul(optarg, &strtolPtr, 10);
+            if ((*optarg == '\0') || (*strtolPtr != '\0') || (nLoops <= 0))
+            {
+                fprintf(stderr, "option -l requires a positive numeric arg\n");
+            }
+            break;
+        }
+
+        case 'r':   // Worker threads for unlogged reads
+        {
+            char *strtolPtr;
+            nWorkers = strtoul(optarg, &strtolPtr, 10);
+            if ((*optarg == '\0') || (*strtolPtr != '\0'))
+            {
+                fprintf(stderr, "option -r requires a numeric arg\n");
+            }
+            break;
+        }
+
+        case 'b':   // Upper bound for adaptive VR batches
+        {
+            char *strtolPtr;
+            batchSize = strtoul(optarg, &strtolPtr, 10);
+            if ((*optarg == '\0') || (*strtolPtr != '\0') || (batchSize <= 0))
+            {
+                fprintf(stderr, "option -b requires a positive numeric arg\n");
+            }
+            break;
+        }
+
+        case 'd':   // How long a VR batch may wait to fill, in us
+        {
+            char *strtolPtr;
+            batchDelay = strtoul(optarg, &strtolPtr, 10);
+            if ((*optarg == '\0') || (*strtolPtr != '\0'))
+            {
+                fprintf(stderr, "option -d requires a numeric arg\n");
+            }
+            break;
+        }
+
+        case 'p':   // VR checkpoint interval in ops, 0 keeps the whole log
+        {
+            char *strtolPtr;
+            checkpointInterval = strtoul(optarg, &strtolPtr, 10);
+            if ((*optarg == '\0') || (*strtolPtr != '\0'))
+            {
+                fprintf(stderr, "option -p requires a numeric arg\n");
+            }
+            break;
+        }
+
         default:
             fprintf(stderr, "Unknown argument %s\n", argv[optind]);
         }
@@ -334,10 +498,18 @@ main(int argc, char **argv)
                 "only %d replicas defined\n", index, config.n);
     }
 
-    TCPTransport transport(0.0, 0.0, 0);
+    // Replicas that are all on this host talk through shared memory
+    Transport *transport;
+    if (ShmTransport::Covers(config)) {
+        transport = new ShmTransport();
+    } else {
+        transport = new TCPTransport(0.0, 0.0, 0, true, nLoops);
+    }
 
     strongstore::Server server(mode, skew, error, index, stored_procedure, timeout);
-    replication::vr::VRReplica replica(config, index, &transport, 1, &server);
+    replication::vr::VRReplica replica(config, index, transport, batchSize,
+                                       &server, nWorkers, batchDelay,
+                                       checkpointInterval);
 
     timeval t0, t1;
     gettimeofday(&t0, NULL);
@@ -436,7 +608,7 @@ main(int argc, char **argv)
     double latency = (t1.tv_sec - t0.tv_sec)*1000000 + t1.tv_usec - t0.tv_usec;
     std::cout << "Init took " << (latency/1000000) << " seconds!" << std::endl;
 
-    transport.Run();
+    transport->Run();
 
     return 0;
 }
@@ -7,11 +7,19 @@ TimeStampServer::TimeStampServer()
 
 TimeStampServer::~TimeStampServer() { }
 
+/* Hands out the next count timestamps and returns the first. Clients
+ * lease blocks this way, so one replicated operation covers many
+ * transactions; an empty request asks for a single timestamp. */
 string
-TimeStampServer::newTimeStamp()
+TimeStampServer::newTimeStamp(const string &count)
 {
-    ts++;
-    return to_string(ts);
+    long n = count.empty() ? 1 : stol(count);
+    if (n < 1) {
+        n = 1;
+    }
+    long first = ts + 1;
+    ts += n;
+    return to_string(first);
 }
 
 void
@@ -22,7 +30,7 @@ TimeStampServer::LeaderUpcall(opnum_t opnum,
 {
     
     // Get a new timestamp from the TimeStampServer
-    str2 = newTimeStamp();
+    str2 = newTimeStamp(str1);
 }
 
 void
@@ -32,7 +40,7 @@ TimeStampServer::ReplicaUpcall(opnum_t opnum,
 {
     
     // Get a new timestamp from the TimeStampServer
-    str2 = newTimeStamp();
+    str2 = newTimeStamp(str1);
 }
 
 static void
@@ -95,12 +103,17 @@ main(int argc, char **argv)
         Usage(argv[0]);
     }
 
-    TCPTransport transport(0.0, 0.0, 0);
+    Transport *transport;
+    if (ShmTransport::Covers(config)) {
+        transport = new ShmTransport();
+    } else {
+        transport = new TCPTransport(0.0, 0.0, 0);
+    }
 
     TimeStampServer server;
-    replication::vr::VRReplica replica(config, index, &transport, 1, &server);
+    replication::vr::VRReplica replica(config, index, transport, 1, &server);
 
-    transport.Run();
+    transport->Run();
 
     return 0;
 }
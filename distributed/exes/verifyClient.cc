@@ -165,6 +165,19 @@ int verifyThread(strongstore::Client* client, int idx, int tLen, int wPer, int d
 
 #endif
 
+// keys committed but not verified yet, for verifyThread to pick up
+void addUnverified(const strongstore::Client::unverified_keys_t& unverified_keys) {
+#ifndef AMZQLDB
+    boost::unique_lock<boost::shared_mutex> write(lck);
+    for (auto& replicas : unverified_keys) {
+        for (auto& blocks : replicas.second) {
+            verifymap[replicas.first][blocks.first].insert(
+                blocks.second.begin(), blocks.second.end());
+        }
+    }
+#endif
+}
+
 int
 txnThread(strongstore::Client* client, int idx, int tLen, int wPer, int rPer, int duration) {
   // Read in the keys from a file.
@@ -208,35 +221,72 @@ txnThread(strongstore::Client* client, int idx, int tLen, int wPer, int rPer, in
     fprintf(stderr, "%ld %ld.%06ld %ld.%06ld %ld %d %d\n", nTransactions,
         t1.tv_sec, t1.tv_usec, t2.tv_sec, t2.tv_usec, latency, status?1:0, task.ops[0]);
 
-#ifndef AMZQLDB
+    addUnverified(unverified_keys);
+    gettimeofday(&t1, NULL);
+    if (((t1.tv_sec-t0.tv_sec)*1000000 + (t1.tv_usec-t0.tv_usec)) >
+        duration*1000000) {
+      std::cout << "txn thread terminated" << std::endl;
+      running = false;
+      break;
+    }
+  }
+  return 0;
+}
+
+// Same workload through the pipelined interface, keeping up to depth
+// transactions in flight at once
+int
+txnThreadAsync(strongstore::Client* client, int idx, int depth, int duration) {
+  struct timeval t0, t1;
+  size_t nTransactions = 0;
+  std::mutex m;
+  std::condition_variable cv;
+  int inflight = 0;
+
+  gettimeofday(&t0, NULL);
+  while (1) {
+    Task task;
+    while (!task_queue.try_pop(task));
+
     {
-        boost::unique_lock<boost::shared_mutex> write(lck);
-        for (auto& replicas : unverified_keys) {
-            if (verifymap.find(replicas.first) != verifymap.end()) {
-                for (auto& blocks : replicas.second) {
-                    if (verifymap[replicas.first].find(blocks.first) != verifymap[replicas.first].end()) {
-                        for (auto& keys : blocks.second) {
-                            verifymap[replicas.first][blocks.first].emplace(keys);
-                        }
-                    } else {
-                        std::set<std::string> ks(blocks.second.begin(), blocks.second.end());
-                        verifymap[replicas.first].emplace(blocks.first, ks);
-                    }
-                }
-            } else {
-                std::map<uint64_t, std::set<std::string>> blocks;
-                for (auto& block : replicas.second) {
-                  std::set<std::string> keys;
-                  for (auto& k : block.second) {
-                    keys.emplace(k);
-                  }
-                  blocks.emplace(block.first, keys);
-                }
-                verifymap.emplace(replicas.first, blocks);
-            }
-        }
+      std::unique_lock<std::mutex> l(m);
+      cv.wait(l, [&] { return inflight < depth; });
+      ++inflight;
     }
-#endif
+
+    gettimeofday(&t1, NULL);
+    uint64_t tid = client->BeginAsync();
+    std::vector<std::string> reads;
+    for (size_t j = 0; j < task.ops.size(); j++) {
+      if (task.ops[j] == 1) {
+        client->PutAsync(tid, task.keys[j], task.vals[j]);
+      } else {
+        reads.emplace_back(task.keys[j]);
+      }
+    }
+
+    int op = task.ops[0];
+    auto done = [&, t1, op](bool status,
+        const strongstore::Client::unverified_keys_t& unverified_keys) {
+      struct timeval t2;
+      gettimeofday(&t2, NULL);
+      long latency = (t2.tv_sec - t1.tv_sec)*1000000 +
+                     (t2.tv_usec - t1.tv_usec);
+      addUnverified(unverified_keys);
+
+      std::lock_guard<std::mutex> l(m);
+      ++nTransactions;
+      fprintf(stderr, "%ld %ld.%06ld %ld.%06ld %ld %d %d\n", nTransactions,
+          t1.tv_sec, t1.tv_usec, t2.tv_sec, t2.tv_usec, latency, status?1:0, op);
+      --inflight;
+      cv.notify_one();
+    };
+    client->BatchGetAsync(tid, reads,
+        [client, tid, done](int status,
+                            const std::map<std::string, std::string>& values) {
+      client->CommitAsync(tid, done);
+    });
+
     gettimeofday(&t1, NULL);
     if (((t1.tv_sec-t0.tv_sec)*1000000 + (t1.tv_usec-t0.tv_usec)) >
         duration*1000000) {
@@ -245,6 +295,10 @@ txnThread(strongstore::Client* client, int idx, int tLen, int wPer, int rPer, in
       break;
     }
   }
+
+  // the callbacks refer to this frame
+  std::unique_lock<std::mutex> l(m);
+  cv.wait(l, [&] { return inflight == 0; });
   return 0;
 }
 
@@ -256,14 +310,16 @@ int main(int argc, char **argv) {
   int wPer = 50; // Out of 100
   int rPer = 50; // Out of 100
   int closestReplica = -1; // Closest replica id.
+  strongstore::Mode mode = strongstore::MODE_OCC;
   int skew = 0; // difference between real clock and TrueTime
   int error = 0; // error bars
   int idx = 0;
   int txn_rate = 0;
+  int depth = 1; // transactions in flight at once
   size_t timeout = 0;
 
   int opt;
-  while ((opt = getopt(argc, argv, "c:d:N:l:w:g:k:f:m:e:s:z:r:i:t:x:")) != -1) {
+  while ((opt = getopt(argc, argv, "c:d:N:l:w:g:k:f:m:e:s:z:r:i:t:x:p:")) != -1) {
     switch (opt) {
     case 'c': // Configuration path
     { 
@@ -386,6 +442,17 @@ int main(int argc, char **argv) {
 
     case 'm': // Mode to run in [occ/lock/...]
     {
+      if (strcasecmp(optarg, "lock") == 0) {
+        mode = strongstore::MODE_LOCK;
+      } else if (strcasecmp(optarg, "occ") == 0) {
+        mode = strongstore::MODE_OCC;
+      } else if (strcasecmp(optarg, "span-lock") == 0) {
+        mode = strongstore::MODE_SPAN_LOCK;
+      } else if (strcasecmp(optarg, "span-occ") == 0) {
+        mode = strongstore::MODE_SPAN_OCC;
+      } else {
+        fprintf(stderr, "unknown mode '%s'\n", optarg);
+      }
       break;
     }
 
@@ -422,12 +489,23 @@ int main(int argc, char **argv) {
       break; 
     }
 
+    case 'p': // pipeline depth
+    {
+      char *strtolPtr;
+      depth = strtoul(optarg, &strtolPtr, 10);
+      if ((*optarg == '\0') || (*strtolPtr != '\0') ||
+        (depth <= 0)) {
+        fprintf(stderr, "option -p requires a positive numeric arg\n");
+      }
+      break;
+    }
+
     default:
       fprintf(stderr, "Unknown argument %s\n", argv[optind]);
       break;
     }
   }
-  strongstore::Client *client = new strongstore::Client(strongstore::MODE_OCC, configPath,
+  strongstore::Client *client = new strongstore::Client(mode, configPath,
       nShards, closestReplica, TrueTime(skew, error));
 
   std::vector<std::future<int>> actual_ops;
@@ -436,7 +514,11 @@ int main(int argc, char **argv) {
   for (int i = 0; i < numThread; ++i) {
     actual_ops.emplace_back(std::async(std::launch::async, taskGenerator, idx, i, tLen, wPer, rPer, interval));
   }
-  actual_ops.emplace_back(std::async(std::launch::async, txnThread, client, idx, tLen, wPer, rPer, duration));
+  if (depth > 1) {
+    actual_ops.emplace_back(std::async(std::launch::async, txnThreadAsync, client, idx, depth, duration));
+  } else {
+    actual_ops.emplace_back(std::async(std::launch::async, txnThread, client, idx, tLen, wPer, rPer, duration));
+  }
 #ifndef AMZQLDB
   std::cout << "start verification thread" << std::endl;
   actual_ops.emplace_back(std::async(std::launch::async, verifyThread, client, idx, tLen, wPer, duration, timeout));
@@ -0,0 +1,705 @@
+#include "distributed/lib/assert.h"
+#include "distributed/lib/configuration.h"
+#include "distributed/lib/message.h"
+#include "distributed/lib/shmtransport.h"
+
+#include <google/protobuf/message.h>
+#include <event2/thread.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+
+const size_t SHM_RING_SIZE = 1 << 22;
+const size_t SHM_MAX_FRAGMENT = SHM_RING_SIZE / 4;
+const size_t SHM_MAX_NAME = 256;
+
+const uint32_t FRAME_MORE = 1;  // the message continues in the next frame
+const uint32_t FRAME_WRAP = 2;  // the rest of the ring is unused
+
+struct ShmFrameHeader
+{
+    uint32_t len;
+    uint32_t flags;
+    MessageType type;
+    uint32_t pad;
+};
+
+// Positions only grow, the offset in data is the position modulo the
+// ring size. The consumer owns head and the producer tail.
+struct ShmTransport::ShmRing
+{
+    alignas(64) std::atomic<uint64_t> head;
+    alignas(64) std::atomic<uint64_t> tail;
+    // Set while the consumer is draining, so the producer can skip the
+    // eventfd write
+    alignas(64) std::atomic<uint32_t> consumerAwake;
+    // Set while the producer has messages queued for lack of space
+    alignas(64) std::atomic<uint32_t> producerWaiting;
+    alignas(64) char data[SHM_RING_SIZE];
+};
+
+// rings[0] carries the connecting side's messages, rings[1] the replies
+struct ShmSegment
+{
+    ShmTransport::ShmRing rings[2];
+};
+
+static inline size_t
+FrameSize(size_t len)
+{
+    return sizeof(ShmFrameHeader) + ((len + 15) & ~(size_t)15);
+}
+
+static inline void
+Signal(int fd)
+{
+    if (eventfd_write(fd, 1) < 0) {
+        PWarning("Failed to signal shared memory peer");
+    }
+}
+
+ShmTransportAddress::ShmTransportAddress(const string &name)
+    : name(name)
+{
+}
+
+ShmTransportAddress *
+ShmTransportAddress::clone() const
+{
+    ShmTransportAddress *c = new ShmTransportAddress(*this);
+    return c;
+}
+
+bool operator==(const ShmTransportAddress &a, const ShmTransportAddress &b)
+{
+    return a.name == b.name;
+}
+
+bool operator!=(const ShmTransportAddress &a, const ShmTransportAddress &b)
+{
+    return !(a == b);
+}
+
+bool operator<(const ShmTransportAddress &a, const ShmTransportAddress &b)
+{
+    return a.name < b.name;
+}
+
+bool
+ShmTransport::Covers(const transport::Configuration &config)
+{
+    int shm = 0;
+    for (int i = 0; i < config.n; i++) {
+        if (config.replica(i).host == SHM_HOST) {
+            shm++;
+        }
+    }
+    if (shm > 0 && shm < config.n) {
+        Panic("Configuration mixes shared memory and network replicas");
+    }
+    return shm > 0;
+}
+
+ShmTransportAddress
+ShmTransport::LookupAddress(const transport::Configuration &config,
+                            int idx)
+{
+    const transport::ReplicaAddress &addr = config.replica(idx);
+    if (addr.host != SHM_HOST) {
+        Panic("Replica %s:%s is not reachable through shared memory",
+              addr.host.c_str(), addr.port.c_str());
+    }
+    return ShmTransportAddress(addr.port);
+}
+
+ShmTransport::ShmConnection::~ShmConnection()
+{
+    if (wakeEvent != NULL) {
+        event_free(wakeEvent);
+    }
+    if (closeEvent != NULL) {
+        event_free(closeEvent);
+    }
+    munmap(segment, sizeof(ShmSegment));
+    close(wakeFd);
+    close(peerFd);
+    close(sockFd);
+}
+
+ShmTransport::ShmTransport(bool handleSignals)
+{
+    lastTimerId = 0;
+    nextClientId = 0;
+
+    evthread_use_pthreads();
+    libeventBase = event_base_new();
+    evthread_make_base_notifiable(libeventBase);
+
+    if (handleSignals) {
+        signalEvents.push_back(evsignal_new(libeventBase, SIGTERM,
+                                            SignalCallback, this));
+        signalEvents.push_back(evsignal_new(libeventBase, SIGINT,
+                                            SignalCallback, this));
+        for (event *x : signalEvents) {
+            event_add(x, NULL);
+        }
+    }
+}
+
+ShmTransport::~ShmTransport()
+{
+    for (ShmTransportListener *info : listeners) {
+        struct sockaddr_un sun;
+        socklen_t len = sizeof(sun);
+        if (getsockname(info->acceptFd, (sockaddr *)&sun, &len) == 0) {
+            unlink(sun.sun_path);
+        }
+    }
+}
+
+void
+ShmTransport::Register(TransportReceiver *receiver,
+                       const transport::Configuration &config,
+                       int replicaIdx)
+{
+    ASSERT(replicaIdx < config.n);
+
+    RegisterConfiguration(receiver, config, replicaIdx);
+
+    // Clients are named after the process, replicas after their socket
+    if (replicaIdx == -1) {
+        string name = "client-" + std::to_string(getpid()) + "-" +
+            std::to_string(nextClientId++);
+        names[receiver] = name;
+        receiver->SetAddress(new ShmTransportAddress(name));
+        return;
+    }
+
+    ShmTransportAddress addr = LookupAddress(config, replicaIdx);
+    if (addr.name.size() >= sizeof(((sockaddr_un *)0)->sun_path)) {
+        Panic("Socket path too long: %s", addr.name.c_str());
+    }
+
+    int fd;
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        PPanic("Failed to create socket to accept connections");
+    }
+    if (fcntl(fd, F_SETFL, O_NONBLOCK, 1)) {
+        PWarning("Failed to set O_NONBLOCK");
+    }
+
+    // A socket left behind by an earlier run would make bind fail
+    struct sockaddr_un sun;
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strncpy(sun.sun_path, addr.name.c_str(), sizeof(sun.sun_path) - 1);
+    unlink(sun.sun_path);
+    if (bind(fd, (sockaddr *)&sun, sizeof(sun)) < 0) {
+        PPanic("Failed to bind to %s", sun.sun_path);
+    }
+    if (listen(fd, 5) < 0) {
+        PPanic("Failed to listen for connections");
+    }
+
+    ShmTransportListener *info = new ShmTransportListener();
+    info->transport = this;
+    info->receiver = receiver;
+    info->acceptFd = fd;
+    info->acceptEvent = event_new(libeventBase, fd, EV_READ | EV_PERSIST,
+                                  AcceptCallback, (void *)info);
+    event_add(info->acceptEvent, NULL);
+    listeners.push_back(info);
+
+    names[receiver] = addr.name;
+    receiver->SetAddress(addr.clone());
+}
+
+// Creates the segment and eventfds and hands them to the listener of dst.
+// Called with connMtx held.
+std::shared_ptr<ShmTransport::ShmConnection>
+ShmTransport::Connect(TransportReceiver *src, const ShmTransportAddress &dst)
+{
+    int sock;
+    if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        PPanic("Failed to create socket for outgoing connection");
+    }
+    struct sockaddr_un sun;
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strncpy(sun.sun_path, dst.name.c_str(), sizeof(sun.sun_path) - 1);
+    if (connect(sock, (sockaddr *)&sun, sizeof(sun)) < 0) {
+        close(sock);
+        Warning("Failed to connect to %s", dst.name.c_str());
+        return NULL;
+    }
+
+    int fds[3];
+    fds[0] = memfd_create("shmtransport", 0);
+    if (fds[0] < 0 || ftruncate(fds[0], sizeof(ShmSegment)) < 0) {
+        PPanic("Failed to create shared memory segment");
+    }
+    void *segment = mmap(NULL, sizeof(ShmSegment), PROT_READ | PROT_WRITE,
+                         MAP_SHARED, fds[0], 0);
+    if (segment == MAP_FAILED) {
+        PPanic("Failed to map shared memory segment");
+    }
+    fds[1] = eventfd(0, EFD_NONBLOCK);  // wakes us
+    fds[2] = eventfd(0, EFD_NONBLOCK);  // wakes the listener
+    if (fds[1] < 0 || fds[2] < 0) {
+        PPanic("Failed to create eventfd");
+    }
+
+    // Our name goes along with the descriptors
+    const string &name = names[src];
+    struct iovec iov;
+    iov.iov_base = (void *)name.data();
+    iov.iov_len = name.size();
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    if (sendmsg(sock, &msg, 0) < 0) {
+        PWarning("Failed to hand shared memory to %s", dst.name.c_str());
+        close(sock);
+        munmap(segment, sizeof(ShmSegment));
+        close(fds[0]);
+        close(fds[1]);
+        close(fds[2]);
+        return NULL;
+    }
+    close(fds[0]);
+
+    auto conn = std::make_shared<ShmConnection>(dst);
+    conn->sockFd = sock;
+    conn->transport = this;
+    conn->receiver = src;
+    conn->segment = segment;
+    conn->in = &((ShmSegment *)segment)->rings[1];
+    conn->out = &((ShmSegment *)segment)->rings[0];
+    conn->wakeFd = fds[1];
+    conn->peerFd = fds[2];
+    AddConnection(conn);
+    return conn;
+}
+
+// The events refer to conn by plain pointer, as they are only added
+// while connections holds it. Called with connMtx held.
+void
+ShmTransport::AddConnection(const std::shared_ptr<ShmConnection> &conn)
+{
+    conn->backlogOffset = 0;
+    conn->wakeEvent = event_new(libeventBase, conn->wakeFd,
+                                EV_READ | EV_PERSIST, WakeCallback,
+                                (void *)conn.get());
+    event_add(conn->wakeEvent, NULL);
+    conn->closeEvent = event_new(libeventBase, conn->sockFd,
+                                 EV_READ | EV_PERSIST, CloseCallback,
+                                 (void *)conn.get());
+    event_add(conn->closeEvent, NULL);
+
+    // A peer that restarted replaces its old connection, which is freed
+    // once no sender holds it
+    auto kv = connections.find(conn->peer);
+    if (kv != connections.end()) {
+        event_del(kv->second->wakeEvent);
+        event_del(kv->second->closeEvent);
+    }
+    connections[conn->peer] = conn;
+}
+
+// The socket carries nothing after the handshake, so it only becomes
+// readable when the peer closes it. Senders may still hold the
+// connection, which is freed once the last of them lets go.
+void
+ShmTransport::CloseCallback(evutil_socket_t fd, short what, void *arg)
+{
+    ShmConnection *conn = (ShmConnection *)arg;
+    ShmTransport *transport = conn->transport;
+
+    char buf[16];
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n > 0 || (n < 0 && errno == EAGAIN)) {
+        return;
+    }
+
+    Warning("Shared memory connection to %s closed",
+            conn->peer.name.c_str());
+    std::lock_guard<std::mutex> lck(transport->connMtx);
+    event_del(conn->wakeEvent);
+    event_del(conn->closeEvent);
+    auto kv = transport->connections.find(conn->peer);
+    if (kv != transport->connections.end() && kv->second.get() == conn) {
+        transport->connections.erase(kv);
+    }
+}
+
+void
+ShmTransport::AcceptCallback(evutil_socket_t fd, short what, void *arg)
+{
+    ShmTransportListener *info = (ShmTransportListener *)arg;
+    ShmTransport *transport = info->transport;
+
+    int sock;
+    if ((sock = accept(fd, NULL, NULL)) < 0) {
+        PWarning("Failed to accept incoming connection");
+        return;
+    }
+
+    // The connecting side sends right after connect, so block for it
+    char name[SHM_MAX_NAME];
+    int fds[3];
+    struct iovec iov;
+    iov.iov_base = name;
+    iov.iov_len = sizeof(name);
+    char control[CMSG_SPACE(sizeof(fds))];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t n = recvmsg(sock, &msg, 0);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (n <= 0 || cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+        Warning("Invalid shared memory handshake");
+        close(sock);
+        return;
+    }
+    if (fcntl(sock, F_SETFL, O_NONBLOCK, 1)) {
+        PWarning("Failed to set O_NONBLOCK");
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    void *segment = mmap(NULL, sizeof(ShmSegment), PROT_READ | PROT_WRITE,
+                         MAP_SHARED, fds[0], 0);
+    close(fds[0]);
+    if (segment == MAP_FAILED) {
+        PWarning("Failed to map shared memory segment");
+        close(fds[1]);
+        close(fds[2]);
+        close(sock);
+        return;
+    }
+
+    auto conn =
+        std::make_shared<ShmConnection>(ShmTransportAddress(string(name, n)));
+    conn->transport = transport;
+    conn->receiver = info->receiver;
+    conn->segment = segment;
+    conn->in = &((ShmSegment *)segment)->rings[0];
+    conn->out = &((ShmSegment *)segment)->rings[1];
+    conn->wakeFd = fds[2];
+    conn->peerFd = fds[1];
+    conn->sockFd = sock;
+
+    std::lock_guard<std::mutex> lck(transport->connMtx);
+    transport->AddConnection(conn);
+}
+
+// Space for a frame of len bytes, or NULL if the ring is too full.
+// Nothing is visible to the consumer before PublishFrame.
+static char *
+ReserveFrame(ShmTransport::ShmRing *ring, size_t len)
+{
+    uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    size_t need = FrameSize(len);
+    size_t off = tail % SHM_RING_SIZE;
+    size_t skip = (SHM_RING_SIZE - off < need) ? SHM_RING_SIZE - off : 0;
+    if (SHM_RING_SIZE - (tail - head) < skip + need) {
+        return NULL;
+    }
+    if (skip > 0) {
+        ShmFrameHeader *h = (ShmFrameHeader *)(ring->data + off);
+        h->flags = FRAME_WRAP;
+        ring->tail.store(tail + skip, std::memory_order_release);
+        off = 0;
+    }
+    return ring->data + off + sizeof(ShmFrameHeader);
+}
+
+static void
+PublishFrame(ShmTransport::ShmRing *ring, MessageType type, size_t len,
+             uint32_t flags)
+{
+    uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+    ShmFrameHeader *h = (ShmFrameHeader *)(ring->data + tail % SHM_RING_SIZE);
+    h->len = len;
+    h->flags = flags;
+    h->type = type;
+    ring->tail.store(tail + FrameSize(len));
+}
+
+// Writes out as much of the backlog as fits. Returns whether anything
+// was published. Called with sendMtx held.
+bool
+ShmTransport::Flush(ShmConnection *conn)
+{
+    bool published = false;
+    while (!conn->backlog.empty()) {
+        const string &data = conn->backlog.front().second;
+        size_t len = std::min(data.size() - conn->backlogOffset,
+                              SHM_MAX_FRAGMENT);
+        char *ptr = ReserveFrame(conn->out, len);
+        if (ptr == NULL) {
+            // Ask to be woken once the consumer frees space, and look
+            // again in case it did before seeing the flag
+            conn->out->producerWaiting.store(1);
+            ptr = ReserveFrame(conn->out, len);
+            if (ptr == NULL) {
+                break;
+            }
+        }
+        memcpy(ptr, data.data() + conn->backlogOffset, len);
+        conn->backlogOffset += len;
+        bool more = conn->backlogOffset < data.size();
+        PublishFrame(conn->out, conn->backlog.front().first, len,
+                     more ? FRAME_MORE : 0);
+        published = true;
+        if (!more) {
+            conn->backlog.pop_front();
+            conn->backlogOffset = 0;
+        }
+    }
+    return published;
+}
+
+bool
+ShmTransport::SendMessageInternal(TransportReceiver *src,
+                                  const ShmTransportAddress &dst,
+                                  const Message &m,
+                                  bool multicast)
+{
+    std::shared_ptr<ShmConnection> conn;
+    {
+        std::lock_guard<std::mutex> lck(connMtx);
+        auto kv = connections.find(dst);
+        if (kv == connections.end()) {
+            conn = Connect(src, dst);
+            if (conn == NULL) {
+                return false;
+            }
+        } else {
+            conn = kv->second;
+        }
+    }
+
+    MessageType type = MessageTypeOf(m);
+    size_t dataLen = m.ByteSizeLong();
+
+    std::lock_guard<std::mutex> lck(conn->sendMtx);
+    char *ptr = NULL;
+    if (conn->backlog.empty() && dataLen <= SHM_MAX_FRAGMENT) {
+        ptr = ReserveFrame(conn->out, dataLen);
+    }
+    if (ptr != NULL) {
+        // Serialize straight into the ring
+        m.SerializeWithCachedSizesToArray((uint8_t *)ptr);
+        PublishFrame(conn->out, type, dataLen, 0);
+    } else {
+        conn->backlog.emplace_back(type, string());
+        m.SerializeToString(&conn->backlog.back().second);
+        if (!Flush(conn.get())) {
+            return true;
+        }
+    }
+
+    if (conn->out->consumerAwake.load() == 0) {
+        Signal(conn->peerFd);
+    }
+    return true;
+}
+
+// Delivers every frame in the ring. The consumer is marked awake while
+// it drains, and looks again after clearing the mark, so a frame
+// published in between is either seen here or signalled.
+void
+ShmTransport::Drain(ShmConnection *conn)
+{
+    ShmRing *in = conn->in;
+    in->consumerAwake.store(1);
+    for (;;) {
+        uint64_t head = in->head.load(std::memory_order_relaxed);
+        uint64_t tail = in->tail.load(std::memory_order_acquire);
+        if (head == tail) {
+            in->consumerAwake.store(0);
+            if (in->tail.load() == head) {
+                return;
+            }
+            in->consumerAwake.store(1);
+            continue;
+        }
+
+        while (head != tail) {
+            size_t off = head % SHM_RING_SIZE;
+            ShmFrameHeader *h = (ShmFrameHeader *)(in->data + off);
+            if (h->flags & FRAME_WRAP) {
+                head += SHM_RING_SIZE - off;
+                in->head.store(head);
+                continue;
+            }
+
+            // The view points into the ring, so the frame is only
+            // released after the upcall
+            const char *payload = (const char *)(h + 1);
+            if (!conn->partial.empty() || (h->flags & FRAME_MORE)) {
+                conn->partial.append(payload, h->len);
+                if (!(h->flags & FRAME_MORE)) {
+                    conn->receiver->ReceiveMessage(conn->peer, h->type,
+                                                   StringView(conn->partial));
+                    conn->partial.clear();
+                }
+            } else {
+                conn->receiver->ReceiveMessage(conn->peer, h->type,
+                                               StringView(payload, h->len));
+            }
+            head += FrameSize(h->len);
+            in->head.store(head);
+
+            if (in->producerWaiting.load() &&
+                in->producerWaiting.exchange(0)) {
+                Signal(conn->peerFd);
+            }
+        }
+    }
+}
+
+void
+ShmTransport::WakeCallback(evutil_socket_t fd, short what, void *arg)
+{
+    ShmConnection *conn = (ShmConnection *)arg;
+    ShmTransport *transport = conn->transport;
+
+    eventfd_t count;
+    eventfd_read(fd, &count);
+
+    transport->Drain(conn);
+
+    // We may also have been woken because the peer freed space
+    std::lock_guard<std::mutex> lck(conn->sendMtx);
+    if (!conn->backlog.empty() && transport->Flush(conn) &&
+        conn->out->consumerAwake.load() == 0) {
+        Signal(conn->peerFd);
+    }
+}
+
+void
+ShmTransport::Run()
+{
+    event_base_dispatch(libeventBase);
+}
+
+void
+ShmTransport::Stop()
+{
+    event_base_loopbreak(libeventBase);
+}
+
+int
+ShmTransport::Timer(uint64_t ms, timer_callback_t cb)
+{
+    return TimerMicros(ms * 1000, cb);
+}
+
+int
+ShmTransport::TimerMicros(uint64_t us, timer_callback_t cb)
+{
+    std::lock_guard<std::mutex> lck(mtx);
+
+    ShmTransportTimerInfo *info = new ShmTransportTimerInfo();
+
+    struct timeval tv;
+    tv.tv_sec = us/1000000;
+    tv.tv_usec = us % 1000000;
+
+    ++lastTimerId;
+
+    info->transport = this;
+    info->id = lastTimerId;
+    info->cb = cb;
+    info->ev = event_new(libeventBase, -1, 0, TimerCallback, info);
+
+    timers[info->id] = info;
+
+    event_add(info->ev, &tv);
+
+    return info->id;
+}
+
+bool
+ShmTransport::CancelTimer(int id)
+{
+    std::lock_guard<std::mutex> lck(mtx);
+    ShmTransportTimerInfo *info = timers[id];
+
+    if (info == NULL) {
+        return false;
+    }
+
+    timers.erase(info->id);
+    event_del(info->ev);
+    event_free(info->ev);
+    delete info;
+
+    return true;
+}
+
+void
+ShmTransport::CancelAllTimers()
+{
+    while (!timers.empty()) {
+        auto kv = timers.begin();
+        CancelTimer(kv->first);
+    }
+}
+
+void
+ShmTransport::OnTimer(ShmTransportTimerInfo *info)
+{
+    {
+        std::lock_guard<std::mutex> lck(mtx);
+
+        timers.erase(info->id);
+        event_del(info->ev);
+        event_free(info->ev);
+    }
+
+    info->cb();
+
+    delete info;
+}
+
+void
+ShmTransport::TimerCallback(evutil_socket_t fd, short what, void *arg)
+{
+    ShmTransport::ShmTransportTimerInfo *info =
+        (ShmTransport::ShmTransportTimerInfo *)arg;
+
+    ASSERT(what & EV_TIMEOUT);
+
+    info->transport->OnTimer(info);
+}
+
+void
+ShmTransport::SignalCallback(evutil_socket_t fd, short what, void *arg)
+{
+    ShmTransport *transport = (ShmTransport *)arg;
+    event_base_loopbreak(transport->libeventBase);
+}
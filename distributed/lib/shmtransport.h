@@ -0,0 +1,150 @@
+#ifndef _LIB_SHMTRANSPORT_H_
+#define _LIB_SHMTRANSPORT_H_
+
+#include "distributed/lib/configuration.h"
+#include "distributed/lib/transport.h"
+#include "distributed/lib/transportcommon.h"
+
+#include <event2/event.h>
+
+#include <atomic>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// Replicas listed as "replica shm:<path>" in a configuration are reached
+// through shared memory, with <path> naming their Unix socket
+#define SHM_HOST "shm"
+
+class ShmTransportAddress : public TransportAddress
+{
+public:
+    ShmTransportAddress * clone() const;
+private:
+    ShmTransportAddress(const string &name);
+
+    string name;
+    friend class ShmTransport;
+    friend bool operator==(const ShmTransportAddress &a,
+                           const ShmTransportAddress &b);
+    friend bool operator!=(const ShmTransportAddress &a,
+                           const ShmTransportAddress &b);
+    friend bool operator<(const ShmTransportAddress &a,
+                          const ShmTransportAddress &b);
+};
+
+// Transport between processes on the same host. Every connection is a
+// shared memory segment holding one single-producer single-consumer ring
+// per direction, and each side waits on an eventfd for the other to
+// publish frames or free space. The Unix socket is only used to hand the
+// segment and eventfds over when the connection is set up.
+//
+// Everything runs on one event loop, so upcalls are serialized.
+// SendMessage may be called from any thread. Messages that do not fit in
+// the ring are queued and written as the peer consumes, and those larger
+// than a quarter of the ring are split into several frames.
+class ShmTransport : public TransportCommon<ShmTransportAddress>
+{
+public:
+    ShmTransport(bool handleSignals = true);
+    virtual ~ShmTransport();
+    void Register(TransportReceiver *receiver,
+                  const transport::Configuration &config,
+                  int replicaIdx);
+    void Run();
+    void Stop();
+    int Timer(uint64_t ms, timer_callback_t cb);
+    int TimerMicros(uint64_t us, timer_callback_t cb);
+    bool CancelTimer(int id);
+    void CancelAllTimers();
+
+    // Whether the replicas in config are reached through shared memory.
+    // A process has one transport for all its peers, so a configuration
+    // naming both shared memory and network replicas is rejected.
+    static bool Covers(const transport::Configuration &config);
+
+    // Laid out in shared memory, defined in shmtransport.cc
+    struct ShmRing;
+
+private:
+    // Owned by connections and by the senders using it, so it is only
+    // unmapped and closed once it is out of the map and no send holds it
+    struct ShmConnection
+    {
+        ShmTransport *transport;
+        TransportReceiver *receiver;
+        ShmTransportAddress peer;
+        void *segment;
+        ShmRing *in;
+        ShmRing *out;
+        int wakeFd;             // signalled by the peer
+        int peerFd;             // signals the peer
+        int sockFd;             // only watched for the peer going away
+        event *wakeEvent;
+        event *closeEvent;
+        std::mutex sendMtx;     // the producer side of out, and backlog
+        std::deque<std::pair<MessageType, string> > backlog;
+        size_t backlogOffset;   // bytes of the front message written
+        string partial;         // message being reassembled from frames
+
+        ShmConnection(const ShmTransportAddress &peer)
+            : peer(peer), wakeEvent(NULL), closeEvent(NULL) { }
+        ~ShmConnection();
+    };
+    struct ShmTransportTimerInfo
+    {
+        ShmTransport *transport;
+        timer_callback_t cb;
+        event *ev;
+        int id;
+    };
+    struct ShmTransportListener
+    {
+        ShmTransport *transport;
+        TransportReceiver *receiver;
+        int acceptFd;
+        event *acceptEvent;
+    };
+
+    std::mutex mtx;             // timers
+    std::mutex connMtx;         // connections
+    event_base *libeventBase;
+    std::vector<event *> signalEvents;
+    int lastTimerId;
+    std::map<int, ShmTransportTimerInfo *> timers;
+    std::map<TransportReceiver *, string> names;
+    std::vector<ShmTransportListener *> listeners;
+    std::map<ShmTransportAddress,
+             std::shared_ptr<ShmConnection> > connections;
+    int nextClientId;
+
+    bool SendMessageInternal(TransportReceiver *src,
+                             const ShmTransportAddress &dst,
+                             const Message &m, bool multicast = false);
+    ShmTransportAddress
+    LookupAddress(const transport::Configuration &cfg,
+                  int replicaIdx);
+    const ShmTransportAddress *
+    LookupMulticastAddress(const transport::Configuration *config) { return NULL; };
+
+    std::shared_ptr<ShmConnection> Connect(TransportReceiver *src,
+                                           const ShmTransportAddress &dst);
+    void AddConnection(const std::shared_ptr<ShmConnection> &conn);
+    bool Flush(ShmConnection *conn);
+    void Drain(ShmConnection *conn);
+    void OnTimer(ShmTransportTimerInfo *info);
+    static void TimerCallback(evutil_socket_t fd,
+                              short what, void *arg);
+    static void SignalCallback(evutil_socket_t fd,
+                               short what, void *arg);
+    static void AcceptCallback(evutil_socket_t fd, short what,
+                               void *arg);
+    static void WakeCallback(evutil_socket_t fd, short what,
+                             void *arg);
+    static void CloseCallback(evutil_socket_t fd, short what,
+                              void *arg);
+};
+
+#endif  // _LIB_SHMTRANSPORT_H_
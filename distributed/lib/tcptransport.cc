@@ -19,6 +19,11 @@
 const size_t MAX_TCP_SIZE = 100; // XXX
 const uint32_t MAGIC = 0x06121983;
 
+// Connections are written to from any thread and their callbacks take the
+// upcall lock, so they must not run with the bufferevent lock held
+const int BEV_OPTIONS = (BEV_OPT_CLOSE_ON_FREE | BEV_OPT_THREADSAFE |
+                         BEV_OPT_DEFER_CALLBACKS | BEV_OPT_UNLOCK_CALLBACKS);
+
 using std::pair;
 
 TCPTransportAddress::TCPTransportAddress(const sockaddr_in &addr)
@@ -118,9 +123,10 @@ BindToPort(int fd, const string &host, const string &port)
 }
 
 TCPTransport::TCPTransport(double dropRate, double reorderRate,
-			   int dscp, bool handleSignals)
+			   int dscp, bool handleSignals, int nloops)
 {
     lastTimerId = 0;
+    nextIoBase = 0;
     
     // Set up libevent
     evthread_use_pthreads();
@@ -130,6 +136,12 @@ TCPTransport::TCPTransport(double dropRate, double reorderRate,
     libeventBase = event_base_new();
     evthread_make_base_notifiable(libeventBase);
 
+    for (int i = 1; i < nloops; i++) {
+        event_base *base = event_base_new();
+        evthread_make_base_notifiable(base);
+        ioBases.push_back(base);
+    }
+
     // Set up signal handler
     if (handleSignals) {
         signalEvents.push_back(evsignal_new(libeventBase, SIGTERM,
@@ -151,7 +163,7 @@ TCPTransport::~TCPTransport()
     // }
 }
 
-void
+struct bufferevent *
 TCPTransport::ConnectTCP(TransportReceiver *src, const TCPTransportAddress &dst)
 {
     // Create socket
@@ -182,8 +194,7 @@ TCPTransport::ConnectTCP(TransportReceiver *src, const TCPTransportAddress &dst)
     tcpListeners.push_back(info);
 
     struct bufferevent *bev =
-        bufferevent_socket_new(libeventBase, fd,
-                               BEV_OPT_CLOSE_ON_FREE);
+        bufferevent_socket_new(libeventBase, fd, BEV_OPTIONS);
     bufferevent_setcb(bev, TCPReadableCallback, NULL,
                       TCPOutgoingEventCallback, info);
     
@@ -192,23 +203,27 @@ TCPTransport::ConnectTCP(TransportReceiver *src, const TCPTransportAddress &dst)
                                    sizeof(dst.addr)) < 0) {
 	bufferevent_free(bev);
         Warning("Failed to connect to server via TCP");
-        return;
+        return NULL;
     }
     if (bufferevent_enable(bev, EV_READ|EV_WRITE) < 0) {
         Panic("Failed to enable bufferevent");
     }
 
-    // Tell the receiver its address
-    struct sockaddr_in sin;
-    socklen_t sinsize = sizeof(sin);
-    if (getsockname(fd, (sockaddr *) &sin, &sinsize) < 0) {
-        PPanic("Failed to get socket name");
+    // Tell the receiver its address, unless it is a replica that
+    // already knows its listening address
+    if (fds.find(src) == fds.end()) {
+        struct sockaddr_in sin;
+        socklen_t sinsize = sizeof(sin);
+        if (getsockname(fd, (sockaddr *) &sin, &sinsize) < 0) {
+            PPanic("Failed to get socket name");
+        }
+        TCPTransportAddress *addr = new TCPTransportAddress(sin);
+        src->SetAddress(addr);
     }
-    TCPTransportAddress *addr = new TCPTransportAddress(sin);
-    src->SetAddress(addr);
 
     tcpOutgoing[dst] = bev;
     tcpAddresses.insert(pair<struct bufferevent*, TCPTransportAddress>(bev,dst));
+    return bev;
 }
 
 void
@@ -295,27 +310,40 @@ TCPTransport::SendMessageInternal(TransportReceiver *src,
                                   const Message &m,
                                   bool multicast)
 {
-    auto kv = tcpOutgoing.find(dst);
-    // See if we have a connection open
-    if (kv == tcpOutgoing.end()) {
-        ConnectTCP(src, dst);
-        kv = tcpOutgoing.find(dst);
+    struct bufferevent *ev;
+    {
+        std::lock_guard<std::mutex> lck(connMtx);
+        auto kv = tcpOutgoing.find(dst);
+        // See if we have a connection open
+        if (kv == tcpOutgoing.end()) {
+            ev = ConnectTCP(src, dst);
+            if (ev == NULL) {
+                return false;
+            }
+        } else {
+            ev = kv->second;
+        }
     }
-    
-    struct bufferevent *ev = kv->second;
     ASSERT(ev != NULL);
 
-    // Serialize message
-    string data = m.SerializeAsString();
-    string type = m.GetTypeName();
-    size_t typeLen = type.length();
-    size_t dataLen = data.length();
-    size_t totalLen = (typeLen + sizeof(typeLen) +
+    // Serialize the message straight into the output buffer, so the
+    // frame is never staged in a temporary string or on the stack
+    MessageType type = MessageTypeOf(m);
+    size_t dataLen = m.ByteSizeLong();
+    size_t totalLen = (sizeof(type) +
                        dataLen + sizeof(dataLen) +
                        sizeof(totalLen) +
                        sizeof(uint32_t));
-    
-    char buf[totalLen];
+
+    struct evbuffer *out = bufferevent_get_output(ev);
+    struct evbuffer_iovec vec;
+    evbuffer_lock(out);
+    if (evbuffer_reserve_space(out, totalLen, &vec, 1) != 1) {
+        evbuffer_unlock(out);
+        Warning("Failed to reserve space in TCP buffer");
+        return false;
+    }
+    char *buf = (char *) vec.iov_base;
     char *ptr = buf;
 
     *((uint32_t *) ptr) = MAGIC;
@@ -326,25 +354,25 @@ TCPTransport::SendMessageInternal(TransportReceiver *src,
     ptr += sizeof(size_t);
     ASSERT((size_t)(ptr-buf) < totalLen);
 
-    *((size_t *) ptr) = typeLen;
-    ptr += sizeof(size_t);
+    *((MessageType *) ptr) = type;
+    ptr += sizeof(MessageType);
     ASSERT((size_t)(ptr-buf) < totalLen);
 
-    ASSERT((size_t)(ptr+typeLen-buf) < totalLen);
-    memcpy(ptr, type.c_str(), typeLen);
-    ptr += typeLen;
     *((size_t *) ptr) = dataLen;
     ptr += sizeof(size_t);
 
     ASSERT((size_t)(ptr-buf) < totalLen);
     ASSERT((size_t)(ptr+dataLen-buf) == totalLen);
-    memcpy(ptr, data.c_str(), dataLen);
+    m.SerializeWithCachedSizesToArray((uint8_t *) ptr);
     ptr += dataLen;
 
-    if (bufferevent_write(ev, buf, totalLen) < 0) {
+    vec.iov_len = totalLen;
+    if (evbuffer_commit_space(out, &vec, 1) < 0) {
+        evbuffer_unlock(out);
         Warning("Failed to write to TCP buffer");
         return false;
     }
+    evbuffer_unlock(out);
     
     return true;
 }
@@ -352,7 +380,21 @@ TCPTransport::SendMessageInternal(TransportReceiver *src,
 void
 TCPTransport::Run()
 {
+    for (event_base *base : ioBases) {
+        ioThreads.emplace_back([base]() {
+                event_base_loop(base, EVLOOP_NO_EXIT_ON_EMPTY);
+            });
+    }
+
     event_base_dispatch(libeventBase);
+
+    for (event_base *base : ioBases) {
+        event_base_loopbreak(base);
+    }
+    for (std::thread &t : ioThreads) {
+        t.join();
+    }
+    ioThreads.clear();
 }
 
 void
@@ -363,14 +405,20 @@ TCPTransport::Stop()
 
 int
 TCPTransport::Timer(uint64_t ms, timer_callback_t cb)
+{
+    return TimerMicros(ms * 1000, cb);
+}
+
+int
+TCPTransport::TimerMicros(uint64_t us, timer_callback_t cb)
 {
     std::lock_guard<std::mutex> lck(mtx);
     
     TCPTransportTimerInfo *info = new TCPTransportTimerInfo();
 
     struct timeval tv;
-    tv.tv_sec = ms/1000;
-    tv.tv_usec = (ms % 1000) * 1000;
+    tv.tv_sec = us/1000000;
+    tv.tv_usec = us % 1000000;
     
     ++lastTimerId;
     
@@ -425,7 +473,10 @@ TCPTransport::OnTimer(TCPTransportTimerInfo *info)
 	    event_free(info->ev);
     }
     
-    info->cb();
+    {
+        std::lock_guard<std::mutex> lck(upcallMtx);
+        info->cb();
+    }
 
     delete info;
 }
@@ -509,9 +560,13 @@ TCPTransport::TCPAcceptCallback(evutil_socket_t fd, short what, void *arg)
             PWarning("Failed to set TCP_NODELAY on TCP listening socket");
         }
 
-        // Create a buffered event
-        bev = bufferevent_socket_new(transport->libeventBase, newfd,
-                                     BEV_OPT_CLOSE_ON_FREE);
+        // Create a buffered event, on the next I/O loop if there are any
+        event_base *base = transport->libeventBase;
+        if (!transport->ioBases.empty()) {
+            base = transport->ioBases[transport->nextIoBase++ %
+                                      transport->ioBases.size()];
+        }
+        bev = bufferevent_socket_new(base, newfd, BEV_OPTIONS);
         bufferevent_setcb(bev, TCPReadableCallback, NULL,
                           TCPIncomingEventCallback, info);
         if (bufferevent_enable(bev, EV_READ|EV_WRITE) < 0) {
@@ -520,6 +575,7 @@ TCPTransport::TCPAcceptCallback(evutil_socket_t fd, short what, void *arg)
 
         info->connectionEvents.push_back(bev);
 	TCPTransportAddress client = TCPTransportAddress(sin);
+	std::lock_guard<std::mutex> lck(transport->connMtx);
 	transport->tcpOutgoing[client] = bev;
 	transport->tcpAddresses.insert(pair<struct bufferevent*, TCPTransportAddress>(bev,client));
     } 
@@ -535,56 +591,56 @@ TCPTransport::TCPReadableCallback(struct bufferevent *bev, void *arg)
         
 
     while (evbuffer_get_length(evbuf) > 0) {
-        uint32_t *magic;
-        magic = (uint32_t *)evbuffer_pullup(evbuf, sizeof(*magic));
-        if (magic == NULL) {
-            return;
-        }
-        ASSERT(*magic == MAGIC);
-    
         size_t *sz;
-        unsigned char *x = evbuffer_pullup(evbuf, sizeof(*magic) + sizeof(*sz));
-        
-        sz = (size_t *) (x + sizeof(*magic));
+        unsigned char *x = evbuffer_pullup(evbuf, sizeof(MAGIC) + sizeof(*sz));
         if (x == NULL) {
             return;
         }
+        ASSERT(*((uint32_t *) x) == MAGIC);
+
+        sz = (size_t *) (x + sizeof(MAGIC));
         size_t totalSize = *sz;
         ASSERT(totalSize < 1073741826);
         
         if (evbuffer_get_length(evbuf) < totalSize) {
             return;
         }
-                
-        char buf[totalSize];
-        size_t copied = evbuffer_remove(evbuf, buf, totalSize);
-        ASSERT(copied == totalSize);
+
+        // Make the frame contiguous and parse it in place. This is free
+        // when the frame already sits in a single chain.
+        char *buf = (char *) evbuffer_pullup(evbuf, totalSize);
+        ASSERT(buf != NULL);
         
         // Parse message
-        char *ptr = buf + sizeof(*sz) + sizeof(*magic);
+        char *ptr = buf + sizeof(*sz) + sizeof(MAGIC);
         
-        size_t typeLen = *((size_t *)ptr);
-        ptr += sizeof(size_t);
+        MessageType msgType = *((MessageType *)ptr);
+        ptr += sizeof(MessageType);
         ASSERT((size_t)(ptr-buf) < totalSize);
         
-        ASSERT((size_t)(ptr+typeLen-buf) < totalSize);
-        string msgType(ptr, typeLen);
-        ptr += typeLen;
-        
         size_t msgLen = *((size_t *)ptr);
         ptr += sizeof(size_t);
         ASSERT((size_t)(ptr-buf) < totalSize);
         
         ASSERT((size_t)(ptr+msgLen-buf) <= totalSize);
-        string msg(ptr, msgLen);
+        StringView msg(ptr, msgLen);
         ptr += msgLen;
         
+        std::unique_lock<std::mutex> connLck(transport->connMtx);
         auto addr = transport->tcpAddresses.find(bev);
         ASSERT(addr != transport->tcpAddresses.end());
+        TCPTransportAddress remote = addr->second;
+        connLck.unlock();
         
-        // Dispatch
-        info->receiver->ReceiveMessage(addr->second, msgType, msg);
-            }
+        // Dispatch, the views are only valid until the frame is drained.
+        // Only this loop reads from the input buffer, so it stays put
+        // without holding the bufferevent lock.
+        {
+            std::lock_guard<std::mutex> lck(transport->upcallMtx);
+            info->receiver->ReceiveMessage(remote, msgType, msg);
+        }
+        evbuffer_drain(evbuf, totalSize);
+    }
 }
 
 void
@@ -609,6 +665,7 @@ TCPTransport::TCPOutgoingEventCallback(struct bufferevent *bev,
 {
     TCPTransportTCPListener *info = (TCPTransportTCPListener *)arg;
     TCPTransport *transport = info->transport;
+    std::lock_guard<std::mutex> lck(transport->connMtx);
     auto it = transport->tcpAddresses.find(bev);    
     ASSERT(it != transport->tcpAddresses.end());
     TCPTransportAddress addr = it->second;
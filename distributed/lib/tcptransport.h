@@ -14,6 +14,7 @@
 #include <list>
 #include <random>
 #include <mutex>
+#include <thread>
 #include <netinet/in.h>
 
 class TCPTransportAddress : public TransportAddress
@@ -33,11 +34,17 @@ private:
                           const TCPTransportAddress &b);
 };
 
+// Timers, listeners and outgoing connections live on the main event
+// loop. With nloops > 1, accepted connections are spread round robin over
+// nloops - 1 additional loops that do the socket I/O and framing for
+// them. Upcalls into receivers are serialized whichever loop they come
+// from, and SendMessage may be called from any thread.
 class TCPTransport : public TransportCommon<TCPTransportAddress>
 {
 public:
     TCPTransport(double dropRate = 0.0, double reogrderRate = 0.0,
-                    int dscp = 0, bool handleSignals = true);
+                    int dscp = 0, bool handleSignals = true,
+                    int nloops = 1);
     virtual ~TCPTransport();
     void Register(TransportReceiver *receiver,
                   const transport::Configuration &config,
@@ -45,11 +52,14 @@ public:
     void Run();
     void Stop();
     int Timer(uint64_t ms, timer_callback_t cb);
+    int TimerMicros(uint64_t us, timer_callback_t cb);
     bool CancelTimer(int id);
     void CancelAllTimers();
     
 private:
     std::mutex mtx;
+    std::mutex connMtx;     // tcpOutgoing, tcpAddresses
+    std::mutex upcallMtx;   // serializes upcalls into receivers
     struct TCPTransportTimerInfo
     {
         TCPTransport *transport;
@@ -67,6 +77,9 @@ private:
         std::list<struct bufferevent *> connectionEvents;
     };
     event_base *libeventBase;
+    std::vector<event_base *> ioBases;
+    std::vector<std::thread> ioThreads;
+    size_t nextIoBase;
     std::vector<event *> listenerEvents;
     std::vector<event *> signalEvents;
     std::map<int, TransportReceiver*> receivers; // fd -> receiver
@@ -89,7 +102,8 @@ private:
     const TCPTransportAddress *
     LookupMulticastAddress(const transport::Configuration*config) { return NULL; };
 
-    void ConnectTCP(TransportReceiver *src, const TCPTransportAddress &dst);
+    struct bufferevent *
+    ConnectTCP(TransportReceiver *src, const TCPTransportAddress &dst);
     void OnTimer(TCPTransportTimerInfo *info);
     static void TimerCallback(evutil_socket_t fd,
                               short what, void *arg);
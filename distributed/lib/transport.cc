@@ -1,6 +1,60 @@
 #include "distributed/lib/assert.h"
 #include "distributed/lib/transport.h"
 
+MessageType
+MessageTypeOf(const ::google::protobuf::Message &m)
+{
+    // Hashed once per type and thread; every send looks it up
+    static thread_local std::unordered_map<
+        const ::google::protobuf::Descriptor *, MessageType> ids;
+    const ::google::protobuf::Descriptor *desc = m.GetDescriptor();
+    auto it = ids.find(desc);
+    if (it != ids.end()) {
+        return it->second;
+    }
+
+    // 32-bit FNV-1a over the full type name
+    MessageType h = 2166136261u;
+    for (char c : desc->full_name()) {
+        h ^= (unsigned char) c;
+        h *= 16777619u;
+    }
+    ids[desc] = h;
+    return h;
+}
+
+void
+MessageDispatcher::Add(Message *msg, handler_t handler)
+{
+    MessageType type = MessageTypeOf(*msg);
+    if (entries.find(type) != entries.end()) {
+        Panic("Message type id collision: %s (%u)",
+              msg->GetTypeName().c_str(), type);
+    }
+    Entry &e = entries[type];
+    e.msg.reset(msg);
+    e.handler = handler;
+}
+
+bool
+MessageDispatcher::Dispatch(const TransportAddress &remote,
+                            MessageType type, const StringView &data)
+{
+    auto it = entries.find(type);
+    if (it == entries.end()) {
+        return false;
+    }
+
+    Entry &e = it->second;
+    if (!e.msg->ParseFromArray(data.data(), data.size())) {
+        Warning("Failed to parse %s message",
+                e.msg->GetTypeName().c_str());
+        return true;
+    }
+    e.handler(remote, *e.msg);
+    return true;
+}
+
 TransportReceiver::~TransportReceiver()
 {
     delete this->myAddress;
@@ -19,7 +73,7 @@ TransportReceiver::GetAddress()
 }
 
 Timeout::Timeout(Transport *transport, uint64_t ms, timer_callback_t cb)
-    : transport(transport), ms(ms), cb(cb)
+    : transport(transport), us(ms * 1000), cb(cb)
 {
     timerId = 0;
 }
@@ -33,7 +87,14 @@ void
 Timeout::SetTimeout(uint64_t ms)
 {
     ASSERT(!Active());
-    this->ms = ms;
+    this->us = ms * 1000;
+}
+
+void
+Timeout::SetTimeoutMicros(uint64_t us)
+{
+    ASSERT(!Active());
+    this->us = us;
 }
 
 uint64_t
@@ -48,13 +109,13 @@ Timeout::Reset()
 {
     Stop();
     
-    timerId = transport->Timer(ms, [this]() {
+    timerId = transport->TimerMicros(us, [this]() {
             timerId = 0;
             Reset();
             cb();
         });
     
-    return ms;
+    return us / 1000;
 }
 
 void
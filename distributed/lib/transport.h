@@ -5,11 +5,36 @@
 
 #include <google/protobuf/message.h>
 #include <functional>
+#include <memory>
+#include <unordered_map>
 
 #define CLIENT_NETWORK_DELAY 0
 #define REPLICA_NETWORK_DELAY 0
 #define READ_AT_LEADER 1
 
+// Non-owning view of received bytes. It points into the transport's
+// input buffer and is only valid for the duration of the upcall.
+class StringView
+{
+public:
+    StringView() : ptr(NULL), len(0) { }
+    StringView(const char *ptr, size_t len) : ptr(ptr), len(len) { }
+    StringView(const string &s) : ptr(s.data()), len(s.size()) { }
+
+    const char *data() const { return ptr; }
+    size_t size() const { return len; }
+    string str() const { return string(ptr, len); }
+
+private:
+    const char *ptr;
+    size_t len;
+};
+
+// Wire id of a protobuf message type. It is derived from the full type
+// name, so every process agrees on it without exchanging a table.
+typedef uint32_t MessageType;
+MessageType MessageTypeOf(const ::google::protobuf::Message &m);
+
 class TransportAddress
 {
 public:
@@ -28,13 +53,49 @@ public:
     virtual const TransportAddress& GetAddress();
 
     virtual void ReceiveMessage(const TransportAddress &remote,
-                                const string &type, const string &data) = 0;
+                                MessageType type,
+                                const StringView &data) = 0;
 
     
 protected:
     const TransportAddress *myAddress;
 };
 
+// Per-receiver dispatch table from message type to handler. Each
+// registered type owns one message object that is reparsed in place for
+// every delivery, so handlers must copy whatever they keep past the call.
+class MessageDispatcher
+{
+public:
+    typedef ::google::protobuf::Message Message;
+    typedef std::function<void (const TransportAddress &,
+                                const Message &)> handler_t;
+
+    template <class R, class MSG>
+    void Register(R *receiver,
+                  void (R::*handler)(const TransportAddress &, const MSG &))
+    {
+        Add(new MSG(), [receiver, handler](const TransportAddress &remote,
+                                           const Message &m) {
+                (receiver->*handler)(remote, static_cast<const MSG &>(m));
+            });
+    }
+
+    // Returns false if no handler is registered for the type
+    bool Dispatch(const TransportAddress &remote,
+                  MessageType type, const StringView &data);
+
+private:
+    struct Entry
+    {
+        std::unique_ptr<Message> msg;
+        handler_t handler;
+    };
+    std::unordered_map<MessageType, Entry> entries;
+
+    void Add(Message *msg, handler_t handler);
+};
+
 typedef std::function<void (void)> timer_callback_t;
 
 class Transport
@@ -51,8 +112,11 @@ public:
     virtual bool SendMessageToReplica(TransportReceiver *src, int replicaIdx, const Message &m) = 0;
     virtual bool SendMessageToAll(TransportReceiver *src, const Message &m, bool fromSvr) = 0;
     virtual int Timer(uint64_t ms, timer_callback_t cb) = 0;
+    virtual int TimerMicros(uint64_t us, timer_callback_t cb) = 0;
     virtual bool CancelTimer(int id) = 0;
     virtual void CancelAllTimers() = 0;
+    virtual void Run() = 0;
+    virtual void Stop() = 0;
 };
 
 class Timeout
@@ -61,6 +125,7 @@ public:
     Timeout(Transport *transport, uint64_t ms, timer_callback_t cb);
     virtual ~Timeout();
     virtual void SetTimeout(uint64_t ms);
+    virtual void SetTimeoutMicros(uint64_t us);
     virtual uint64_t Start();
     virtual uint64_t Reset();
     virtual void Stop();
@@ -68,7 +133,7 @@ public:
     
 private:
     Transport *transport;
-    uint64_t ms;
+    uint64_t us;
     timer_callback_t cb;
     int timerId;
 };
@@ -0,0 +1,49 @@
+#include "distributed/lib/workerpool.h"
+
+WorkerPool::WorkerPool(unsigned int nthreads)
+    : stopping(false)
+{
+    for (unsigned int i = 0; i < nthreads; i++) {
+        threads.emplace_back(&WorkerPool::Run, this);
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lck(mtx);
+        stopping = true;
+    }
+    cv.notify_all();
+    for (std::thread &t : threads) {
+        t.join();
+    }
+}
+
+void
+WorkerPool::Submit(task_t task)
+{
+    {
+        std::lock_guard<std::mutex> lck(mtx);
+        tasks.push_back(std::move(task));
+    }
+    cv.notify_one();
+}
+
+void
+WorkerPool::Run()
+{
+    while (true) {
+        task_t task;
+        {
+            std::unique_lock<std::mutex> lck(mtx);
+            cv.wait(lck, [this]() { return stopping || !tasks.empty(); });
+            if (tasks.empty()) {
+                return;
+            }
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
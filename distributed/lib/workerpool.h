@@ -0,0 +1,32 @@
+#ifndef _LIB_WORKERPOOL_H_
+#define _LIB_WORKERPOOL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads draining a FIFO of tasks. The destructor runs
+// whatever is still queued before joining the threads.
+class WorkerPool
+{
+public:
+    typedef std::function<void (void)> task_t;
+
+    WorkerPool(unsigned int nthreads);
+    ~WorkerPool();
+    void Submit(task_t task);
+
+private:
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<task_t> tasks;
+    std::vector<std::thread> threads;
+    bool stopping;
+
+    void Run();
+};
+
+#endif  // _LIB_WORKERPOOL_H_
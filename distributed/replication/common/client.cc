@@ -45,10 +45,9 @@ Client::~Client()
 
 void
 Client::ReceiveMessage(const TransportAddress &remote,
-                       const string &type, const string &data)
+                       MessageType type, const StringView &data)
 {
-    Panic("Received unexpected message type: %s",
-          type.c_str());
+    Panic("Received unexpected message type: %u", type);
 }
 
 } // namespace replication
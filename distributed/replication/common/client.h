@@ -51,8 +51,8 @@ public:
         uint32_t timeout = DEFAULT_UNLOGGED_OP_TIMEOUT) = 0;
 
     virtual void ReceiveMessage(const TransportAddress &remote,
-                                const string &type,
-                                const string &data);
+                                MessageType type,
+                                const StringView &data);
 
 protected:
     transport::Configuration config;
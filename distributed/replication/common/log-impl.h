@@ -25,6 +25,10 @@ Log::Install(iter start, iter end)
     // Find the first divergence in the log
     iter it = start;
     for (it = start; it != end; it++) {
+        if (it->opnum() < FirstOpnum()) {
+            // Truncated here after it committed
+            continue;
+        }
         const LogEntry *oldEntry = Find(it->opnum());
         if (oldEntry == NULL) {
             break;
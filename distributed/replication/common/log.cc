@@ -111,6 +111,29 @@ Log::RemoveAfter(opnum_t op)
     ASSERT(LastOpnum() == op-1);
 }
 
+// Drops the entries before opnum, which must be committed on a quorum.
+// The log then starts at opnum, even if it held nothing that far yet.
+void
+Log::RemoveBefore(opnum_t op)
+{
+    if (op <= start) {
+        return;
+    }
+
+    if (op > LastOpnum()) {
+        // The hash of what we skipped is unknown
+        ASSERT(!useHash || op == LastOpnum()+1);
+        initialHash = LastHash();
+        entries.clear();
+    } else {
+        initialHash = Find(op-1)->hash;
+        entries.erase(entries.begin(), entries.begin() + (op-start));
+    }
+    start = op;
+
+    ASSERT(FirstOpnum() == op);
+}
+
 LogEntry *
 Log::Last()
 {
@@ -7,6 +7,7 @@
 #include "distributed/lib/transport.h"
 #include "distributed/replication/common/viewstamp.h"
 
+#include <deque>
 #include <map>
 #include <google/protobuf/message.h>
 
@@ -62,6 +63,7 @@ public:
     bool SetStatus(opnum_t opnum, LogEntryState state);
     bool SetRequest(opnum_t op, const Request &req);
     void RemoveAfter(opnum_t opnum);
+    void RemoveBefore(opnum_t opnum);
     LogEntry * Last();
     viewstamp_t LastViewstamp() const; // deprecated
     opnum_t LastOpnum() const;
@@ -76,7 +78,8 @@ public:
 
     
 private:
-    std::vector<LogEntry> entries;
+    // A deque so that truncating the front does not move the rest
+    std::deque<LogEntry> entries;
     string initialHash;
     opnum_t start;
     bool useHash;
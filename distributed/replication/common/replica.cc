@@ -39,4 +39,35 @@ Replica::UnloggedUpcall(const string &op, string &res)
     app->UnloggedUpcall(op, res);
 }
 
+bool
+Replica::Checkpoint(opnum_t opnum)
+{
+    return app->Checkpoint(opnum);
+}
+
+void
+Replica::SnapshotBase(string &base)
+{
+    app->SnapshotBase(base);
+}
+
+void
+Replica::Snapshot(const string &base,
+                  const std::function<void (string &part)> &send)
+{
+    app->Snapshot(base, send);
+}
+
+void
+Replica::RestorePart(opnum_t opnum, size_t part, const string &data)
+{
+    app->RestorePart(opnum, part, data);
+}
+
+void
+Replica::Restore(opnum_t opnum)
+{
+    app->Restore(opnum);
+}
+
 } // namespace replication
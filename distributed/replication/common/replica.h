@@ -8,6 +8,9 @@
 #include "distributed/lib/transport.h"
 #include "distributed/replication/common/viewstamp.h"
 
+#include <functional>
+#include <vector>
+
 namespace replication {
     
 class Replica;
@@ -27,8 +30,32 @@ public:
     virtual void LeaderUpcall(opnum_t opnum, const string &str1, bool &replicate, string &str2) { replicate = true; str2 = str1; };
     // Invoke callback on all replicas
     virtual void ReplicaUpcall(opnum_t opnum, const string &str1, string &str2) { };
-    // Invoke call back for unreplicated operations run on only one replica
+    // Invoke call back for unreplicated operations run on only one replica.
+    // May run on worker threads, concurrently with the other upcalls.
     virtual void UnloggedUpcall(const string &str1, string &str2) { };
+    // Called every checkpoint interval, once opnum has been applied.
+    // Returning true lets the replica drop its log up to here; replicas
+    // that fall further behind are then sent a Snapshot instead. The
+    // default keeps the whole log.
+    virtual bool Checkpoint(opnum_t opnum) { return false; };
+    // Describe the state this replica already has, so that a Snapshot
+    // sent to it can build on it
+    virtual void SnapshotBase(string &base) { };
+    // Capture the state left by every operation applied so far, for a
+    // replica whose SnapshotBase was base, handing it to send one part
+    // at a time as it is taken. Each part goes in its own message, so
+    // keep them well below the transport's message size; send may take
+    // the contents of part.
+    virtual void Snapshot(const string &base,
+                          const std::function<void (string &part)> &send) { };
+    // Receive the next part of a Snapshot taken at opnum on another
+    // replica. Parts arrive in order; part 0 starts a new snapshot and
+    // drops whatever an unfinished one left.
+    virtual void RestorePart(opnum_t opnum, size_t part, const string &data) { };
+    // Replace the state with the Snapshot whose parts were all passed to
+    // RestorePart. It reflects exactly the operations up to opnum; those
+    // after it are then applied from the log.
+    virtual void Restore(opnum_t opnum) { };
 };
 
 class Replica : public TransportReceiver
@@ -44,6 +71,12 @@ protected:
                                      const Request & msg,
                                      MSG &reply);
     void UnloggedUpcall(const string &op, string &res);
+    bool Checkpoint(opnum_t opnum);
+    void SnapshotBase(string &base);
+    void Snapshot(const string &base,
+                  const std::function<void (string &part)> &send);
+    void RestorePart(opnum_t opnum, size_t part, const string &data);
+    void Restore(opnum_t opnum);
     template<class MSG> void ExecuteUnlogged(const UnloggedRequest & msg,
                                                MSG &reply);
     
@@ -15,6 +15,10 @@ VRClient::VRClient(const transport::Configuration &config,
     : Client(config, transport, clientid)
 {
     lastReqId = 0;
+    lastOpnum = 0;
+
+    dispatcher.Register(this, &VRClient::HandleReply);
+    dispatcher.Register(this, &VRClient::HandleUnloggedReply);
 }
 
 VRClient::~VRClient()
@@ -56,6 +60,7 @@ VRClient::InvokeUnlogged(int replicaIdx,
     reqMsg.mutable_req()->set_op(request);
     reqMsg.mutable_req()->set_clientid(clientid);
     reqMsg.mutable_req()->set_clientreqid(reqId);
+    reqMsg.mutable_req()->set_minopnum(lastOpnum);
 
     if (transport->SendMessageToReplica(this, replicaIdx, reqMsg)) {
         Timeout *timer =
@@ -79,6 +84,13 @@ VRClient::SendRequest(const PendingRequest *req)
     reqMsg.mutable_req()->set_op(req->request);
     reqMsg.mutable_req()->set_clientid(clientid);
     reqMsg.mutable_req()->set_clientreqid(req->clientReqId);
+    // several requests may be in flight, replicas have to keep the
+    // entries of all of them for a resend
+    uint64_t oldest = req->clientReqId;
+    for (auto &kv : pendingReqs) {
+        oldest = std::min(oldest, kv.first);
+    }
+    reqMsg.mutable_req()->set_oldestreqid(oldest);
 
     //    // XXX Try sending only to (what we think is) the leader first
     if (transport->SendMessageToAll(this, reqMsg, false)) {
@@ -104,18 +116,10 @@ VRClient::ResendRequest(const uint64_t reqId)
 
 void
 VRClient::ReceiveMessage(const TransportAddress &remote,
-                         const string &type,
-                         const string &data)
+                         MessageType type,
+                         const StringView &data)
 {
-    proto::ReplyMessage reply;
-    proto::UnloggedReplyMessage unloggedReply;
-    if (type == reply.GetTypeName()) {
-        reply.ParseFromString(data);
-        HandleReply(remote, reply);
-    } else if (type == unloggedReply.GetTypeName()) {
-        unloggedReply.ParseFromString(data);
-        HandleUnloggedReply(remote, unloggedReply);
-    } else {
+    if (!dispatcher.Dispatch(remote, type, data)) {
         Client::ReceiveMessage(remote, type, data);
     }
 }
@@ -130,6 +134,10 @@ VRClient::HandleReply(const TransportAddress &remote,
                 return;
     }
 
+    if (msg.opnum() > lastOpnum) {
+        lastOpnum = msg.opnum();
+    }
+
     PendingRequest *req = it->second;
         req->timer->Stop();
     pendingReqs.erase(it);
@@ -26,12 +26,17 @@ public:
                                 error_continuation_t error_continuation = nullptr,
                                 uint32_t timeout = DEFAULT_UNLOGGED_OP_TIMEOUT);
     virtual void ReceiveMessage(const TransportAddress &remote,
-                                const string &type, const string &data);
+                                MessageType type,
+                                const StringView &data);
 
 protected:
     int view;
     int opnumber;
     uint64_t lastReqId;
+    // Highest committed operation seen in a reply. Unlogged requests
+    // carry it so that whichever replica serves them is at least as
+    // recent as what this client has observed.
+    opnum_t lastOpnum;
 
     struct PendingRequest
     {
@@ -61,6 +66,7 @@ protected:
     };
 
     std::unordered_map<uint64_t, PendingRequest *> pendingReqs;
+    MessageDispatcher dispatcher;
 
     void SendRequest(const PendingRequest *req);
     void ResendRequest(const uint64_t reqId);
@@ -0,0 +1,64 @@
+#include "distributed/replication/vr/clienttable.h"
+
+namespace replication {
+namespace vr {
+
+bool
+ClientTable::Seen(const Request &req) const
+{
+    auto client = clients.find(req.clientid());
+    if (client == clients.end()) {
+        return false;
+    }
+    return req.clientreqid() < client->second.oldest ||
+        client->second.requests.count(req.clientreqid()) > 0;
+}
+
+const ClientTable::Entry *
+ClientTable::Find(const Request &req) const
+{
+    auto client = clients.find(req.clientid());
+    if (client == clients.end()) {
+        return nullptr;
+    }
+    auto entry = client->second.requests.find(req.clientreqid());
+    if (entry == client->second.requests.end()) {
+        return nullptr;
+    }
+    return &entry->second;
+}
+
+void
+ClientTable::Add(const Request &req)
+{
+    Client &client = clients[req.clientid()];
+    // requests may arrive out of order, so the bound never moves back
+    if (req.oldestreqid() > client.oldest) {
+        client.oldest = req.oldestreqid();
+        client.requests.erase(client.requests.begin(),
+                              client.requests.lower_bound(client.oldest));
+    }
+    if (req.clientreqid() < client.oldest ||
+        client.requests.count(req.clientreqid()) > 0) {
+        return;
+    }
+    client.requests[req.clientreqid()].replied = false;
+}
+
+void
+ClientTable::SetReply(const Request &req, const proto::ReplyMessage &reply)
+{
+    auto client = clients.find(req.clientid());
+    if (client == clients.end()) {
+        return;
+    }
+    auto entry = client->second.requests.find(req.clientreqid());
+    if (entry == client->second.requests.end()) {
+        return;
+    }
+    entry->second.replied = true;
+    entry->second.reply = reply;
+}
+
+} // namespace replication::vr
+} // namespace replication
@@ -0,0 +1,52 @@
+#ifndef _VR_CLIENTTABLE_H_
+#define _VR_CLIENTTABLE_H_
+
+#include "distributed/proto/request.pb.h"
+#include "distributed/proto/vr-proto.pb.h"
+
+#include <map>
+
+namespace replication {
+namespace vr {
+
+// Requests each client may still resend, kept per request so that a
+// client with several requests in flight gets every one of them executed
+// once and answered again on a resend. Clients report their oldest
+// request still waiting for a reply, and older entries are forgotten.
+class ClientTable
+{
+public:
+    struct Entry
+    {
+        bool replied;
+        proto::ReplyMessage reply;
+    };
+
+    // whether req was executed already, or is older than anything its
+    // client still waits for
+    bool Seen(const Request &req) const;
+
+    // the entry of req, nullptr if there is none
+    const Entry *Find(const Request &req) const;
+
+    // records req as executed, and forgets the client's requests below
+    // the oldest one it still waits for
+    void Add(const Request &req);
+
+    // keeps the reply to resend, unless the client has moved past req
+    void SetReply(const Request &req, const proto::ReplyMessage &reply);
+
+private:
+    struct Client
+    {
+        Client() : oldest(0) { }
+        uint64_t oldest;
+        std::map<uint64_t, Entry> requests;
+    };
+    std::map<uint64_t, Client> clients;
+};
+
+} // namespace replication::vr
+} // namespace replication
+
+#endif  /* _VR_CLIENTTABLE_H_ */
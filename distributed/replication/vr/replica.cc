@@ -20,9 +20,12 @@ using namespace proto;
     
 VRReplica::VRReplica(transport::Configuration config, int myIdx,
                      Transport *transport, unsigned int batchSize,
-                     AppReplica *app)
+                     AppReplica *app, unsigned int nworkers,
+                     uint64_t batchDelayUs, opnum_t checkpointInterval)
     : Replica(config, myIdx, transport, app),
       batchSize(batchSize),
+      batchTarget(1),
+      checkpointInterval(checkpointInterval),
       log(false),
       prepareOKQuorum(config.QuorumSize()-1),
       startViewChangeQuorum(config.QuorumSize()-1),
@@ -34,12 +37,33 @@ VRReplica::VRReplica(transport::Configuration config, int myIdx,
     this->lastCommitted = 0;
     this->lastRequestStateTransferView = 0;
     this->lastRequestStateTransferOpnum = 0;
+    this->lastRequestStateTransferIdx = myIdx;
     lastBatchEnd = 0;
+    lastCheckpoint = 0;
+    batchStats = BatchStats();
+    snapshotTransfer = SnapshotTransfer();
 
     if (batchSize > 1) {
-        Notice("Batching enabled; batch size %d", batchSize);
+        Notice("Batching enabled; batch size up to %d, delay %lu us",
+               batchSize, batchDelayUs);
     }
 
+    if (nworkers > 0) {
+        Notice("Running unlogged requests on %u workers", nworkers);
+        unloggedWorkers.reset(new WorkerPool(nworkers));
+    }
+
+    dispatcher.Register(this, &VRReplica::HandleRequest);
+    dispatcher.Register(this, &VRReplica::HandleUnloggedRequest);
+    dispatcher.Register(this, &VRReplica::HandlePrepare);
+    dispatcher.Register(this, &VRReplica::HandlePrepareOK);
+    dispatcher.Register(this, &VRReplica::HandleCommit);
+    dispatcher.Register(this, &VRReplica::HandleRequestStateTransfer);
+    dispatcher.Register(this, &VRReplica::HandleStateTransfer);
+    dispatcher.Register(this, &VRReplica::HandleStartViewChange);
+    dispatcher.Register(this, &VRReplica::HandleDoViewChange);
+    dispatcher.Register(this, &VRReplica::HandleStartView);
+
     this->viewChangeTimeout = new Timeout(transport, 5000, [this]() {
             StartViewChange(view+1);
         });
@@ -49,14 +73,29 @@ VRReplica::VRReplica(transport::Configuration config, int myIdx,
     this->stateTransferTimeout = new Timeout(transport, 1000, [this]() {
             this->lastRequestStateTransferView = 0;
             this->lastRequestStateTransferOpnum = 0;            
+            // Give up on a snapshot whose sender went quiet
+            if ((snapshotTransfer.parts > 0) &&
+                ++snapshotTransfer.idleTicks > 5) {
+                Notice("Dropping incomplete snapshot from replica %d",
+                       snapshotTransfer.replicaIdx);
+                snapshotTransfer.parts = 0;
+            }
         });
     this->stateTransferTimeout->Start();
     this->resendPrepareTimeout = new Timeout(transport, 500, [this]() {
             ResendPrepare();
         });
-    this->closeBatchTimeout = new Timeout(transport, 300, [this]() {
+    this->closeBatchTimeout = new Timeout(transport, 0, [this]() {
+            // The delay ran out before the batch filled, aim lower
+            batchTarget = std::max<unsigned int>(lastOp - lastBatchEnd, 1);
+            batchStats.timedOut++;
             CloseBatch();
         });
+    this->closeBatchTimeout->SetTimeoutMicros(batchDelayUs);
+    this->batchStatsTimeout = new Timeout(transport, 10000, [this]() {
+            LogBatchStats();
+        });
+    this->batchStatsTimeout->Start();
 
     if (AmLeader()) {
         nullCommitTimeout->Start();
@@ -67,11 +106,15 @@ VRReplica::VRReplica(transport::Configuration config, int myIdx,
 
 VRReplica::~VRReplica()
 {
+    // Drain outstanding unlogged requests before anything they use goes
+    unloggedWorkers.reset();
+
     delete viewChangeTimeout;
     delete nullCommitTimeout;
     delete stateTransferTimeout;
     delete resendPrepareTimeout;
     delete closeBatchTimeout;
+    delete batchStatsTimeout;
     
     for (auto &kv : pendingPrepares) {
         delete kv.first;
@@ -91,14 +134,21 @@ VRReplica::CommitUpTo(opnum_t upto)
         lastCommitted++;
 
         /* Find operation in log */
-        const LogEntry *entry = log.Find(lastCommitted);
+        LogEntry *entry = log.Find(lastCommitted);
         if (!entry) {
             RPanic("Did not find operation " FMT_OPNUM " in log", lastCommitted);
         }
 
-        /* Execute it */
+        /* Execute it, unless LeaderUpcall already did */
         ReplyMessage reply;
-        Execute(lastCommitted, entry->request, reply);
+        if (entry->replyMessage) {
+            reply = *static_cast<const ReplyMessage *>(entry->replyMessage);
+            // Only needed until now; the client table keeps the copy
+            delete entry->replyMessage;
+            entry->replyMessage = NULL;
+        } else {
+            Execute(lastCommitted, entry->request, reply);
+        }
 
         reply.set_view(entry->viewstamp.view);
         reply.set_opnum(entry->viewstamp.opnum);
@@ -108,25 +158,86 @@ VRReplica::CommitUpTo(opnum_t upto)
         log.SetStatus(lastCommitted, LOG_STATE_COMMITTED);
 
         // Store reply in the client table
-        ClientTableEntry &cte =
-            clientTable[entry->request.clientid()];
-        if (cte.lastReqId <= entry->request.clientreqid()) {
-            cte.lastReqId = entry->request.clientreqid();
-            cte.replied = true;
-            cte.reply = reply;            
-        } else {
-            // We've subsequently prepared another operation from the
-            // same client. So this request must have been completed
-            // at the client, and there's no need to record the
-            // result.
-        }
+        clientTable.SetReply(entry->request, reply);
         
         /* Send reply */
         auto iter = clientAddresses.find(entry->request.clientid());
         if (iter != clientAddresses.end()) {
             transport->SendMessage(this, *iter->second, reply);
         }
+
+        if (checkpointInterval > 0 &&
+            lastCommitted - lastCheckpoint >= checkpointInterval) {
+            TakeCheckpoint();
+        }
+    }
+
+    /* Serve the reads that were waiting for these operations */
+    while (!pendingUnlogged.empty() &&
+           pendingUnlogged.begin()->first <= lastCommitted) {
+        auto it = pendingUnlogged.begin();
+        ServeUnlogged(*it->second.first, it->second.second);
+        pendingUnlogged.erase(it);
+    }
+}
+
+// Keeps the log bounded. Each checkpoint drops the entries up to the
+// previous one, so that replicas less than an interval behind can
+// still catch up from the log, and older ones get a snapshot.
+void
+VRReplica::TakeCheckpoint()
+{
+    if (!Checkpoint(lastCommitted)) {
+        Notice("App does not support checkpoints; keeping the whole log");
+        checkpointInterval = 0;
+        return;
+    }
+
+    log.RemoveBefore(lastCheckpoint+1);
+    lastCheckpoint = lastCommitted;
+}
+
+// Whether the app state holds operations that have not committed yet,
+// which LeaderUpcall applies as soon as it accepts them
+bool
+VRReplica::AppliedPastCommit()
+{
+    for (opnum_t i = lastCommitted+1; i <= lastOp; i++) {
+        const LogEntry *entry = log.Find(i);
+        if (entry && entry->replyMessage) {
+            return true;
+        }
     }
+    return false;
+}
+
+// Passes the parts of a snapshot on to the app, in order and from one
+// sender at a time. Returns true once msg completes it.
+bool
+VRReplica::AddSnapshotPart(const StateTransferMessage &msg)
+{
+    SnapshotTransfer &t = snapshotTransfer;
+    if (msg.snapshotpart() == 0) {
+        // The same sender may start over, others wait for it to finish
+        if ((t.parts > 0) && (t.replicaIdx != (int)msg.replicaidx())) {
+            return false;
+        }
+        t.replicaIdx = msg.replicaidx();
+        t.view = msg.view();
+        t.opnum = msg.snapshotopnum();
+        t.parts = 0;
+    } else if ((t.parts == 0) ||
+               (t.replicaIdx != (int)msg.replicaidx()) ||
+               (t.view != msg.view()) ||
+               (t.opnum != msg.snapshotopnum()) ||
+               (t.parts != msg.snapshotpart())) {
+        return false;
+    }
+
+    t.idleTicks = 0;
+    RestorePart(t.opnum, t.parts++, msg.snapshot());
+    // Only the last part knows how many there are
+    return msg.has_snapshotparts() && (t.parts >= msg.snapshotparts());
 }
 
 void
@@ -144,7 +255,7 @@ VRReplica::SendPrepareOKs(opnum_t oldLastOp)
             RPanic("Did not find operation " FMT_OPNUM " in log", i);
         }
         ASSERT(entry->state == LOG_STATE_PREPARED);
-        UpdateClientTable(entry->request);
+        clientTable.Add(entry->request);
 
         PrepareOKMessage reply;
         reply.set_view(view);
@@ -172,11 +283,26 @@ VRReplica::RequestStateTransfer()
         return;
     }
 
+    // The snapshot on its way brings us up to date
+    if ((snapshotTransfer.parts > 0) || (configuration.n < 2)) {
+        return;
+    }
+
     this->lastRequestStateTransferView = view;
     this->lastRequestStateTransferOpnum = lastCommitted;
 
-    if (!transport->SendMessageToAll(this, m, true)) {
-        RWarning("Failed to send RequestStateTransfer message to all replicas");
+    // Ask one replica, the next one on each retry, so that a lagging
+    // replica does not get a snapshot from every other replica at once
+    int target = lastRequestStateTransferIdx;
+    do {
+        target = (target + 1) % configuration.n;
+    } while (target == myIdx);
+    this->lastRequestStateTransferIdx = target;
+
+    SnapshotBase(*m.mutable_snapshotbase());
+    if (!transport->SendMessageToReplica(this, target, m)) {
+        RWarning("Failed to send RequestStateTransfer message to replica %d",
+                 target);
     }
 }
 
@@ -237,22 +363,6 @@ VRReplica::SendNullCommit()
     }
 }
 
-void
-VRReplica::UpdateClientTable(const Request &req)
-{
-    ClientTableEntry &entry = clientTable[req.clientid()];
-
-    ASSERT(entry.lastReqId <= req.clientreqid());
-
-    if (entry.lastReqId == req.clientreqid()) {
-        return;
-    }
-
-    entry.lastReqId = req.clientreqid();
-    entry.replied = false;
-    entry.reply.Clear();
-}
-
 void
 VRReplica::ResendPrepare()
 {
@@ -265,6 +375,28 @@ VRReplica::ResendPrepare()
     }
 }
 
+// Called on the leader for every new operation. An idle leader sends
+// it right away, since waiting could only add latency. While earlier
+// batches are still out, operations accumulate until the batch reaches
+// batchTarget, the previous batches commit, or the batch delay expires.
+// A batch that fills up doubles the target for the next one.
+void
+VRReplica::AddToBatch()
+{
+    unsigned int pending = lastOp - lastBatchEnd;
+
+    if (lastBatchEnd == lastCommitted) {
+        batchTarget = std::max<unsigned int>(batchTarget / 2, 1);
+        CloseBatch();
+    } else if (pending >= batchTarget) {
+        batchTarget = std::min(batchTarget * 2, std::max(batchSize, 1u));
+        batchStats.full++;
+        CloseBatch();
+    } else if (!closeBatchTimeout->Active()) {
+        closeBatchTimeout->Start();
+    }
+}
+
 void
 VRReplica::CloseBatch()
 {
@@ -273,6 +405,11 @@ VRReplica::CloseBatch()
 
     opnum_t batchStart = lastBatchEnd+1;
 
+    uint64_t size = lastOp - lastBatchEnd;
+    batchStats.batches++;
+    batchStats.ops += size;
+    batchStats.maxSize = std::max(batchStats.maxSize, size);
+
     /* Send prepare messages */
     PrepareMessage p;
     p.set_view(view);
@@ -296,62 +433,35 @@ VRReplica::CloseBatch()
     
     resendPrepareTimeout->Reset();
     closeBatchTimeout->Stop();
+
+    // Without backups the leader alone is a quorum
+    if (configuration.QuorumSize() == 1) {
+        CommitUpTo(lastOp);
+    }
+}
+
+void
+VRReplica::LogBatchStats()
+{
+    if (batchStats.batches == 0) {
+        return;
+    }
+    Notice("Batching: %lu batches, mean size %.2f, max %lu, "
+           "%lu full, %lu timed out, target %u",
+           batchStats.batches,
+           (double) batchStats.ops / batchStats.batches,
+           batchStats.maxSize, batchStats.full, batchStats.timedOut,
+           batchTarget);
+    batchStats = BatchStats();
 }
 
 void
 VRReplica::ReceiveMessage(const TransportAddress &remote,
-                          const string &type, const string &data)
+                          MessageType type, const StringView &data)
 {
-    timeval t0, t1;
-    gettimeofday(&t0, NULL);
-    
-    RequestMessage request;
-    UnloggedRequestMessage unloggedRequest;
-    PrepareMessage prepare;
-    PrepareOKMessage prepareOK;
-    CommitMessage commit;
-    RequestStateTransferMessage requestStateTransfer;
-    StateTransferMessage stateTransfer;
-    StartViewChangeMessage startViewChange;
-    DoViewChangeMessage doViewChange;
-    StartViewMessage startView;
-    
-    if (type == request.GetTypeName()) {
-        request.ParseFromString(data);
-        HandleRequest(remote, request);
-    } else if (type == unloggedRequest.GetTypeName()) {
-        unloggedRequest.ParseFromString(data);
-        HandleUnloggedRequest(remote, unloggedRequest);
-    } else if (type == prepare.GetTypeName()) {
-        prepare.ParseFromString(data);
-        HandlePrepare(remote, prepare);
-    } else if (type == prepareOK.GetTypeName()) {
-        prepareOK.ParseFromString(data);
-        HandlePrepareOK(remote, prepareOK);
-    } else if (type == commit.GetTypeName()) {
-        commit.ParseFromString(data);
-        HandleCommit(remote, commit);
-    } else if (type == requestStateTransfer.GetTypeName()) {
-        requestStateTransfer.ParseFromString(data);
-        HandleRequestStateTransfer(remote, requestStateTransfer);
-    } else if (type == stateTransfer.GetTypeName()) {
-        stateTransfer.ParseFromString(data);
-        HandleStateTransfer(remote, stateTransfer);
-    } else if (type == startViewChange.GetTypeName()) {
-        startViewChange.ParseFromString(data);
-        HandleStartViewChange(remote, startViewChange);
-    } else if (type == doViewChange.GetTypeName()) {
-        doViewChange.ParseFromString(data);
-        HandleDoViewChange(remote, doViewChange);
-    } else if (type == startView.GetTypeName()) {
-        startView.ParseFromString(data);
-        HandleStartView(remote, startView);
-    } else {
-        RPanic("Received unexpected message type in VR proto: %s",
-              type.c_str());
+    if (!dispatcher.Dispatch(remote, type, data)) {
+        RPanic("Received unexpected message type in VR proto: %u", type);
     }
-    gettimeofday(&t1, NULL);
-    //std::cout << ((t1.tv_sec - t0.tv_sec)*1000000 + (t1.tv_usec - t0.tv_usec)) << std::endl;
 }
 
 void
@@ -376,38 +486,27 @@ VRReplica::HandleRequest(const TransportAddress &remote,
             std::unique_ptr<TransportAddress>(remote.clone())));
 
     // Check the client table to see if this is a duplicate request
-    auto kv = clientTable.find(msg.req().clientid());
-    if (kv != clientTable.end()) {
-        const ClientTableEntry &entry = kv->second;
-        if (msg.req().clientreqid() < entry.lastReqId) {
-            return;
-        }
-        if (msg.req().clientreqid() == entry.lastReqId) {
-            // This is a duplicate request. Resend the reply if we
-            // have one. We might not have a reply to resend if we're
-            // waiting for the other replicas; in that case, just
-            // discard the request.
-            if (entry.replied) {
-                if (!(transport->SendMessage(this, remote,
-                                             entry.reply))) {
-                    RWarning("Failed to resend reply to client");
-                }
-                return;
-            } else {
-                return;
+    if (clientTable.Seen(msg.req())) {
+        // Resend the reply if we have one. We might not have a reply
+        // to resend if we're waiting for the other replicas, or if the
+        // client no longer waits for it; in that case, just discard
+        // the request.
+        const ClientTable::Entry *entry = clientTable.Find(msg.req());
+        if (entry != nullptr && entry->replied) {
+            if (!(transport->SendMessage(this, remote, entry->reply))) {
+                RWarning("Failed to resend reply to client");
             }
         }
+        return;
     }
 
     // Update the client table
-    UpdateClientTable(msg.req());
+    clientTable.Add(msg.req());
 
     // Leader Upcall
     bool replicate = false;
     string res;
     LeaderUpcall(lastCommitted, msg.req().op(), replicate, res);
-    ClientTableEntry &cte =
-        clientTable[msg.req().clientid()];
 
     // Check whether this request should be committed to replicas
     if (!replicate) {
@@ -417,20 +516,25 @@ VRReplica::HandleRequest(const TransportAddress &remote,
         reply.set_view(0);
         reply.set_opnum(0);
         reply.set_clientreqid(msg.req().clientreqid());
-        cte.replied = true;
-        cte.reply = reply;
+        clientTable.SetReply(msg.req(), reply);
         transport->SendMessage(this, remote, reply);
     } else {
-        ReplyMessage reply;
+        /* Assign it an opnum */
         ++this->lastOp;
-        ++this->lastCommitted;
-        reply.set_reply(res);
-        reply.set_view(this->view);
-        reply.set_opnum(this->lastOp);
-        reply.set_clientreqid(msg.req().clientreqid());
-        cte.replied = true;
-        cte.reply = reply;
-        transport->SendMessage(this, remote, reply);
+        v.view = this->view;
+        v.opnum = this->lastOp;
+
+        /* Add the request to my log */
+        LogEntry &entry = log.Append(v, msg.req(), LOG_STATE_PREPARED);
+
+        // LeaderUpcall already applied the operation here, so keep its
+        // result to reply with once the operation commits
+        ReplyMessage *reply = new ReplyMessage();
+        reply->set_reply(res);
+        entry.replyMessage = reply;
+
+        AddToBatch();
+        nullCommitTimeout->Reset();
     }
 }
 
@@ -444,11 +548,44 @@ VRReplica::HandleUnloggedRequest(const TransportAddress &remote,
         return;
     }
 
+    // Any replica may answer, but not before it has caught up with
+    // what the client has already seen committed
+    if (msg.req().minopnum() > lastCommitted) {
+        pendingUnlogged.emplace(
+            msg.req().minopnum(),
+            std::make_pair(std::unique_ptr<TransportAddress>(remote.clone()),
+                           msg.req()));
+        return;
+    }
+
+    ServeUnlogged(remote, msg.req());
+}
+
+void
+VRReplica::ServeUnlogged(const TransportAddress &remote,
+                         const UnloggedRequest &unlogged)
+{
+    if (unloggedWorkers) {
+        // The app answers unlogged requests from its committed state, so
+        // they do not have to wait behind the ordered path. The reply is
+        // queued on the client's connection and written by its loop.
+        std::shared_ptr<TransportAddress> client(remote.clone());
+        std::shared_ptr<UnloggedRequest> req(new UnloggedRequest(unlogged));
+        unloggedWorkers->Submit([this, client, req]() {
+                UnloggedReplyMessage reply;
+                ExecuteUnlogged(*req, reply);
+                reply.set_clientreqid(req->clientreqid());
+                if (!(transport->SendMessage(this, *client, reply)))
+                    Warning("Failed to send reply message");
+            });
+        return;
+    }
+
     UnloggedReplyMessage reply;
     
     
-    ExecuteUnlogged(msg.req(), reply);
-    reply.set_clientreqid(msg.req().clientreqid());
+    ExecuteUnlogged(unlogged, reply);
+    reply.set_clientreqid(unlogged.clientreqid());
 
     if (!(transport->SendMessage(this, remote, reply)))
         Warning("Failed to send reply message");
@@ -511,7 +648,7 @@ VRReplica::HandlePrepare(const TransportAddress &remote,
         this->lastOp++;
         log.Append(viewstamp_t(msg.view(), op),
                    req, LOG_STATE_PREPARED);
-        UpdateClientTable(req);
+        clientTable.Add(req);
     }
     ASSERT(op == msg.opnum());
     
@@ -565,6 +702,12 @@ VRReplica::HandlePrepareOK(const TransportAddress &remote,
          */
         CommitUpTo(msg.opnum());
 
+        // Everything sent so far is committed, so ship what queued up
+        // behind it
+        if ((lastBatchEnd == lastCommitted) && (lastOp > lastBatchEnd)) {
+            CloseBatch();
+        }
+
         if (msgs->size() >= (unsigned int)configuration.QuorumSize()) {
             return;
         }
@@ -640,8 +783,43 @@ VRReplica::HandleRequestStateTransfer(const TransportAddress &remote,
     StateTransferMessage reply;
     reply.set_view(view);
     reply.set_opnum(lastCommitted);
-    
-    log.Dump(msg.opnum()+1, reply.mutable_entries());
+
+    if (msg.opnum()+1 < log.FirstOpnum()) {
+        // What the requester is missing has been truncated, so send
+        // our state instead and only the log after it. The snapshot
+        // must hold exactly the operations up to lastCommitted, or the
+        // requester applies those after it twice when it replays the
+        // log. Backups only apply committed operations; a leader with
+        // operations in flight leaves the request to them, or to the
+        // requester's retry once it is idle.
+        if (AppliedPastCommit()) {
+            Notice("Not sending snapshot: state is past op " FMT_OPNUM,
+                   lastCommitted);
+            return;
+        }
+        // One message per part, as a whole snapshot may not fit in one.
+        // Each goes out as soon as the next is taken; the last is held
+        // back to carry the part count and the log.
+        reply.set_snapshotopnum(lastCommitted);
+        reply.set_replicaidx(myIdx);
+        uint32_t parts = 0;
+        string last;
+        Snapshot(msg.snapshotbase(), [&](string &part) {
+                if (parts > 0) {
+                    reply.set_snapshotpart(parts-1);
+                    reply.mutable_snapshot()->swap(last);
+                    transport->SendMessage(this, remote, reply);
+                }
+                last.swap(part);
+                parts++;
+            });
+        reply.set_snapshotpart(parts > 0 ? parts-1 : 0);
+        reply.set_snapshotparts(std::max<uint32_t>(parts, 1));
+        reply.mutable_snapshot()->swap(last);
+        log.Dump(lastCommitted+1, reply.mutable_entries());
+    } else {
+        log.Dump(msg.opnum()+1, reply.mutable_entries());
+    }
 
     transport->SendMessage(this, remote, reply);
 }
@@ -655,6 +833,20 @@ VRReplica::HandleStateTransfer(const TransportAddress &remote,
         return;
     }
     
+    if (msg.has_snapshot() && (msg.snapshotopnum() > lastCommitted)) {
+        if (!AddSnapshotPart(msg)) {
+            return;
+        }
+        Notice("Installing snapshot at op " FMT_OPNUM " (was at " FMT_OPNUM ")",
+               msg.snapshotopnum(), lastCommitted);
+        snapshotTransfer.parts = 0;
+        Restore(msg.snapshotopnum());
+        log.RemoveBefore(msg.snapshotopnum()+1);
+        lastCommitted = msg.snapshotopnum();
+        lastCheckpoint = lastCommitted;
+        lastOp = std::max(lastOp, lastCommitted);
+    }
+
     opnum_t oldLastOp = lastOp;
     
     /* Install the new log entries */
@@ -715,7 +907,7 @@ VRReplica::HandleStateTransfer(const TransportAddress &remote,
     // Process pending prepares
     std::list<std::pair<TransportAddress *, PrepareMessage> >pending = pendingPrepares;
     pendingPrepares.clear();
-    for (auto & msgpair : pendingPrepares) {
+    for (auto & msgpair : pending) {
         HandlePrepare(*msgpair.first, msgpair.second);
         delete msgpair.first;
     }
@@ -901,7 +1093,13 @@ VRReplica::HandleStartView(const TransportAddress &remote,
         ASSERT(msg.lastop() == msg.lastcommitted());
     } else {
         if (msg.entries(0).opnum() > lastCommitted+1) {
-            RPanic("Not enough entries in STARTVIEW message to install new log");
+            // The leader has truncated what we are missing. Drop our
+            // uncommitted entries and catch up from its snapshot.
+            log.RemoveAfter(lastCommitted+1);
+            lastOp = lastCommitted;
+            EnterView(msg.view());
+            RequestStateTransfer();
+            return;
         }
         
         // Install the new log
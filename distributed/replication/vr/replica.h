@@ -2,9 +2,11 @@
 #define _VR_REPLICA_H_
 
 #include "distributed/lib/configuration.h"
+#include "distributed/lib/workerpool.h"
 #include "distributed/replication/common/log.h"
 #include "distributed/replication/common/replica.h"
 #include "distributed/replication/common/quorumset.h"
+#include "distributed/replication/vr/clienttable.h"
 #include "distributed/proto/vr-proto.pb.h"
 
 #include <map>
@@ -19,11 +21,13 @@ class VRReplica : public Replica
 public:
     VRReplica(transport::Configuration config, int myIdx,
               Transport *transport, unsigned int batchSize,
-              AppReplica *app);
+              AppReplica *app, unsigned int nworkers = 0,
+              uint64_t batchDelayUs = 500,
+              opnum_t checkpointInterval = 10000);
     ~VRReplica();
     
     void ReceiveMessage(const TransportAddress &remote,
-                        const string &type, const string &data);
+                        MessageType type, const StringView &data);
 
 private:
     view_t view;
@@ -31,21 +35,41 @@ private:
     opnum_t lastOp;
     view_t lastRequestStateTransferView;
     opnum_t lastRequestStateTransferOpnum;
+    int lastRequestStateTransferIdx;    // replica it was sent to
     std::list<std::pair<TransportAddress *,
                         proto::PrepareMessage> > pendingPrepares;
     proto::PrepareMessage lastPrepare;
-    unsigned int batchSize;
+    unsigned int batchSize;     // upper bound for batchTarget
+    unsigned int batchTarget;   // adapts to load, see AddToBatch
     opnum_t lastBatchEnd;
+    opnum_t checkpointInterval; // 0 once the app declines checkpoints
+    opnum_t lastCheckpoint;
+    struct BatchStats
+    {
+        uint64_t batches;
+        uint64_t ops;
+        uint64_t full;
+        uint64_t timedOut;
+        uint64_t maxSize;
+    } batchStats;
+    // The snapshot being received, from one sender at a time. Its parts
+    // go to the app as they arrive.
+    struct SnapshotTransfer
+    {
+        int replicaIdx;
+        view_t view;
+        opnum_t opnum;
+        unsigned int idleTicks;
+        uint32_t parts;         // received so far, 0 if none is
+    } snapshotTransfer;
     
     Log log;
     std::map<uint64_t, std::unique_ptr<TransportAddress> > clientAddresses;
-    struct ClientTableEntry
-    {
-        uint64_t lastReqId;
-        bool replied;
-        proto::ReplyMessage reply;
-    };
-    std::map<uint64_t, ClientTableEntry> clientTable;
+    ClientTable clientTable;
+    // Unlogged requests waiting for their minopnum to commit here
+    std::multimap<opnum_t,
+                  std::pair<std::unique_ptr<TransportAddress>,
+                            UnloggedRequest> > pendingUnlogged;
     
     QuorumSet<viewstamp_t, proto::PrepareOKMessage> prepareOKQuorum;
     QuorumSet<view_t, proto::StartViewChangeMessage> startViewChangeQuorum;
@@ -56,6 +80,12 @@ private:
     Timeout *stateTransferTimeout;
     Timeout *resendPrepareTimeout;
     Timeout *closeBatchTimeout;
+    Timeout *batchStatsTimeout;
+
+    MessageDispatcher dispatcher;
+
+    // Unlogged requests run here when nworkers > 0, off the ordered path
+    std::unique_ptr<WorkerPool> unloggedWorkers;
     
     bool AmLeader() const;
     void CommitUpTo(opnum_t upto);
@@ -64,14 +94,20 @@ private:
     void EnterView(view_t newview);
     void StartViewChange(view_t newview);
     void SendNullCommit();
-    void UpdateClientTable(const Request &req);
     void ResendPrepare();
+    void AddToBatch();
     void CloseBatch();
+    void LogBatchStats();
+    void TakeCheckpoint();
+    bool AppliedPastCommit();
+    bool AddSnapshotPart(const proto::StateTransferMessage &msg);
     
     void HandleRequest(const TransportAddress &remote,
                        const proto::RequestMessage &msg);
     void HandleUnloggedRequest(const TransportAddress &remote,
                                const proto::UnloggedRequestMessage &msg);
+    void ServeUnlogged(const TransportAddress &remote,
+                       const UnloggedRequest &unlogged);
     
     void HandlePrepare(const TransportAddress &remote,
                        const proto::PrepareMessage &msg);
@@ -0,0 +1,105 @@
+#include "distributed/store/common/backend/lockserver.h"
+
+#include <functional>
+#include <set>
+
+using namespace std;
+
+LockServer::LockServer(size_t nshards) : shards(nshards) { }
+
+LockServer::~LockServer() { }
+
+size_t
+LockServer::shardOf(const string &key) const
+{
+    return std::hash<string>()(key) % shards.size();
+}
+
+int
+LockServer::LockAll(uint64_t id, uint64_t timestamp,
+                    const vector<string> &reads,
+                    const vector<string> &writes)
+{
+    Priority self(timestamp, id);
+
+    // Hold every shard involved, in order, so that checking and granting
+    // are one step
+    set<size_t> involved;
+    for (auto &key : reads) {
+        involved.insert(shardOf(key));
+    }
+    for (auto &key : writes) {
+        involved.insert(shardOf(key));
+    }
+    vector<unique_lock<mutex>> held;
+    for (size_t s : involved) {
+        held.emplace_back(shards[s].mtx);
+    }
+
+    // Wait-die against every conflicting holder
+    int status = REPLY_OK;
+    auto check = [&](const string &key, bool exclusive) {
+        auto &locks = shards[shardOf(key)].locks;
+        auto it = locks.find(key);
+        if (it == locks.end()) {
+            return;
+        }
+        const Lock &lock = it->second;
+        if (!exclusive && !lock.exclusive) {
+            return;
+        }
+        for (auto &holder : lock.holders) {
+            if (holder.first == id) {
+                continue;
+            }
+            if (holder.second < self) {
+                status = REPLY_FAIL;
+                return;
+            }
+            status = REPLY_RETRY;
+        }
+    };
+    for (auto &key : writes) {
+        check(key, true);
+        if (status == REPLY_FAIL) {
+            return status;
+        }
+    }
+    for (auto &key : reads) {
+        check(key, false);
+        if (status == REPLY_FAIL) {
+            return status;
+        }
+    }
+    if (status != REPLY_OK) {
+        return status;
+    }
+
+    for (auto &key : reads) {
+        Lock &lock = shards[shardOf(key)].locks[key];
+        lock.holders[id] = self;
+    }
+    for (auto &key : writes) {
+        Lock &lock = shards[shardOf(key)].locks[key];
+        lock.exclusive = true;
+        lock.holders[id] = self;
+    }
+    return REPLY_OK;
+}
+
+void
+LockServer::ReleaseAll(uint64_t id, const vector<string> &keys)
+{
+    for (auto &key : keys) {
+        Shard &shard = shards[shardOf(key)];
+        lock_guard<mutex> l(shard.mtx);
+        auto it = shard.locks.find(key);
+        if (it == shard.locks.end()) {
+            continue;
+        }
+        it->second.holders.erase(id);
+        if (it->second.holders.empty()) {
+            shard.locks.erase(it);
+        }
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef _LOCK_SERVER_H_
+#define _LOCK_SERVER_H_
+
+#include "distributed/lib/assert.h"
+#include "distributed/lib/message.h"
+#include "distributed/store/common/transaction.h"
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/* Lock table for strict two-phase locking. Keys hash onto shards, each
+ * with its own map and mutex, so transactions on unrelated keys do not
+ * contend on either.
+ *
+ * Deadlocks are avoided with wait-die. Transactions are ordered by
+ * (timestamp, id), smaller being older. A request that conflicts with
+ * locks held only by younger transactions waits; one that conflicts with
+ * an older holder dies. Nothing here blocks: waiting is reported to the
+ * caller, who tries again later. */
+class LockServer
+{
+public:
+    LockServer(size_t nshards = 64);
+    ~LockServer();
+
+    // Takes shared locks on reads and exclusive locks on writes for id,
+    // all of them or none. Returns REPLY_OK once they are held,
+    // REPLY_RETRY if id has to wait, and REPLY_FAIL if it has to die.
+    int LockAll(uint64_t id, uint64_t timestamp,
+                const std::vector<std::string> &reads,
+                const std::vector<std::string> &writes);
+
+    // Releases whatever id holds on keys.
+    void ReleaseAll(uint64_t id, const std::vector<std::string> &keys);
+
+private:
+    typedef std::pair<uint64_t, uint64_t> Priority; // (timestamp, id)
+
+    struct Lock
+    {
+        bool exclusive;
+        std::map<uint64_t, Priority> holders;
+
+        Lock() : exclusive(false) { }
+    };
+
+    struct Shard
+    {
+        std::mutex mtx;
+        std::unordered_map<std::string, Lock> locks;
+    };
+
+    std::vector<Shard> shards;
+
+    size_t shardOf(const std::string &key) const;
+};
+
+#endif /* _LOCK_SERVER_H_ */
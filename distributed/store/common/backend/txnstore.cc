@@ -22,6 +22,19 @@ TxnStore::Prepare(uint64_t id, const Transaction &txn)
     return 0;
 }
 
+int
+TxnStore::Prepare(uint64_t id, const Transaction &txn,
+                  const Timestamp &timestamp)
+{
+    return Prepare(id, txn);
+}
+
+uint64_t
+TxnStore::LastCommitted(const Transaction &txn)
+{
+    return 0;
+}
+
 void
 TxnStore::Abort(uint64_t id, const Transaction &txn)
 {
@@ -59,3 +72,31 @@ TxnStore::Commit(uint64_t id, uint64_t timestamp,
 {
     Panic("Unimplemented COMMIT");
 }
+
+int TxnStore::GetDigest(strongstore::proto::Reply* reply) {
+  return 0;
+}
+
+void
+TxnStore::SnapshotBase(std::string &base)
+{
+}
+
+void
+TxnStore::Snapshot(const std::string &base,
+                   const std::function<void (std::string &part)> &send)
+{
+    Panic("Unimplemented SNAPSHOT");
+}
+
+void
+TxnStore::RestorePart(size_t part, const std::string &data)
+{
+    Panic("Unimplemented RESTORE");
+}
+
+void
+TxnStore::Restore()
+{
+    Panic("Unimplemented RESTORE");
+}
@@ -8,6 +8,8 @@
 #include "distributed/proto/strong-proto.pb.h"
 #include "distributed/store/common/backend/type.h"
 
+#include <functional>
+
 class TxnStore
 {
 public:
@@ -24,6 +26,15 @@ public:
 
     virtual int Prepare(uint64_t id, const Transaction &txn);
 
+    // Prepare, for stores that order transactions by the timestamp the
+    // client sent along
+    virtual int Prepare(uint64_t id, const Transaction &txn,
+                        const Timestamp &timestamp);
+
+    // Highest commit timestamp on any key txn touches; txn has to commit
+    // above it for versions to be ordered by timestamp
+    virtual uint64_t LastCommitted(const Transaction &txn);
+
     virtual void Abort(uint64_t id, const Transaction &txn = Transaction());
 
     virtual void Load(const std::vector<std::string> &keys,
@@ -42,6 +53,18 @@ public:
 
     virtual void Commit(uint64_t id, uint64_t timestamp,
                         strongstore::proto::Reply* reply);
+
+    virtual int GetDigest(strongstore::proto::Reply* reply);
+
+    virtual void SnapshotBase(std::string &base);
+
+    virtual void Snapshot(const std::string &base,
+                          const std::function<void (std::string &part)> &send);
+
+    // part is the index of data in the snapshot, 0 starting a new one
+    virtual void RestorePart(size_t part, const std::string &data);
+
+    virtual void Restore();
 };
 
 #endif /* _TXN_STORE_H_ */
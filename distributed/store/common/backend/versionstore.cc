@@ -5,9 +5,10 @@
 
 using namespace std;
 
-VersionedKVStore::VersionedKVStore() { }
+VersionedKVStore::VersionedKVStore() : last_put_(1 << 12, 0) { }
 
-VersionedKVStore::VersionedKVStore(const string& db_path, int timeout) {
+VersionedKVStore::VersionedKVStore(const string& db_path, int timeout)
+    : last_put_(1 << 12, 0) {
 #ifdef LEDGERDB
   ldb.reset(new ledgebase::ledgerdb::LedgerDB(timeout));
 #endif
@@ -17,13 +18,21 @@ VersionedKVStore::VersionedKVStore(const string& db_path, int timeout) {
 #endif
 #ifdef SQLLEDGER
   ledgebase::qldb::BPlusConfig::Init(45, 45);
-  sqlledger_.reset(new ledgebase::sqlledger::SQLLedger(timeout, db_path));
+  sqlledger_.reset(new ledgebase::sqlledger::SQLLedger(timeout, db_path,
+      db_path + ".wal", db_path + ".index"));
 #endif
+  // the ledger may be reopened with data from an earlier run
+  rebuildLastPut();
 }
     
 VersionedKVStore::~VersionedKVStore() { }
 
 bool VersionedKVStore::GetDigest(strongstore::proto::Reply* reply) {
+  boost::shared_lock<boost::shared_mutex> read(lock_);
+  return getDigest(reply);
+}
+
+bool VersionedKVStore::getDigest(strongstore::proto::Reply* reply) {
   uint64_t tip;
   std::string hash;
 
@@ -44,6 +53,7 @@ bool VersionedKVStore::GetDigest(strongstore::proto::Reply* reply) {
 bool VersionedKVStore::GetNVersions(
     std::vector<std::pair<std::string, size_t>>& ver_keys,
     strongstore::proto::Reply* reply) {
+  boost::shared_lock<boost::shared_mutex> read(lock_);
 #ifdef LEDGERDB
   std::vector<std::vector<
       std::pair<uint64_t, std::pair<size_t, std::string>>>> get_val_res;
@@ -64,13 +74,20 @@ bool VersionedKVStore::GetNVersions(
   }
 #endif
 #ifdef AMZQLDB
-  auto digestInfo = qldb_->digest("test");
+  // documents come from the index, which only holds committed blocks, so
+  // a digest read after them covers them all
+  std::vector<std::vector<ledgebase::Chunk>> history;
   for (auto& key : ver_keys) {
-    auto result = qldb_->GetHistory("test", key.first, key.second);
-    for (auto& res : result) {
+    history.emplace_back(qldb_->GetHistory("test", key.first, key.second));
+  }
+  auto snapshot = qldb_->GetSnapshot();
+  auto digestInfo = qldb_->digest("test", snapshot);
+  for (size_t k = 0; k < ver_keys.size(); ++k) {
+    auto& key = ver_keys[k];
+    for (auto& res : history[k]) {
       ledgebase::qldb::Document doc(&res);
       auto proofres = qldb_->getProof("test", digestInfo.tip,
-          doc.getAddr().seq_no, doc.getMetaData().doc_seq);
+          doc.getAddr().seq_no, doc.getMetaData().doc_seq, snapshot);
       auto p = reply->add_qproof();
       p->set_key(key.first);
       p->set_value(proofres.data.val.ToString());
@@ -86,6 +103,7 @@ bool VersionedKVStore::GetNVersions(
       }
     }
   }
+  qldb_->ReleaseSnapshot(snapshot);
 #endif
 #ifdef SQLLEDGER
   for (auto& key : ver_keys) {
@@ -106,6 +124,7 @@ bool VersionedKVStore::GetNVersions(
 
 bool VersionedKVStore::BatchGet(const std::vector<std::string>& keys,
     strongstore::proto::Reply* reply) {
+  boost::shared_lock<boost::shared_mutex> read(lock_);
 #ifdef LEDGERDB
   std::vector<std::pair<uint64_t, std::pair<size_t, std::string>>> get_val_res;
   ldb->GetValues(keys, get_val_res);
@@ -120,21 +139,27 @@ bool VersionedKVStore::BatchGet(const std::vector<std::string>& keys,
   }
 #endif
 #ifdef AMZQLDB
-  auto digest = reply->mutable_digest();
-  auto digestInfo = qldb_->digest("test");
-  digest->set_block(digestInfo.tip);
-  digest->set_hash(digestInfo.digest);
+  // documents first, see GetNVersions
+  std::vector<std::pair<std::string, ledgebase::Chunk>> docs;
   for (auto& key : keys) {
     auto result = qldb_->GetCommitted("test", key);
     if (result.empty()) {
       std::cout << key << " is empty" << std::endl;
       continue;
     }
-    ledgebase::qldb::Document doc(&result);
+    docs.emplace_back(key, std::move(result));
+  }
+  auto snapshot = qldb_->GetSnapshot();
+  auto digest = reply->mutable_digest();
+  auto digestInfo = qldb_->digest("test", snapshot);
+  digest->set_block(digestInfo.tip);
+  digest->set_hash(digestInfo.digest);
+  for (auto& entry : docs) {
+    ledgebase::qldb::Document doc(&entry.second);
     auto proofres = qldb_->getProof("test", digestInfo.tip, doc.getAddr().seq_no,
-        doc.getMetaData().doc_seq);
+        doc.getMetaData().doc_seq, snapshot);
     auto p = reply->add_qproof();
-    p->set_key(key);
+    p->set_key(entry.first);
     p->set_value(proofres.data.val.ToString());
     p->set_blockno(proofres.addr.seq_no);
     p->set_doc_seq(proofres.meta.doc_seq);
@@ -147,6 +172,7 @@ bool VersionedKVStore::BatchGet(const std::vector<std::string>& keys,
       p->add_pos(pos);
     }
   }
+  qldb_->ReleaseSnapshot(snapshot);
 #endif
 #ifdef SQLLEDGER
   for (auto& key : keys) {
@@ -169,6 +195,7 @@ bool VersionedKVStore::BatchGet(const std::vector<std::string>& keys,
 
 bool VersionedKVStore::GetRange(const std::string &start,
     const std::string &end, strongstore::proto::Reply* reply) {
+  boost::shared_lock<boost::shared_mutex> read(lock_);
 #ifdef LEDGERDB
   std::map<std::string,
       std::pair<uint64_t, std::pair<size_t, std::string>>> range_res;
@@ -182,17 +209,19 @@ bool VersionedKVStore::GetRange(const std::string &start,
   }
 #endif
 #ifdef AMZQLDB
+  // documents first, see GetNVersions
+  auto results = qldb_->Range("test", start, end);
+  auto snapshot = qldb_->GetSnapshot();
   auto digest = reply->mutable_digest();
-  auto digestInfo = qldb_->digest("test");
+  auto digestInfo = qldb_->digest("test", snapshot);
   digest->set_block(digestInfo.tip);
   digest->set_hash(digestInfo.digest);
-  auto results = qldb_->Range("test", start, end);
   for (auto& r : results) {
     ledgebase::Slice valslice(r.second);
     ledgebase::Chunk valchunk(valslice.data());
     ledgebase::qldb::Document doc(&valchunk);
     auto proofres = qldb_->getProof("test", digestInfo.tip, doc.getAddr().seq_no,
-        doc.getMetaData().doc_seq);
+        doc.getMetaData().doc_seq, snapshot);
     auto p = reply->add_qproof();
     p->set_key(r.first);
     p->set_value(proofres.data.val.ToString());
@@ -207,6 +236,7 @@ bool VersionedKVStore::GetRange(const std::string &start,
       p->add_pos(pos);
     }
   }
+  qldb_->ReleaseSnapshot(snapshot);
 #endif
 #ifdef SQLLEDGER
   auto results = sqlledger_->Range(start, end);
@@ -222,9 +252,193 @@ bool VersionedKVStore::GetRange(const std::string &start,
   return true;
 }
 
+bool VersionedKVStore::GetAll(std::vector<std::string>* keys,
+    std::vector<std::string>* values, std::vector<uint64_t>* timestamps) {
+  boost::shared_lock<boost::shared_mutex> read(lock_);
+  return getAll(keys, values, timestamps);
+}
+
+bool VersionedKVStore::getAll(std::vector<std::string>* keys,
+    std::vector<std::string>* values, std::vector<uint64_t>* timestamps) {
+  const std::string first, last(1, '\xff');
+#ifdef LEDGERDB
+  std::map<std::string,
+      std::pair<uint64_t, std::pair<size_t, std::string>>> range_res;
+  ldb->GetRange(first, last, range_res);
+  for (auto& res : range_res) {
+    keys->emplace_back(res.first);
+    values->emplace_back(res.second.second.second);
+    timestamps->emplace_back(res.second.first);
+  }
+#endif
+#ifdef AMZQLDB
+  auto results = qldb_->Range("test", first, last);
+  for (auto& r : results) {
+    ledgebase::Slice valslice(r.second);
+    ledgebase::Chunk valchunk(valslice.data());
+    ledgebase::qldb::Document doc(&valchunk);
+    keys->emplace_back(r.first);
+    values->emplace_back(doc.getData().val.ToString());
+    timestamps->emplace_back(doc.getMetaData().time);
+  }
+#endif
+#ifdef SQLLEDGER
+  auto results = sqlledger_->Range(first, last);
+  for (auto& r : results) {
+    auto docs = ledgebase::Utils::splitBy(r.second, '|');
+    keys->emplace_back(docs[3]);
+    values->emplace_back(docs[4]);
+    timestamps->emplace_back(std::stoul(docs[5]));
+  }
+#endif
+  return true;
+}
+
+void VersionedKVStore::GetSnapshotBase(std::string* base) {
+  boost::shared_lock<boost::shared_mutex> read(lock_);
+#ifdef LEDGERDB
+  uint64_t next_block;
+  std::string mpt_root;
+  ldb->GetSnapshotBase(&next_block, &mpt_root);
+  strongstore::proto::SnapshotBase msg;
+  msg.set_next_block(next_block);
+  msg.set_mpt_root(mpt_root);
+  msg.SerializeToString(base);
+#endif
+}
+
+// LedgerDB ships its ledger along, the others only the latest version
+// of every key. Restoring merges the parts back into one Snapshot, so
+// any field may be spread over several of them; only store files are
+// written out as they arrive.
+void VersionedKVStore::Snapshot(const std::string& base,
+    const std::function<void (strongstore::proto::Snapshot&)>& send) {
+  boost::shared_lock<boost::shared_mutex> read(lock_);
+  // the part to add bytes more to, sent once the next one is started
+  strongstore::proto::Snapshot current;
+  size_t part_bytes = 0;
+  auto part = [&](size_t bytes) {
+    if (part_bytes > 0 && part_bytes + bytes > kSnapshotPartBytes) {
+      send(current);
+      current.Clear();
+      part_bytes = 0;
+    }
+    part_bytes += bytes;
+    return &current;
+  };
+
+#ifdef LEDGERDB
+  strongstore::proto::SnapshotBase msg;
+  if (!msg.ParseFromString(base)) {
+    msg.Clear();
+  }
+  ledgebase::ledgerdb::Snapshot ls;
+  // files come in pieces no larger than a part, sent as they are read
+  auto piece = [&](const std::string& name, std::string& data) {
+    auto ledger = part(data.size())->mutable_ledger();
+    ledger->add_file_names(name);
+    ledger->add_files()->swap(data);
+  };
+  if (!ldb->GetSnapshot(msg.next_block(), msg.mpt_root(), &ls, piece)) {
+    Panic("Failed to take ledger snapshot");
+  }
+  auto ledger = part(0)->mutable_ledger();
+  ledger->set_full(ls.full);
+  ledger->set_first_block(ls.first_block);
+  for (auto& block : ls.blocks) {
+    part(block.size())->mutable_ledger()->add_blocks()->swap(block);
+  }
+  for (size_t i = 0; i < ls.keys.size(); ++i) {
+    ledger = part(ls.keys[i].size() + ls.versions[i].size())
+        ->mutable_ledger();
+    ledger->add_keys(ls.keys[i]);
+    ledger->add_timestamps(ls.timestamps[i]);
+    ledger->add_versions(ls.versions[i]);
+  }
+#else
+  std::vector<std::string> keys, vals;
+  std::vector<uint64_t> timestamps;
+  getAll(&keys, &vals, &timestamps);
+  for (size_t i = 0; i < keys.size(); ++i) {
+    auto snapshot = part(keys[i].size() + vals[i].size());
+    auto kv = snapshot->add_values();
+    kv->set_key(keys[i]);
+    kv->set_val(vals[i]);
+    snapshot->add_timestamps(timestamps[i]);
+  }
+#endif
+  send(current);
+}
+
+void VersionedKVStore::RestorePart(size_t part,
+    strongstore::proto::Snapshot* snapshot) {
+  if (part == 0) {
+    restore_.Clear();
+  }
+#ifdef LEDGERDB
+  if (part == 0) {
+    ldb->ClearSnapshotPieces();
+  }
+  if (snapshot->has_ledger()) {
+    auto ledger = snapshot->mutable_ledger();
+    for (int i = 0; i < ledger->files_size(); ++i) {
+      if (!ldb->AddSnapshotPiece(ledger->file_names(i), ledger->files(i))) {
+        Panic("Failed to write ledger snapshot file %s",
+              ledger->file_names(i).c_str());
+      }
+    }
+    ledger->clear_file_names();
+    ledger->clear_files();
+  }
+#endif
+  restore_.MergeFrom(*snapshot);
+}
+
+void VersionedKVStore::Restore() {
+  boost::unique_lock<boost::shared_mutex> write(lock_);
+  strongstore::proto::Snapshot snapshot;
+  snapshot.Swap(&restore_);
+#ifdef LEDGERDB
+  if (snapshot.has_ledger()) {
+    auto& ledger = snapshot.ledger();
+    ledgebase::ledgerdb::Snapshot ls;
+    ls.full = ledger.full();
+    ls.first_block = ledger.first_block();
+    ls.blocks.assign(ledger.blocks().begin(), ledger.blocks().end());
+    ls.keys.assign(ledger.keys().begin(), ledger.keys().end());
+    ls.timestamps.assign(ledger.timestamps().begin(),
+        ledger.timestamps().end());
+    ls.versions.assign(ledger.versions().begin(), ledger.versions().end());
+    if (!ldb->ApplySnapshot(ls)) {
+      Panic("Failed to apply ledger snapshot");
+    }
+    // a full snapshot carries store files rather than keys
+    if (ls.full) rebuildLastPut();
+    for (size_t i = 0; i < ls.keys.size(); ++i) {
+      uint64_t& last =
+          last_put_[std::hash<std::string>()(ls.keys[i]) % last_put_.size()];
+      last = std::max(last, ls.timestamps[i]);
+    }
+  }
+#endif
+
+  // one write per timestamp rather than per key
+  std::map<uint64_t, std::pair<std::vector<std::string>,
+      std::vector<std::string>>> writes;
+  for (int i = 0; i < snapshot.values_size(); ++i) {
+    auto& w = writes[snapshot.timestamps(i)];
+    w.first.push_back(snapshot.values(i).key());
+    w.second.push_back(snapshot.values(i).val());
+  }
+  for (auto& w : writes) {
+    apply(w.second.first, w.second.second, Timestamp(w.first), nullptr);
+  }
+}
+
 bool VersionedKVStore::GetProof(
     const std::map<uint64_t, std::vector<std::string>>& keys,
     strongstore::proto::Reply* reply) {
+  boost::shared_lock<boost::shared_mutex> read(lock_);
   timeval t0, t1;
   gettimeofday(&t0, NULL);
   int nkey = 0;
@@ -269,16 +483,35 @@ bool VersionedKVStore::GetProof(
   }
 #endif
 #ifdef SQLLEDGER
-  GetDigest(reply);
+  getDigest(reply);
+  // blocks are sealed on a timer, so a block number reported by another
+  // replica may not hold the key here; fall back to the version this
+  // replica has committed
+  std::map<uint64_t, std::vector<std::string>> blocks;
   for (auto& entry : keys) {
+    for (auto& key : entry.second) {
+      auto doc = sqlledger_->GetDataAtBlock(key, entry.first);
+      if (doc.empty() ||
+          std::stoul(doc.substr(0, doc.find('|'))) != entry.first) {
+        doc = sqlledger_->GetDataAtBlock(key, reply->digest().block());
+      }
+      if (doc.empty()) continue;
+      blocks[std::stoul(doc.substr(0, doc.find('|')))].push_back(key);
+    }
+  }
+  for (auto& entry : blocks) {
     int level;
 
     auto block_proof = sqlledger_->getBlockProof(entry.first,
         reply->digest().block(), &level);
     //ledgebase::sqlledger::BlockProof block_proof;
     auto p = reply->add_sproof();
-    for (size_t i = 0; i < block_proof.blks.size(); ++i) {
-      p->add_blocks(block_proof.blks[i]);
+    auto blk_proof = p->mutable_block_proof();
+    blk_proof->set_digest(block_proof.proof.digest);
+    blk_proof->set_value(block_proof.proof.value);
+    for (size_t i = 0; i < block_proof.proof.proof.size(); ++i) {
+      blk_proof->add_proof(block_proof.proof.proof[i]);
+      blk_proof->add_pos(block_proof.proof.pos[i]);
     }
 
     for (auto& key : entry.second) {
@@ -310,6 +543,7 @@ bool VersionedKVStore::GetProof(
 
 bool VersionedKVStore::GetProof(const uint64_t& seq,
     strongstore::proto::Reply* reply) {
+  boost::shared_lock<boost::shared_mutex> read(lock_);
 #ifdef LEDGERDB
   auto auditor = ldb->GetAudit(seq);
   auto reply_auditor = reply->mutable_laudit();
@@ -322,6 +556,9 @@ bool VersionedKVStore::GetProof(const uint64_t& seq,
   for (size_t i = 0; i < auditor.blocks.size(); ++i) {
     reply_auditor->add_blocks(auditor.blocks[i]);
   }
+  for (auto& node : auditor.mt_frontier) {
+    reply_auditor->add_mt_frontier(node);
+  }
   for (auto& mptproof : auditor.mptproofs) {
     auto reply_mptproof = reply_auditor->add_mptproofs();
     reply_mptproof->set_value(mptproof.GetValue());
@@ -337,8 +574,13 @@ bool VersionedKVStore::GetProof(const uint64_t& seq,
   a->set_block_no(auditor.block_seq);
   a->set_digest(auditor.digest);
   a->set_txns(auditor.txns);
-  for (auto& b : auditor.blks) {
-    a->add_blocks(b);
+  auto blk_proof = a->mutable_block_proof();
+  auto& proof = auditor.blk_proof.proof;
+  blk_proof->set_digest(proof.digest);
+  blk_proof->set_value(proof.value);
+  for (size_t i = 0; i < proof.proof.size(); ++i) {
+    blk_proof->add_proof(proof.proof[i]);
+    blk_proof->add_pos(proof.pos[i]);
   }
 #endif
   return true;
@@ -349,6 +591,18 @@ void VersionedKVStore::put(const vector<string> &keys,
     const vector<string> &values, const Timestamp &t,
     strongstore::proto::Reply* reply)
 {
+  boost::shared_lock<boost::shared_mutex> read(lock_);
+  apply(keys, values, t, reply);
+}
+
+void VersionedKVStore::apply(const vector<string> &keys,
+    const vector<string> &values, const Timestamp &t,
+    strongstore::proto::Reply* reply)
+{
+  for (auto& key : keys) {
+    uint64_t& last = last_put_[std::hash<std::string>()(key) % last_put_.size()];
+    last = std::max(last, t.getTimestamp());
+  }
 #ifdef LEDGERDB
   auto estimate_blocks = ldb->Set(keys, values, t.getTimestamp());
   if (reply != nullptr) {
@@ -361,13 +615,38 @@ void VersionedKVStore::put(const vector<string> &keys,
   }
 #endif
 #ifdef AMZQLDB
-  qldb_->Set("test", keys, values);
+  uint64_t blockno;
+  qldb_->Set("test", keys, values, &blockno, t.getTimestamp());
   if (reply != nullptr) {
-    BatchGet(keys, reply);
+    // proofs come from the block just written, so the reply does not
+    // wait for the indexer
+    auto digest = reply->mutable_digest();
+    auto digestInfo = qldb_->digest("test");
+    digest->set_block(digestInfo.tip);
+    digest->set_hash(digestInfo.digest);
+    for (size_t i = 0; i < keys.size(); ++i) {
+      auto proofres = qldb_->getProof("test", digestInfo.tip, blockno, i);
+      auto p = reply->add_qproof();
+      p->set_key(keys[i]);
+      p->set_value(values[i]);
+      p->set_blockno(blockno);
+      p->set_doc_seq(proofres.meta.doc_seq);
+      p->set_version(proofres.meta.version);
+      p->set_time(proofres.meta.time);
+      for (auto& hash : proofres.proof) {
+        p->add_hashes(hash);
+      }
+      for (auto& pos : proofres.pos) {
+        p->add_pos(pos);
+      }
+    }
   }
 #endif
 #ifdef SQLLEDGER
-  auto estimate_blocks = sqlledger_->Set(keys, values);
+  uint64_t estimate_blocks;
+  if (!sqlledger_->Set(keys, values, &estimate_blocks, t.getTimestamp())) {
+    Panic("Failed to log transaction to the SQLLedger WAL");
+  }
   if (reply != nullptr) {
     for (size_t i = 0; i < keys.size(); ++i) {
       auto kv = reply->add_values();
@@ -379,10 +658,51 @@ void VersionedKVStore::put(const vector<string> &keys,
 #endif
 }
 
+void VersionedKVStore::rebuildLastPut()
+{
+  std::vector<std::string> keys, values;
+  std::vector<uint64_t> timestamps;
+  getAll(&keys, &values, &timestamps);
+  for (size_t i = 0; i < keys.size(); ++i) {
+    uint64_t& last =
+        last_put_[std::hash<std::string>()(keys[i]) % last_put_.size()];
+    last = std::max(last, timestamps[i]);
+  }
+}
+
+uint64_t VersionedKVStore::LastPut(const std::string& key) const
+{
+  boost::shared_lock<boost::shared_mutex> read(lock_);
+  return last_put_[std::hash<std::string>()(key) % last_put_.size()];
+}
+
+uint64_t VersionedKVStore::Version(const std::string& key)
+{
+  boost::shared_lock<boost::shared_mutex> read(lock_);
+#ifdef LEDGERDB
+  std::vector<std::pair<uint64_t, std::pair<size_t, std::string>>> res;
+  ldb->GetValues({key}, res);
+  return res[0].first;
+#endif
+#ifdef AMZQLDB
+  auto result = qldb_->GetCommitted("test", key);
+  if (result.empty()) return 0;
+  ledgebase::qldb::Document doc(&result);
+  return doc.getMetaData().time;
+#endif
+#ifdef SQLLEDGER
+  auto result = sqlledger_->GetHistory(key, 1);
+  if (result.empty()) return 0;
+  return std::stoul(ledgebase::Utils::splitBy(result[0], '|')[5]);
+#endif
+  return 0;
+}
+
 bool VersionedKVStore::get(const std::string &key,
                            const Timestamp &t,
                            std::pair<Timestamp, std::string> &value)
 {
+    boost::shared_lock<boost::shared_mutex> read(lock_);
 #ifdef LEDGERDB
     std::vector<std::pair<uint64_t, std::pair<size_t, std::string>>> get_val_res;
     ldb->GetValues({key}, get_val_res);
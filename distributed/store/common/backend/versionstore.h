@@ -11,12 +11,21 @@
 #include "ledger/sqlledger/sqlledger.h"
 #include "distributed/proto/strong-proto.pb.h"
 
+#include "boost/thread.hpp"
 #include "tbb/concurrent_hash_map.h"
+#include <algorithm>
+#include <functional>
 #include <set>
 #include <map>
 #include <vector>
 #include <unordered_map>
 
+// Readers may run concurrently with each other and with the replica's
+// upcall thread (unlogged requests run on worker threads). The ledger
+// backends serve reads while a block is being set, so writes do not wait
+// for proofs or audits; only a restore, which replaces the whole ledger,
+// excludes readers. put, Snapshot, RestorePart and Restore all come from
+// the ordered upcalls and never overlap each other.
 class VersionedKVStore {
  public:
   VersionedKVStore();
@@ -40,6 +49,28 @@ class VersionedKVStore {
   bool GetRange(const std::string &start, const std::string &end,
                 strongstore::proto::Reply* reply);
 
+  // latest version of every key
+  bool GetAll(std::vector<std::string>* keys,
+              std::vector<std::string>* values,
+              std::vector<uint64_t>* timestamps);
+
+  // what this store already holds, for a snapshot to build on
+  void GetSnapshotBase(std::string* base);
+
+  // state that brings a store holding base up to this one, handed to
+  // send in parts of about kSnapshotPartBytes as it is read; there is
+  // always at least one part
+  void Snapshot(const std::string& base,
+      const std::function<void (strongstore::proto::Snapshot&)>& send);
+
+  // the next part of a snapshot, 0 starting a new one; the store files
+  // of a full LedgerDB snapshot are written out as they come and taken
+  // out of snapshot, the rest is kept until Restore
+  void RestorePart(size_t part, strongstore::proto::Snapshot* snapshot);
+
+  // installs the snapshot whose parts were passed to RestorePart
+  void Restore();
+
   void put(const std::vector<std::string> &keys,
            const std::vector<std::string> &values,
            const Timestamp &t,
@@ -49,7 +80,39 @@ class VersionedKVStore {
            const Timestamp &t,
            std::pair<Timestamp, std::string> &value);
 
+  // highest timestamp put for key, or for a key that shares its bucket
+  uint64_t LastPut(const std::string& key) const;
+
+  // timestamp of the latest version of key, as reads report it; 0 if the
+  // key has none
+  uint64_t Version(const std::string& key);
+
+  // each snapshot part is sent in a message of its own
+  static const size_t kSnapshotPartBytes = 16 << 20;
+
  private:
+  // unlocked versions for callers that already hold lock_
+  bool getDigest(strongstore::proto::Reply* reply);
+
+  bool getAll(std::vector<std::string>* keys,
+              std::vector<std::string>* values,
+              std::vector<uint64_t>* timestamps);
+
+  void apply(const std::vector<std::string> &keys,
+             const std::vector<std::string> &values,
+             const Timestamp &t,
+             strongstore::proto::Reply* reply);
+
+  // raises last_put_ to the latest version of every key in the store,
+  // which is all that survives a restart or a full restore
+  void rebuildLastPut();
+
+  // held exclusively by Restore only
+  mutable boost::shared_mutex lock_;
+  // only touched from the upcall thread
+  std::vector<uint64_t> last_put_;
+  // the parts of the snapshot being restored, less any store files
+  strongstore::proto::Snapshot restore_;
 
   std::unique_ptr<ledgebase::ledgerdb::LedgerDB> ldb;
   std::unique_ptr<ledgebase::qldb::QLDB> qldb_;
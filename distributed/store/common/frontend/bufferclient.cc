@@ -101,6 +101,15 @@ BufferClient::Commit(uint64_t timestamp, Promise *promise)
     txnclient->Commit(tid, txn, history, timestamp, promise);
 }
 
+void
+BufferClient::PrepareCommit(uint64_t timestamp,
+                            const Timestamp &prepareTimestamp,
+                            Promise *promise)
+{
+    txnclient->PrepareCommit(tid, txn, history, timestamp, prepareTimestamp,
+                             promise);
+}
+
 /* Aborts the ongoing transaction. */
 void
 BufferClient::Abort(Promise *promise)
@@ -36,6 +36,10 @@ public:
     // Commit the ongoing transaction.
     void Commit(uint64_t timestamp = 0, Promise *promise = NULL);
 
+    // Prepare and commit at once, when this is the only participant.
+    void PrepareCommit(uint64_t timestamp, const Timestamp &prepareTimestamp,
+        Promise *promise);
+
     // Abort the running transaction.
     void Abort(Promise *promise = NULL);
 
@@ -60,6 +60,15 @@ public:
         uint64_t timestamp = 0,
         Promise *promise = NULL) = 0;
     
+    // Prepare and commit at once, for transactions on a single shard.
+    // Replies like Commit, or like Prepare if it did not commit.
+    virtual void PrepareCommit(uint64_t id,
+        const Transaction &txn,
+        const std::vector<std::pair<std::string, size_t> > &versions,
+        uint64_t timestamp,
+        const Timestamp &prepareTimestamp,
+        Promise *promise = NULL) = 0;
+
     // Abort all Get(s) and Put(s) since Begin().
     virtual void Abort(uint64_t id, 
                        const Transaction &txn = Transaction(), 
@@ -16,6 +16,14 @@ Promise::Promise(int timeoutMS)
     timeout = timeoutMS;
 }
 
+Promise::Promise(int timeoutMS, promise_callback_t callback)
+    : callback(callback)
+{
+    done = false;
+    reply = 0;
+    timeout = timeoutMS;
+}
+
 Promise::~Promise() { }
 
 // Get configured timeout, return after this period
@@ -27,43 +35,51 @@ Promise::GetTimeout()
 
 // Functions for replying to the promise
 void
-Promise::ReplyInternal(int r)
+Promise::ReplyInternal(int r, unique_lock<mutex> &l)
 {
     done = true;
     reply = r;
     cv.notify_all();
+
+    // The callback may delete the promise, so nothing is touched after it
+    if (callback) {
+        promise_callback_t cb = std::move(callback);
+        callback = nullptr;
+        l.unlock();
+        cb(this);
+    }
 }
 
 void
 Promise::Reply(int r)
 {
-    lock_guard<mutex> l(lock);
-    ReplyInternal(r);
+    unique_lock<mutex> l(lock);
+    ReplyInternal(r, l);
 }
 
 void
 Promise::Reply(int r, Timestamp t)
 {
-    lock_guard<mutex> l(lock);
+    unique_lock<mutex> l(lock);
     timestamp = t;
-    ReplyInternal(r);
+    ReplyInternal(r, l);
 }
 
 void
 Promise::Reply(int r, string v)
 {
-    lock_guard<mutex> l(lock);
+    unique_lock<mutex> l(lock);
     value = v;
-    ReplyInternal(r);
+    ReplyInternal(r, l);
 }
 
 void
 Promise::Reply(int r, Timestamp t, string v)
 {
-    lock_guard<mutex> l(lock);
+    unique_lock<mutex> l(lock);
     value = v;
     timestamp = t;
-    ReplyInternal(r);
+    ReplyInternal(r, l);
 }
 
 void
@@ -72,7 +88,7 @@ Promise::Reply(int r, std::vector<Timestamp> ts,
                std::vector<std::string> keys,
                std::vector<uint64_t> blocks)
 {
-    lock_guard<mutex> l(lock);
+    unique_lock<mutex> l(lock);
     values.insert(vals.begin(), vals.end());
     for (auto t : ts) {
       timestamps.emplace_back(t);
@@ -83,22 +99,22 @@ Promise::Reply(int r, std::vector<Timestamp> ts,
     for (auto& b : blocks) {
       estimated_blocks.emplace_back(b);
     }
-    ReplyInternal(r);
+    ReplyInternal(r, l);
 }
 
 void
 Promise::Reply(int r, VerifyStatus vs)
 {
-    lock_guard<mutex> l(lock);
+    unique_lock<mutex> l(lock);
     verify = vs;
-    ReplyInternal(r);
+    ReplyInternal(r, l);
 }
 
 void
 Promise::Reply(int r, VerifyStatus vs, std::vector<std::string> keys,
     std::vector<uint64_t> blocks)
 {
-    lock_guard<mutex> l(lock);
+    unique_lock<mutex> l(lock);
     for (auto& k : keys) {
       unverified_keys.emplace_back(k);
     }
@@ -106,7 +122,7 @@ Promise::Reply(int r, VerifyStatus vs, std::vector<std::string> keys,
       estimated_blocks.emplace_back(b);
     }
     verify = vs;
-    ReplyInternal(r);
+    ReplyInternal(r, l);
 }
 
 // Functions for getting a reply from the promise
@@ -7,6 +7,7 @@
 #include "distributed/store/common/transaction.h"
 
 #include <condition_variable>
+#include <functional>
 #include <mutex>
 
 enum VerifyStatus {
@@ -15,6 +16,11 @@ enum VerifyStatus {
   FAILED = 9
 };
 
+class Promise;
+
+// Runs on the replying thread once the promise has its reply
+typedef std::function<void (Promise *)> promise_callback_t;
+
 class Promise
 {
 private:
@@ -30,12 +36,16 @@ private:
     std::vector<uint64_t> estimated_blocks;
     std::map<std::string, std::string> values;
     std::vector<Timestamp> timestamps;
+    promise_callback_t callback;
 
-    void ReplyInternal(int r);
+    void ReplyInternal(int r, std::unique_lock<std::mutex> &l);
 
 public:
     Promise();
     Promise(int timeoutMS); // timeout in milliseconds
+    // Instead of blocking on GetReply, have callback run with the reply.
+    // The callback may delete the promise.
+    Promise(int timeoutMS, promise_callback_t callback);
     ~Promise();
 
     // reply to this promise and unblock any waiting threads
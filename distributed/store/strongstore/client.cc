@@ -6,7 +6,7 @@ namespace strongstore {
 
 Client::Client(Mode mode, string configPath, int nShards,
                 int closestReplica, TrueTime timeServer)
-    : transport(0.0, 0.0, 0), mode(mode), timeServer(timeServer)
+    : mode(mode), timeServer(timeServer)
 {
     // Initialize all state here;
     client_id = 0;
@@ -17,13 +17,41 @@ Client::Client(Mode mode, string configPath, int nShards,
         client_id = dis(gen);
     }
     t_id = (client_id/10000)*10000;
+    leaseNext = leaseEnd = 0;
 
     nshards = nShards;
     bclient.reserve(nshards);
 
+    // One transport reaches every shard and the timestamp server, so
+    // their configurations must all name the same kind of peers
+    auto shmConfig = [](const string &path) {
+        ifstream stream(path);
+        if (stream.fail()) {
+            fprintf(stderr, "unable to read configuration file: %s\n",
+                    path.c_str());
+        }
+        return ShmTransport::Covers(transport::Configuration(stream));
+    };
+    bool shm = shmConfig(configPath + "0.config");
+    for (int i = 1; i < nShards; i++) {
+        if (shmConfig(configPath + to_string(i) + ".config") != shm) {
+            Panic("Shards 0 and %d are reached through different transports",
+                  i);
+        }
+    }
+    if (leased() && (shmConfig(configPath + ".tss.config") != shm)) {
+        Panic("Shards and timestamp server are reached through "
+              "different transports");
+    }
+    if (shm) {
+        transport = new ShmTransport();
+    } else {
+        transport = new TCPTransport(0.0, 0.0, 0);
+    }
+
 
     /* Start a client for time stamp server. */
-    if (mode == MODE_OCC) {
+    if (leased()) {
         string tssConfigPath = configPath + ".tss.config";
         ifstream tssConfigStream(tssConfigPath);
         if (tssConfigStream.fail()) {
@@ -31,15 +59,16 @@ Client::Client(Mode mode, string configPath, int nShards,
                     tssConfigPath.c_str());
         }
         transport::Configuration tssConfig(tssConfigStream);
-        tss = new replication::vr::VRClient(tssConfig, &transport);
+        tss = new replication::vr::VRClient(tssConfig, transport);
     }
 
     /* Start a client for each shard. */
     for (int i = 0; i < nShards; i++) {
         string shardConfigPath = configPath + to_string(i) + ".config";
         ShardClient *shardclient = new ShardClient(mode, shardConfigPath,
-            &transport, client_id, i, closestReplica);
+            transport, client_id, i, closestReplica);
         bclient[i] = new BufferClient(shardclient);
+        sclient.push_back(shardclient);
     }
 
     /* Run the transport in a new thread. */
@@ -49,19 +78,23 @@ Client::Client(Mode mode, string configPath, int nShards,
 
 Client::~Client()
 {
-    transport.Stop();
+    transport->Stop();
     delete tss;
     for (auto& b : bclient) {
         delete b;
     }
     clientTransport->join();
+    delete transport;
+    for (auto &entry : asyncTxns) {
+        delete entry.second;
+    }
 }
 
 /* Runs the transport event loop. */
 void
 Client::run_client()
 {
-    transport.Run();
+    transport->Run();
 }
 
 /* Begins a transaction. All subsequent operations before a commit() or
@@ -72,11 +105,12 @@ Client::run_client()
 void
 Client::Begin()
 {
-    t_id++;
+    uint64_t tid = ++t_id;
     participants.clear();
+    priority = locking() ? timeServer.GetTime() : 0;
     commit_sleep = -1;
     for (int i = 0; i < nshards; i++) {
-        bclient[i]->Begin(t_id);
+        bclient[i]->Begin(tid);
     }
 }
 
@@ -244,53 +278,84 @@ int
 Client::Prepare(uint64_t &ts)
 {
     int status;
+    set<int> waiting = participants;
+    uint64_t backoff = LOCK_BACKOFF_MIN, waited = 0;
+
+    do {
+        // 1. Send commit-prepare to all shards.
+        map<int, Promise *> promises;
 
-    // 0. go get a timestamp for OCC
-    if (mode == MODE_OCC) {
-        // Have to go to timestamp server
-        unique_lock<mutex> lk(cv_m);
+        for (auto& p : waiting) {
+            promises.emplace(p, new Promise(PREPARE_TIMEOUT));
+            bclient[p]->Prepare(Timestamp(priority), promises[p]);
+        }
 
-        transport.Timer(0, [=]() {
-		        tss->Invoke("", bind(&Client::tssCallback, this,
-                placeholders::_1,
-                placeholders::_2));
-	      });
+        // 2. Wait for reply from all shards. (abort on timeout)
 
-        cv.wait(lk);
-        ts = stol(replica_reply, NULL, 10);
-    }
+        status = REPLY_OK;
+        for (auto& entry : promises) {
+            Promise *p = entry.second;
+            // If any shard returned false, abort the transaction.
+            if (p->GetReply() != REPLY_OK) {
+                if (status != REPLY_FAIL) {
+                    status = p->GetReply();
+                }
+            } else {
+                waiting.erase(entry.first);
+            }
+            // Also, find the max of all prepare timestamp returned.
+            if (p->GetTimestamp().getTimestamp() > ts) {
+                ts = p->GetTimestamp().getTimestamp();
+            }
+            delete p;
+        }
 
-    // 1. Send commit-prepare to all shards.
-    list<Promise *> promises;
+        // With locks, a retry means a younger transaction holds one this
+        // needs. The shards that did prepare keep theirs while it waits.
+    } while (status == REPLY_RETRY && locking() &&
+             LockBackoff(backoff, waited));
 
-    for (auto& p : participants) {
-        promises.push_back(new Promise(PREPARE_TIMEOUT));
-        bclient[p]->Prepare(Timestamp(),promises.back());
+    // 3. For OCC, those are what the commit timestamp has to clear.
+    // Taking it once every shard is prepared orders it after the
+    // transactions this one conflicts with.
+    if (status == REPLY_OK && leased()) {
+        ts = GetTimestamp(ts);
     }
+    return status;
+}
 
-    // 2. Wait for reply from all shards. (abort on timeout)
+bool
+Client::LockBackoff(uint64_t &backoff, uint64_t &waited)
+{
+    if (waited >= COMMIT_TIMEOUT * 1000) {
+        return false;
+    }
+    usleep(backoff);
+    waited += backoff;
+    backoff = min(backoff * 2, (uint64_t)LOCK_BACKOFF_MAX);
+    return true;
+}
 
-    status = REPLY_OK;
-    for (auto& p : promises) {
-        // If any shard returned false, abort the transaction.
-        if (p->GetReply() != REPLY_OK) {
-            if (status != REPLY_FAIL) {
-                status = p->GetReply();
-            }
-        }
-        // Also, find the max of all prepare timestamp returned.
-        if (p->GetTimestamp().getTimestamp() > ts) {
-            ts = p->GetTimestamp().getTimestamp();
-        }
-        delete p;
+bool
+Client::LockBackoffAsync(AsyncTxn *txn, function<void ()> retry)
+{
+    if (txn->waited >= COMMIT_TIMEOUT * 1000) {
+        return false;
     }
-    return status;
+    transport->TimerMicros(txn->backoff, retry);
+    txn->waited += txn->backoff;
+    txn->backoff = min(txn->backoff * 2, (uint64_t)LOCK_BACKOFF_MAX);
+    return true;
 }
 
 /* Attempts to commit the ongoing transaction. */
 bool
 Client::Commit()
 {
+    if (participants.size() == 1 && leased()) {
+        return CommitOnePhase(NULL);
+    }
+
     // Implementing 2 Phase Commit
     uint64_t ts = 0;
     int status;
@@ -351,6 +416,10 @@ Client::Commit()
 }
 
 bool Client::Commit(std::map<int, std::map<uint64_t, std::vector<std::string>>>& keys) {
+    if (participants.size() == 1 && leased()) {
+        return CommitOnePhase(&keys);
+    }
+
   // Implementing 2 Phase Commit
     uint64_t ts = 0;
     int status;
@@ -432,6 +501,43 @@ bool Client::Commit(std::map<int, std::map<uint64_t, std::vector<std::string>>>&
     return false;
 }
 
+/* Commits a transaction on a single shard, which validates and commits
+ * it in one replicated round. The shard rejects timestamps that do not
+ * clear what it has committed on the transaction's keys, so the lease is
+ * advanced past those and the request sent again. */
+bool
+Client::CommitOnePhase(unverified_keys_t *keys)
+{
+    int p = *participants.begin();
+    uint64_t floor = 0;
+    uint64_t backoff = LOCK_BACKOFF_MIN, waited = 0;
+    int status;
+
+    do {
+        uint64_t ts = GetTimestamp(floor);
+        Promise *promise = new Promise(COMMIT_TIMEOUT);
+        bclient[p]->PrepareCommit(ts, Timestamp(priority), promise);
+        status = promise->GetReply();
+        if (status == REPLY_OK && keys != NULL) {
+            for (size_t i = 0; i < promise->EstimateBlockSize(); ++i) {
+                (*keys)[p][promise->GetEstimateBlock(i)].emplace_back(
+                    promise->GetUnverifiedKey(i));
+            }
+        }
+        floor = promise->GetTimestamp().getTimestamp();
+        delete promise;
+
+        // Without a floor, the retry was for a lock held by a younger
+        // transaction
+        if (status == REPLY_RETRY && floor == 0 &&
+            !LockBackoff(backoff, waited)) {
+            status = REPLY_FAIL;
+        }
+    } while (status == REPLY_RETRY);
+
+    return status == REPLY_OK;
+}
+
 /* Aborts the ongoing transaction. */
 void
 Client::Abort()
@@ -532,6 +638,314 @@ bool Client::Audit(std::map<int, uint64_t>& seqs) {
 }
 
 
+/* Begins a pipelined transaction and returns its id. Unlike Begin, this
+ * does not wait for the previous transaction's commit to be acknowledged.
+ */
+uint64_t
+Client::BeginAsync()
+{
+    uint64_t tid = ++t_id;
+    AsyncTxn *txn = new AsyncTxn();
+    txn->ts = 0;
+    txn->priority = locking() ? timeServer.GetTime() : 0;
+    txn->status = REPLY_OK;
+    txn->outstanding = 0;
+    txn->backoff = LOCK_BACKOFF_MIN;
+    txn->waited = 0;
+
+    lock_guard<mutex> lock(async_m);
+    asyncTxns.emplace(tid, txn);
+    return tid;
+}
+
+/* Reads keys, one request per shard, and calls back once every shard has
+ * replied. The reads join the transaction's read set as they would with
+ * BatchGet. */
+void
+Client::BatchGetAsync(uint64_t tid, const vector<string> &keys,
+                      get_callback_t callback)
+{
+    map<int, vector<string>> shardKeys;
+    for (auto &key : keys) {
+        shardKeys[key_to_shard(key, nshards)].push_back(key);
+    }
+    if (shardKeys.empty()) {
+        callback(REPLY_OK, map<string, string>());
+        return;
+    }
+
+    struct Gather
+    {
+        size_t outstanding;
+        int status;
+        map<string, string> values;
+    };
+    auto gather = make_shared<Gather>();
+    gather->outstanding = shardKeys.size();
+    gather->status = REPLY_OK;
+
+    for (auto &entry : shardKeys) {
+        int shard = entry.first;
+        Promise *promise = new Promise(GET_TIMEOUT,
+            [this, tid, shard, gather, callback](Promise *p) {
+            if (p->GetReply() == REPLY_OK) {
+                auto &values = p->getValues();
+                {
+                    lock_guard<mutex> lock(async_m);
+                    auto it = asyncTxns.find(tid);
+                    if (it != asyncTxns.end()) {
+                        Transaction &txn = it->second->shards[shard];
+                        size_t count = 0;
+                        for (auto &value : values) {
+                            txn.addReadSet(value.first,
+                                           p->GetTimestamp(count));
+                            ++count;
+                        }
+                    }
+                }
+                gather->values.insert(values.begin(), values.end());
+            } else {
+                gather->status = p->GetReply();
+            }
+            delete p;
+
+            if (--gather->outstanding == 0) {
+                callback(gather->status, gather->values);
+            }
+        });
+        sclient[shard]->BatchGet(tid, entry.second, promise);
+    }
+}
+
+/* Buffers a write of a pipelined transaction. */
+void
+Client::PutAsync(uint64_t tid, const string &key, const string &value)
+{
+    int i = key_to_shard(key, nshards);
+
+    lock_guard<mutex> lock(async_m);
+    auto it = asyncTxns.find(tid);
+    ASSERT(it != asyncTxns.end());
+    it->second->shards[i].addWriteSet(key, value);
+}
+
+/* Runs two phase commit for a pipelined transaction. The callback gets
+ * the outcome and, like Commit(keys), the keys whose proofs are pending.
+ */
+void
+Client::CommitAsync(uint64_t tid, commit_callback_t callback)
+{
+    AsyncTxn *txn;
+    {
+        lock_guard<mutex> lock(async_m);
+        auto it = asyncTxns.find(tid);
+        ASSERT(it != asyncTxns.end());
+        txn = it->second;
+    }
+    txn->callback = callback;
+
+    transport->Timer(0, [=]() {
+        if (txn->shards.size() == 1 && leased()) {
+            CommitAsyncOnePhase(tid, txn);
+        } else {
+            PrepareAsync(tid, txn, 0);
+        }
+    });
+}
+
+/* Aborts a pipelined transaction that has not been committed. */
+void
+Client::AbortAsync(uint64_t tid)
+{
+    AsyncTxn *txn;
+    {
+        lock_guard<mutex> lock(async_m);
+        auto it = asyncTxns.find(tid);
+        ASSERT(it != asyncTxns.end());
+        txn = it->second;
+        asyncTxns.erase(it);
+    }
+    AbortAsyncShards(tid, txn);
+    delete txn;
+}
+
+void
+Client::PrepareAsync(uint64_t tid, AsyncTxn *txn, int attempt)
+{
+    if (txn->shards.empty()) {
+        FinishAsync(tid, txn, true);
+        return;
+    }
+
+    // 1. Send commit-prepare to the shards not prepared yet.
+    txn->status = REPLY_OK;
+    txn->outstanding = txn->shards.size() - txn->prepared.size();
+    for (auto &entry : txn->shards) {
+        int shard = entry.first;
+        if (txn->prepared.count(shard) > 0) {
+            continue;
+        }
+        Promise *promise = new Promise(PREPARE_TIMEOUT,
+            [this, tid, txn, attempt, shard](Promise *p) {
+            // 2. Collect the replies, any failure aborts
+            if (p->GetReply() == REPLY_OK) {
+                txn->prepared.insert(shard);
+            } else if (txn->status != REPLY_FAIL) {
+                txn->status = p->GetReply();
+            }
+            if (p->GetTimestamp().getTimestamp() > txn->ts) {
+                txn->ts = p->GetTimestamp().getTimestamp();
+            }
+            delete p;
+
+            if (--txn->outstanding == 0) {
+                PrepareAsyncDone(tid, txn, attempt);
+            }
+        });
+        sclient[shard]->Prepare(tid, entry.second, Timestamp(txn->priority),
+                                promise);
+    }
+}
+
+void
+Client::PrepareAsyncDone(uint64_t tid, AsyncTxn *txn, int attempt)
+{
+    if (txn->status != REPLY_OK && txn->status != REPLY_FAIL &&
+        attempt + 1 < COMMIT_RETRIES) {
+        PrepareAsync(tid, txn, attempt + 1);
+        return;
+    }
+
+    // Waiting for locks, the shards that did prepare keep theirs
+    if (txn->status == REPLY_RETRY && locking() &&
+        LockBackoffAsync(txn, [=]() { PrepareAsync(tid, txn, attempt); })) {
+        return;
+    }
+
+    if (txn->status != REPLY_OK) {
+        // 4. If not, send abort to all shards.
+        AbortAsyncShards(tid, txn);
+        FinishAsync(tid, txn, false);
+        return;
+    }
+
+    // For OCC, take the commit timestamp above what the shards reported
+    if (leased()) {
+        LeaseTimestamp(txn->ts, [=](uint64_t ts) {
+            txn->ts = ts;
+            CommitAsyncShards(tid, txn);
+        });
+        return;
+    }
+
+    // For Spanner like systems, wait out the uncertainty on a timer
+    // rather than sleeping on the transport thread.
+    if (mode == MODE_SPAN_OCC || mode == MODE_SPAN_LOCK) {
+        uint64_t now, err;
+        timeServer.GetTimeAndError(now, err);
+
+        if (now > txn->ts) {
+            txn->ts = now;
+        } else {
+            uint64_t diff = ((txn->ts >> 32) - (now >> 32))*1000000 +
+                    ((txn->ts & 0xffffffff) - (now & 0xffffffff));
+            err += diff;
+        }
+
+        if (err > 1000000)
+            Warning("Sleeping for too long! %lu; now,ts: %lu,%lu",
+                    err, now, txn->ts);
+        transport->TimerMicros(err, [=]() {
+            CommitAsyncShards(tid, txn);
+        });
+        return;
+    }
+
+    CommitAsyncShards(tid, txn);
+}
+
+void
+Client::CommitAsyncShards(uint64_t tid, AsyncTxn *txn)
+{
+    // 3. Send commits, and report once every shard has applied them
+    txn->outstanding = txn->shards.size();
+    for (auto &entry : txn->shards) {
+        int shard = entry.first;
+        Promise *promise = new Promise(COMMIT_TIMEOUT,
+            [this, tid, txn, shard](Promise *p) {
+            for (size_t i = 0; i < p->EstimateBlockSize(); ++i) {
+                txn->keys[shard][p->GetEstimateBlock(i)].emplace_back(
+                    p->GetUnverifiedKey(i));
+            }
+            delete p;
+
+            if (--txn->outstanding == 0) {
+                FinishAsync(tid, txn, true);
+            }
+        });
+        sclient[shard]->Commit(tid, entry.second, {}, txn->ts, promise);
+    }
+}
+
+/* CommitOnePhase, with txn->ts as the floor to clear. */
+void
+Client::CommitAsyncOnePhase(uint64_t tid, AsyncTxn *txn)
+{
+    LeaseTimestamp(txn->ts, [this, tid, txn](uint64_t ts) {
+        auto &entry = *txn->shards.begin();
+        int shard = entry.first;
+        Promise *promise = new Promise(COMMIT_TIMEOUT,
+            [this, tid, txn, shard](Promise *p) {
+            int status = p->GetReply();
+            if (status == REPLY_OK) {
+                for (size_t i = 0; i < p->EstimateBlockSize(); ++i) {
+                    txn->keys[shard][p->GetEstimateBlock(i)].emplace_back(
+                        p->GetUnverifiedKey(i));
+                }
+            }
+            txn->ts = p->GetTimestamp().getTimestamp();
+            delete p;
+
+            if (status == REPLY_RETRY && txn->ts == 0) {
+                // a lock is held by a younger transaction
+                if (!LockBackoffAsync(txn,
+                        [=]() { CommitAsyncOnePhase(tid, txn); })) {
+                    FinishAsync(tid, txn, false);
+                }
+            } else if (status == REPLY_RETRY) {
+                CommitAsyncOnePhase(tid, txn);
+            } else {
+                FinishAsync(tid, txn, status == REPLY_OK);
+            }
+        });
+        sclient[shard]->PrepareCommit(tid, entry.second, {}, ts,
+                                      Timestamp(txn->priority), promise);
+    });
+}
+
+void
+Client::AbortAsyncShards(uint64_t tid, AsyncTxn *txn)
+{
+    // Nobody waits for aborts, the promises only clean up after themselves
+    for (auto &entry : txn->shards) {
+        sclient[entry.first]->Abort(tid, Transaction(),
+            new Promise(ABORT_TIMEOUT, [](Promise *p) { delete p; }));
+    }
+}
+
+void
+Client::FinishAsync(uint64_t tid, AsyncTxn *txn, bool committed)
+{
+    {
+        lock_guard<mutex> lock(async_m);
+        asyncTxns.erase(tid);
+    }
+    if (txn->callback) {
+        txn->callback(committed, txn->keys);
+    }
+    delete txn;
+}
+
 /* Return statistics of most recent transaction. */
 vector<int>
 Client::Stats()
@@ -540,17 +954,88 @@ Client::Stats()
     return v;
 }
 
-/* Callback from a tss replica upon any request. */
+/* Returns a commit timestamp above floor, going to the timestamp server
+ * only when the lease cannot provide one. */
+uint64_t
+Client::GetTimestamp(uint64_t floor)
+{
+    uint64_t ts;
+    if (TakeTimestamp(floor, ts)) {
+        return ts;
+    }
+
+    unique_lock<mutex> lk(cv_m);
+    bool done = false;
+    transport->Timer(0, [&]() {
+        LeaseTimestamp(floor, [&](uint64_t leased) {
+            lock_guard<mutex> lock(cv_m);
+            ts = leased;
+            done = true;
+            cv.notify_all();
+        });
+    });
+    cv.wait(lk, [&] { return done; });
+    return ts;
+}
+
+/* Every timestamp in the lease belongs to this client alone, so one below
+ * floor can be skipped over without giving up uniqueness. */
+bool
+Client::TakeTimestamp(uint64_t floor, uint64_t &ts)
+{
+    lock_guard<mutex> lock(lease_m);
+    uint64_t next = max(leaseNext, floor + 1);
+    if (next >= leaseEnd) {
+        return false;
+    }
+    ts = next;
+    leaseNext = next + 1;
+    return true;
+}
+
 void
-Client::tssCallback(const string &request, const string &reply)
+Client::LeaseTimestamp(uint64_t floor, function<void (uint64_t)> callback)
 {
-    lock_guard<mutex> lock(cv_m);
+    uint64_t ts;
+    if (TakeTimestamp(floor, ts)) {
+        callback(ts);
+        return;
+    }
 
-    // Copy reply to "replica_reply".
-    replica_reply = reply;
+    // Transactions that run out together share one renewal
+    leaseWaiters.emplace_back(floor, callback);
+    if (leaseWaiters.size() == 1) {
+        RenewLease();
+    }
+}
+
+void
+Client::RenewLease()
+{
+    tss->Invoke(to_string(TIMESTAMP_LEASE),
+                [this](const string &request, const string &reply) {
+        {
+            lock_guard<mutex> lock(lease_m);
+            leaseNext = stoul(reply, NULL, 10);
+            leaseEnd = leaseNext + TIMESTAMP_LEASE;
+        }
 
-    // Wake up thread waiting for the reply.
-    cv.notify_all();
+        // A floor above the new lease was committed from a lease granted
+        // in the meantime, so those waiters need another one
+        auto waiters = std::move(leaseWaiters);
+        leaseWaiters.clear();
+        for (auto &waiter : waiters) {
+            uint64_t ts;
+            if (TakeTimestamp(waiter.first, ts)) {
+                waiter.second(ts);
+            } else {
+                leaseWaiters.push_back(waiter);
+            }
+        }
+        if (!leaseWaiters.empty()) {
+            RenewLease();
+        }
+    });
 }
 
 } // namespace strongstore
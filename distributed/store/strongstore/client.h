@@ -4,6 +4,7 @@
 #include "distributed/lib/assert.h"
 #include "distributed/lib/message.h"
 #include "distributed/lib/configuration.h"
+#include "distributed/lib/shmtransport.h"
 #include "distributed/lib/tcptransport.h"
 #include "distributed/replication/vr/client.h"
 #include "distributed/store/common/frontend/bufferclient.h"
@@ -12,9 +13,18 @@
 #include "distributed/store/strongstore/shardclient.h"
 #include "distributed/proto/strong-proto.pb.h"
 
+#include <atomic>
+#include <functional>
 #include <set>
 #include <thread>
 
+// Timestamps a client leases from the timestamp server at a time
+#define TIMESTAMP_LEASE 1000
+
+// Backoff between prepares of a transaction waiting for locks, in us
+#define LOCK_BACKOFF_MIN 100
+#define LOCK_BACKOFF_MAX 10000
+
 namespace strongstore {
 
 class Client : public ::Client
@@ -43,21 +53,80 @@ public:
     std::vector<int> Stats();
     bool Audit(std::map<int, uint64_t>& seqs);
 
+    // Pipelined interface. Any number of transactions started with
+    // BeginAsync can be in flight at once, next to the synchronous one;
+    // the shard clients match replies to them by request id. Callbacks run
+    // on the transport thread and must not block.
+    typedef std::map<int, std::map<uint64_t, std::vector<std::string>>>
+        unverified_keys_t;
+    typedef std::function<void (int status,
+        const std::map<std::string, std::string> &values)> get_callback_t;
+    typedef std::function<void (bool committed,
+        const unverified_keys_t &keys)> commit_callback_t;
+
+    uint64_t BeginAsync();
+    void BatchGetAsync(uint64_t tid, const std::vector<std::string> &keys,
+        get_callback_t callback);
+    void PutAsync(uint64_t tid, const string &key, const string &value);
+    // The transaction must not be used once its commit or abort is issued
+    void CommitAsync(uint64_t tid, commit_callback_t callback);
+    void AbortAsync(uint64_t tid);
+
 private:
+    // A transaction of the pipelined interface
+    struct AsyncTxn
+    {
+        std::map<int, Transaction> shards;  // participants' read and write sets
+        commit_callback_t callback;
+        uint64_t ts;                        // largest prepare timestamp
+        uint64_t priority;                  // under wait-die, for lock modes
+        int status;                         // of the current phase
+        size_t outstanding;                 // replies the phase still needs
+        std::set<int> prepared;             // shards that replied OK
+        uint64_t backoff;                   // before the next lock wait
+        uint64_t waited;                    // on locks so far
+        unverified_keys_t keys;
+    };
+
     /* Private helper functions. */
     void run_client(); // Runs the transport event loop.
 
-    // timestamp server call back
-    void tssCallback(const string &request, const string &reply);
+    // Whether commit timestamps come from the timestamp server
+    bool leased() const { return mode == MODE_OCC || mode == MODE_LOCK; }
+    // Whether shards lock, so that a prepare may be told to wait
+    bool locking() const { return mode == MODE_LOCK || mode == MODE_SPAN_LOCK; }
+    // Sleeps out one lock wait, false once waiting is no longer worth it
+    bool LockBackoff(uint64_t &backoff, uint64_t &waited);
+    // The same for a pipelined transaction, calling retry after the wait
+    bool LockBackoffAsync(AsyncTxn *txn, std::function<void ()> retry);
+
+    // Commit timestamps for OCC, from a lease on a block of them. The
+    // timestamp handed out is above floor and unique to this client.
+    uint64_t GetTimestamp(uint64_t floor);
+    bool TakeTimestamp(uint64_t floor, uint64_t &ts);
+    // On the transport thread, renewing the lease when it is used up
+    void LeaseTimestamp(uint64_t floor, std::function<void (uint64_t)> callback);
+    void RenewLease();
 
     // local Prepare function
     int Prepare(uint64_t &ts);
 
+    // Commit when the only participant can prepare and commit at once
+    bool CommitOnePhase(unverified_keys_t *keys);
+
+    // Steps of CommitAsync, all on the transport thread
+    void PrepareAsync(uint64_t tid, AsyncTxn *txn, int attempt);
+    void PrepareAsyncDone(uint64_t tid, AsyncTxn *txn, int attempt);
+    void CommitAsyncShards(uint64_t tid, AsyncTxn *txn);
+    void CommitAsyncOnePhase(uint64_t tid, AsyncTxn *txn);
+    void AbortAsyncShards(uint64_t tid, AsyncTxn *txn);
+    void FinishAsync(uint64_t tid, AsyncTxn *txn, bool committed);
+
     // Unique ID for this client.
     uint64_t client_id;
 
-    // Ongoing transaction ID.
-    uint64_t t_id;
+    // Last transaction ID handed out, to either interface.
+    std::atomic<uint64_t> t_id;
 
     // Number of shards in SpanStore.
     long nshards;
@@ -65,8 +134,13 @@ private:
     // List of participants in the ongoing transaction.
     std::set<int> participants;
 
-    // Transport used by paxos client proxies.
-    TCPTransport transport;
+    // Wait-die priority of the ongoing transaction, its start time. Older
+    // transactions wait for locks, younger ones abort.
+    uint64_t priority;
+
+    // Transport used by paxos client proxies. Shared memory when the
+    // replicas are on this host.
+    Transport *transport;
     
     // Thread running the transport event loop.
     std::thread *clientTransport;
@@ -74,6 +148,13 @@ private:
     // Buffering client for each shard.
     std::vector<BufferClient *> bclient;
 
+    // The shard clients underneath, shared by all pipelined transactions.
+    std::vector<ShardClient *> sclient;
+
+    // Pipelined transactions that have not finished yet.
+    std::mutex async_m;
+    std::map<uint64_t, AsyncTxn *> asyncTxns;
+
     // Mode in which spanstore runs.
     Mode mode;
 
@@ -86,7 +167,16 @@ private:
     // Synchronization variables.
     std::condition_variable cv;
     std::mutex cv_m;
-    string replica_reply;
+
+    // Leased timestamps not handed out yet, [leaseNext, leaseEnd).
+    std::mutex lease_m;
+    uint64_t leaseNext;
+    uint64_t leaseEnd;
+
+    // Waiting for the lease to be renewed, with the floor each needs.
+    // Only touched on the transport thread.
+    std::vector<std::pair<uint64_t, std::function<void (uint64_t)>>>
+        leaseWaiters;
 
     // Time spend sleeping for commit.
     int commit_sleep;
@@ -0,0 +1,273 @@
+#include "distributed/store/strongstore/lockstore.h"
+
+namespace strongstore {
+
+using namespace std;
+
+LockStore::LockStore(const std::string& db_path, int timeout) :
+    store(db_path, timeout) { }
+LockStore::~LockStore() { }
+
+int LockStore::BatchGet(uint64_t id, const std::vector<std::string> &keys,
+                        strongstore::proto::Reply* reply) {
+  store.GetDigest(reply);
+  if (store.BatchGet(keys, reply)) {
+    return REPLY_OK;
+  } else {
+    return REPLY_FAIL;
+  }
+}
+
+int LockStore::GetRange(const std::string& start, const std::string& end,
+                        strongstore::proto::Reply* reply) {
+  store.GetDigest(reply);
+  if (store.GetRange(start, end, reply)) {
+    return REPLY_OK;
+  } else {
+    return REPLY_FAIL;
+  }
+}
+
+int
+LockStore::Prepare(uint64_t id, const Transaction &txn)
+{
+  return Prepare(id, txn, Timestamp());
+}
+
+int
+LockStore::Prepare(uint64_t id, const Transaction &txn,
+                   const Timestamp &timestamp)
+{
+  if (prepared.find(id) != prepared.end()) {
+    return REPLY_OK;
+  }
+
+  std::vector<std::string> reads, writes;
+  for (auto &read : txn.getReadSet()) {
+    reads.push_back(read.first);
+  }
+  for (auto &write : txn.getWriteSet()) {
+    writes.push_back(write.first);
+  }
+
+  // Either all locks are taken or none, so a transaction told to wait or
+  // die holds nothing here
+  int status = locks.LockAll(id, timestamp.getTimestamp(), reads, writes);
+  if (status != REPLY_OK) {
+    return status;
+  }
+
+  // The locks keep the read set from changing from here on, but a write
+  // may have committed after the transaction read it. Only keys whose
+  // bucket saw a newer put need their latest version looked up.
+  for (auto &read : txn.getReadSet()) {
+    uint64_t ts = read.second.getTimestamp();
+    if (store.LastPut(read.first) > ts && store.Version(read.first) != ts) {
+      release(id, txn);
+      return REPLY_FAIL;
+    }
+  }
+  prepared[id] = std::make_pair(txn, timestamp.getTimestamp());
+  return REPLY_OK;
+}
+
+uint64_t
+LockStore::LastCommitted(const Transaction &txn)
+{
+  uint64_t last = 0;
+  for (auto &read : txn.getReadSet()) {
+    last = std::max(last, store.LastPut(read.first));
+  }
+  for (auto &write : txn.getWriteSet()) {
+    last = std::max(last, store.LastPut(write.first));
+  }
+  return last;
+}
+
+void
+LockStore::release(uint64_t id, const Transaction &txn)
+{
+  std::vector<std::string> keys;
+  for (auto &read : txn.getReadSet()) {
+    keys.push_back(read.first);
+  }
+  for (auto &write : txn.getWriteSet()) {
+    keys.push_back(write.first);
+  }
+  locks.ReleaseAll(id, keys);
+}
+
+void
+LockStore::Abort(uint64_t id, const Transaction &txn)
+{
+  auto it = prepared.find(id);
+  if (it == prepared.end()) {
+    return;
+  }
+  release(id, it->second.first);
+  prepared.erase(it);
+}
+
+void
+LockStore::Load(const vector<string> &keys, const vector<string> &values,
+        const Timestamp &timestamp)
+{
+  store.put(keys, values, timestamp, nullptr);
+}
+
+void
+LockStore::Commit(uint64_t id, uint64_t timestamp,
+                  std::vector<std::pair<std::string, size_t>> ver_keys,
+                  strongstore::proto::Reply* reply)
+{
+  auto it = prepared.find(id);
+  if (it == prepared.end()) {
+    // committed already, in a snapshot this replica restored
+    return;
+  }
+  const Transaction &txn = it->second.first;
+
+  store.GetDigest(reply);
+
+  std::vector<std::string> keys, vals;
+  for (auto &read: txn.getReadSet()) {
+    keys.push_back(read.first);
+  }
+  if (keys.size() > 0) {
+    store.BatchGet(keys, reply);
+    keys.clear();
+  }
+
+  if (ver_keys.size() > 0) {
+    store.GetNVersions(ver_keys, reply);
+  }
+
+  for (auto &write : txn.getWriteSet()) {
+    keys.push_back(write.first);
+    vals.push_back(write.second);
+  }
+  if (keys.size() > 0) {
+    store.put(keys, vals, Timestamp(timestamp), reply);
+  }
+
+  release(id, txn);
+  prepared.erase(it);
+}
+
+void
+LockStore::Commit(uint64_t id, uint64_t timestamp,
+                  strongstore::proto::Reply* reply)
+{
+  auto it = prepared.find(id);
+  if (it == prepared.end()) {
+    return;
+  }
+  const Transaction &txn = it->second.first;
+
+  store.GetDigest(reply);
+
+  std::vector<std::string> keys, vals;
+  for (auto &write : txn.getWriteSet()) {
+    keys.push_back(write.first);
+    vals.push_back(write.second);
+  }
+  store.put(keys, vals, Timestamp(timestamp), nullptr);
+
+  release(id, txn);
+  prepared.erase(it);
+}
+
+int
+LockStore::GetProof(const std::map<uint64_t, std::vector<std::string>> &keys,
+                    strongstore::proto::Reply* reply)
+{
+    if (store.GetProof(keys, reply)) {
+        return REPLY_OK;
+    } else {
+        return REPLY_FAIL;
+    }
+}
+
+int
+LockStore::GetProof(const uint64_t seq,
+                    strongstore::proto::Reply* reply)
+{
+    store.GetDigest(reply);
+    if (store.GetProof(seq, reply)) {
+        return REPLY_OK;
+    } else {
+        return REPLY_FAIL;
+    }
+}
+
+int
+LockStore::GetDigest(strongstore::proto::Reply* reply)
+{
+  store.GetDigest(reply);
+  return REPLY_OK;
+}
+
+void
+LockStore::SnapshotBase(std::string &base)
+{
+  store.GetSnapshotBase(&base);
+}
+
+// The store's state plus the prepared transactions, whose locks the
+// restoring replica takes again. They go in the first part.
+void
+LockStore::Snapshot(const std::string &base,
+                    const std::function<void (std::string &part)> &send)
+{
+  bool first = true;
+  store.Snapshot(base, [&](proto::Snapshot &msg) {
+    if (first) {
+      for (auto &t : prepared) {
+        auto p = msg.add_prepared();
+        p->set_txnid(t.first);
+        t.second.first.serialize(p->mutable_txn());
+        p->set_timestamp(t.second.second);
+      }
+      first = false;
+    }
+    std::string part;
+    msg.SerializeToString(&part);
+    send(part);
+  });
+}
+
+void
+LockStore::RestorePart(size_t part, const std::string &data)
+{
+  proto::Snapshot m;
+  if (!m.ParseFromString(data)) {
+    Panic("Invalid store snapshot");
+  }
+  if (part == 0) {
+    restoring.Clear();
+  }
+  restoring.mutable_prepared()->MergeFrom(m.prepared());
+  m.clear_prepared();
+  store.RestorePart(part, &m);
+}
+
+void
+LockStore::Restore()
+{
+  proto::Snapshot msg;
+  msg.Swap(&restoring);
+  store.Restore();
+
+  for (auto &t : prepared) {
+    release(t.first, t.second.first);
+  }
+  prepared.clear();
+  for (auto &p : msg.prepared()) {
+    if (Prepare(p.txnid(), Transaction(p.txn()),
+                Timestamp(p.timestamp())) != REPLY_OK) {
+      Panic("Prepared transactions in snapshot conflict");
+    }
+  }
+}
+
+} // namespace strongstore
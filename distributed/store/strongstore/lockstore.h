@@ -0,0 +1,86 @@
+#ifndef _STRONG_LOCK_STORE_H_
+#define _STRONG_LOCK_STORE_H_
+
+#include "distributed/lib/assert.h"
+#include "distributed/lib/message.h"
+#include "distributed/store/common/backend/lockserver.h"
+#include "distributed/store/common/backend/versionstore.h"
+#include "distributed/store/common/backend/txnstore.h"
+#include "distributed/store/common/transaction.h"
+
+#include <map>
+#include <vector>
+
+namespace strongstore {
+
+// Strict two-phase locking. Prepare takes every lock the transaction
+// needs, and they are held until it commits or aborts. Reads of the read
+// set are served at commit, under those locks.
+class LockStore : public TxnStore
+{
+public:
+    LockStore(const std::string& db_path, int timeout);
+    ~LockStore();
+
+    int BatchGet(uint64_t id,
+                 const std::vector<std::string> &keys,
+                 strongstore::proto::Reply* reply);
+
+    int GetRange(const std::string &start, const std::string &end,
+                 strongstore::proto::Reply* reply);
+
+    int Prepare(uint64_t id, const Transaction &txn);
+
+    int Prepare(uint64_t id, const Transaction &txn,
+                const Timestamp &timestamp);
+
+    uint64_t LastCommitted(const Transaction &txn);
+
+    void Abort(uint64_t id, const Transaction &txn = Transaction());
+
+    void Load(const std::vector<std::string> &keys,
+              const std::vector<std::string> &values,
+              const Timestamp &timestamp);
+
+    void Commit(uint64_t id, uint64_t timestamp,
+                std::vector<std::pair<std::string, size_t>> ver_keys,
+                strongstore::proto::Reply* reply);
+
+    void Commit(uint64_t id, uint64_t timestamp,
+                strongstore::proto::Reply* reply);
+
+    int GetProof(const std::map<uint64_t, std::vector<std::string>> &keys,
+                 strongstore::proto::Reply* reply);
+
+    int GetProof(const uint64_t seq,
+                  strongstore::proto::Reply* reply);
+
+    int GetDigest(strongstore::proto::Reply* reply);
+
+    void SnapshotBase(std::string &base);
+
+    void Snapshot(const std::string &base,
+                  const std::function<void (std::string &part)> &send);
+
+    void RestorePart(size_t part, const std::string &data);
+
+    void Restore();
+
+private:
+    // Data store.
+    VersionedKVStore store;
+
+    // prepared transactions of the snapshot being restored
+    proto::Snapshot restoring;
+
+    LockServer locks;
+
+    // Prepared transactions and their wait-die timestamps.
+    std::map<uint64_t, std::pair<Transaction, uint64_t>> prepared;
+
+    void release(uint64_t id, const Transaction &txn);
+};
+
+} // namespace strongstore
+
+#endif /* _STRONG_LOCK_STORE_H_ */
@@ -47,6 +47,12 @@ OCCStore::Prepare(uint64_t id, const Transaction &txn)
       Abort(id);
       return REPLY_FAIL;
     }
+    // If the version read has been overwritten since, abort.
+    uint64_t ts = read.second.getTimestamp();
+    if (store.LastPut(read.first) > ts && store.Version(read.first) != ts) {
+      Abort(id);
+      return REPLY_FAIL;
+    }
   }
 
   // Check for conflicts with the write set.
@@ -63,6 +69,19 @@ OCCStore::Prepare(uint64_t id, const Transaction &txn)
   return REPLY_OK;
 }
 
+uint64_t
+OCCStore::LastCommitted(const Transaction &txn)
+{
+  uint64_t last = 0;
+  for (auto &read : txn.getReadSet()) {
+    last = std::max(last, store.LastPut(read.first));
+  }
+  for (auto &write : txn.getWriteSet()) {
+    last = std::max(last, store.LastPut(write.first));
+  }
+  return last;
+}
+
 void
 OCCStore::Abort(uint64_t id, const Transaction &txn)
 {
@@ -81,7 +100,10 @@ OCCStore::Commit(uint64_t id, uint64_t timestamp,
                  std::vector<std::pair<std::string, size_t>> ver_keys,
                  strongstore::proto::Reply* reply)
 {
-  ASSERT(prepared.find(id) != prepared.end());
+  if (prepared.find(id) == prepared.end()) {
+    // committed already, in a snapshot this replica restored
+    return;
+  }
   Transaction txn = prepared[id];
 
   store.GetDigest(reply);
@@ -138,6 +160,9 @@ void
 OCCStore::Commit(uint64_t id, uint64_t timestamp,
                  strongstore::proto::Reply* reply)
 {
+  if (prepared.find(id) == prepared.end()) {
+    return;
+  }
   Transaction txn = prepared[id];
 
   store.GetDigest(reply);
@@ -152,6 +177,69 @@ OCCStore::Commit(uint64_t id, uint64_t timestamp,
   prepared.erase(id);
 }
 
+int
+OCCStore::GetDigest(strongstore::proto::Reply* reply)
+{
+  store.GetDigest(reply);
+  return REPLY_OK;
+}
+
+void
+OCCStore::SnapshotBase(std::string &base)
+{
+  store.GetSnapshotBase(&base);
+}
+
+// The store's state plus the prepared transactions, which go in the
+// first part
+void
+OCCStore::Snapshot(const std::string &base,
+                   const std::function<void (std::string &part)> &send)
+{
+  bool first = true;
+  store.Snapshot(base, [&](proto::Snapshot &msg) {
+    if (first) {
+      for (auto &t : prepared) {
+        auto p = msg.add_prepared();
+        p->set_txnid(t.first);
+        t.second.serialize(p->mutable_txn());
+      }
+      first = false;
+    }
+    std::string part;
+    msg.SerializeToString(&part);
+    send(part);
+  });
+}
+
+void
+OCCStore::RestorePart(size_t part, const std::string &data)
+{
+  proto::Snapshot m;
+  if (!m.ParseFromString(data)) {
+    Panic("Invalid store snapshot");
+  }
+  if (part == 0) {
+    restoring.Clear();
+  }
+  restoring.mutable_prepared()->MergeFrom(m.prepared());
+  m.clear_prepared();
+  store.RestorePart(part, &m);
+}
+
+void
+OCCStore::Restore()
+{
+  proto::Snapshot msg;
+  msg.Swap(&restoring);
+  store.Restore();
+
+  prepared.clear();
+  for (auto &p : msg.prepared()) {
+    prepared[p.txnid()] = Transaction(p.txn());
+  }
+}
+
 set<string>
 OCCStore::getPreparedWrites()
 {
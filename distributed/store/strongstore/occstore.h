@@ -27,6 +27,8 @@ public:
 
     int Prepare(uint64_t id, const Transaction &txn);
 
+    uint64_t LastCommitted(const Transaction &txn);
+
     void Abort(uint64_t id, const Transaction &txn = Transaction());
 
     void Load(const std::vector<std::string> &keys,
@@ -46,10 +48,24 @@ public:
     int GetProof(const uint64_t seq,
                   strongstore::proto::Reply* reply);
 
+    int GetDigest(strongstore::proto::Reply* reply);
+
+    void SnapshotBase(std::string &base);
+
+    void Snapshot(const std::string &base,
+                  const std::function<void (std::string &part)> &send);
+
+    void RestorePart(size_t part, const std::string &data);
+
+    void Restore();
+
 private:
     // Data store.
     VersionedKVStore store;
 
+    // prepared transactions of the snapshot being restored
+    proto::Snapshot restoring;
+
     std::map<uint64_t, Transaction> prepared;
 
     std::set<std::string> getPreparedWrites();
@@ -2,9 +2,11 @@
 #define _STRONG_SERVER_H_
 
 #include <vector>
+#include "distributed/lib/shmtransport.h"
 #include "distributed/lib/tcptransport.h"
 #include "distributed/replication/vr/replica.h"
 #include "distributed/store/common/truetime.h"
+#include "distributed/store/strongstore/lockstore.h"
 #include "distributed/store/strongstore/occstore.h"
 #include "distributed/proto/strong-proto.pb.h"
 
@@ -28,16 +30,27 @@ public:
     virtual void LeaderUpcall(opnum_t opnum, const string &str1, bool &replicate, string &str2);
     virtual void ReplicaUpcall(opnum_t opnum, const string &str1, string &str2);
     virtual void UnloggedUpcall(const string &str1, string &str2);
+    virtual bool Checkpoint(opnum_t opnum);
+    virtual void SnapshotBase(string &base);
+    virtual void Snapshot(const string &base,
+                          const std::function<void (string &part)> &send);
+    virtual void RestorePart(opnum_t opnum, size_t part, const string &data);
+    virtual void Restore(opnum_t opnum);
     void Load(const string &key, const string &value, const Timestamp timestamp);
     void Load(const std::vector<std::string> &keys,
               const std::vector<std::string> &values,
               const Timestamp timestamp);
 
 private:
+    void Commit(const proto::Request &request, proto::Reply *reply);
+
     Mode mode;
     bool stored_procedure;
     TxnStore *store;
     TrueTime timeServer;
+    // size of the snapshot being restored, for the log
+    size_t restoreParts;
+    size_t restoreBytes;
 };
 
 } // namespace strongstore
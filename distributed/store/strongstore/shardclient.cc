@@ -30,13 +30,10 @@ ShardClient::ShardClient(Mode mode, const string &configPath,
     replica = 0;
   }
 
-  waiting = NULL;
   blockingBegin = NULL;
   uid = 0;
   tip_block = 0;
   audit_block = -1;
-  auto status = db_.Open("/tmp/auditor"+std::to_string(shard)+".store");
-  if (!status) std::cout << "auditor db open failed" << std::endl;
 }
 
 ShardClient::~ShardClient()
@@ -73,15 +70,17 @@ ShardClient::BatchGet(uint64_t id, const std::vector<std::string> &keys,
 
   int timeout = 100000;
   transport->Timer(0, [=]() {
-    waiting = promise;
+    size_t reqId = AddPending(promise);
     client->InvokeUnlogged(replica,
                            request_str,
                            bind(&ShardClient::BatchGetCallback,
                             this,
+                            reqId,
                             placeholders::_1,
                             placeholders::_2),
                            bind(&ShardClient::GetTimeout,
-                            this),
+                            this,
+                            reqId),
                            timeout);
   });
 }
@@ -102,15 +101,17 @@ ShardClient::GetRange(uint64_t id, const std::string& from,
   // set to 1 second by default
   int timeout = 100000;
   transport->Timer(0, [=]() {
-    waiting = promise;
+    size_t reqId = AddPending(promise);
     client->InvokeUnlogged(replica,
                  request_str,
                  bind(&ShardClient::GetRangeCallback,
                   this,
+                  reqId,
                   placeholders::_1,
                   placeholders::_2),
                  bind(&ShardClient::GetTimeout,
-                  this),
+                  this,
+                  reqId),
                  timeout); // timeout in ms
   });
 }
@@ -138,18 +139,18 @@ ShardClient::GetProof(const uint64_t block,
   // set to 1 second by default
   int timeout = 100000;
   transport->Timer(0, [=]() {
-    verifyPromise.emplace(uid, promise);
-    ++uid;
+    size_t reqId = AddPending(promise);
     client->InvokeUnlogged(replica,
                  request_str,
                  bind(&ShardClient::GetProofCallback,
                   this,
-                  uid - 1,
+                  reqId,
                   keys,
                   placeholders::_1,
                   placeholders::_2),
                  bind(&ShardClient::GetTimeout,
-                  this),
+                  this,
+                  reqId),
                  timeout); // timeout in ms
   });
   return true;
@@ -169,18 +170,18 @@ ShardClient::Audit(const uint64_t& seq, Promise* promise) {
   // set to 1 second by default
   int timeout = 100000;
   transport->Timer(0, [=]() {
-    verifyPromise.emplace(uid, promise);
-    ++uid;
+    size_t reqId = AddPending(promise);
     client->InvokeUnlogged(replica,
                  request_str,
                  bind(&ShardClient::AuditCallback,
                   this,
                   seq,
-                  uid - 1,
+                  reqId,
                   placeholders::_1,
                   placeholders::_2),
                  bind(&ShardClient::GetTimeout,
-                  this),
+                  this,
+                  reqId),
                  timeout); // timeout in ms
   });
   return true;
@@ -197,15 +198,19 @@ ShardClient::Prepare(uint64_t id, const Transaction &txn,
   request.set_op(Request::PREPARE);
   request.set_txnid(id);
   txn.serialize(request.mutable_prepare()->mutable_txn());
+  if (timestamp.getTimestamp() > 0) {
+    request.mutable_prepare()->set_timestamp(timestamp.getTimestamp());
+  }
   request.SerializeToString(&request_str);
 
   timeval t;
   gettimeofday(&t, NULL);
   transport->Timer(0, [=]() {
-	  waiting = promise;
+      size_t reqId = AddPending(promise);
       client->Invoke(request_str,
                bind(&ShardClient::PrepareCallback,
                 this,
+                reqId,
                 placeholders::_1,
                 placeholders::_2));
     });
@@ -232,15 +237,59 @@ ShardClient::Commit(uint64_t id, const Transaction &txn,
   }
   request.SerializeToString(&request_str);
 
-  blockingBegin = new Promise(COMMIT_TIMEOUT);
+  if (promise == NULL) {
+    // nobody waits for the reply, but the next Begin must
+    blockingBegin = new Promise(COMMIT_TIMEOUT);
+    promise = blockingBegin;
+  }
   timeval t;
   gettimeofday(&t, NULL);
   transport->Timer(0, [=]() {
-    waiting = promise;
+    size_t reqId = AddPending(promise);
 
     client->Invoke(request_str,
       bind(&ShardClient::CommitCallback,
         this,
+        reqId,
+        placeholders::_1,
+        placeholders::_2));
+  });
+}
+
+/* Validates and commits a transaction that touches this shard alone, in
+ * one replicated round. */
+void
+ShardClient::PrepareCommit(uint64_t id, const Transaction &txn,
+    const std::vector<std::pair<std::string, size_t>>& versionedKeys,
+    uint64_t timestamp, const Timestamp &prepareTimestamp, Promise *promise)
+{
+  // create prepare and commit request
+  string request_str;
+  Request request;
+  request.set_op(Request::PREPARE_COMMIT);
+  request.set_txnid(id);
+  txn.serialize(request.mutable_prepare()->mutable_txn());
+  if (prepareTimestamp.getTimestamp() > 0) {
+    request.mutable_prepare()->set_timestamp(prepareTimestamp.getTimestamp());
+  }
+  request.mutable_commit()->set_timestamp(timestamp);
+  if (versionedKeys.size() > 0) {
+    auto ver_msg = request.mutable_version();
+    for (auto& vk : versionedKeys) {
+      auto ver_keys = ver_msg->add_versionedkeys();
+      ver_keys->set_key(vk.first);
+      ver_keys->set_nversions(vk.second);
+    }
+  }
+  request.SerializeToString(&request_str);
+
+  transport->Timer(0, [=]() {
+    size_t reqId = AddPending(promise);
+
+    client->Invoke(request_str,
+      bind(&ShardClient::PrepareCommitCallback,
+        this,
+        reqId,
         placeholders::_1,
         placeholders::_2));
   });
@@ -259,26 +308,31 @@ ShardClient::Abort(uint64_t id, const Transaction &txn, Promise *promise)
   txn.serialize(request.mutable_abort()->mutable_txn());
   request.SerializeToString(&request_str);
 
-  blockingBegin = new Promise(ABORT_TIMEOUT);
+  if (promise == NULL) {
+    blockingBegin = new Promise(ABORT_TIMEOUT);
+    promise = blockingBegin;
+  }
   transport->Timer(0, [=]() {
-	  waiting = promise;
+	  size_t reqId = AddPending(promise);
 
 	  client->Invoke(request_str,
 			   bind(&ShardClient::AbortCallback,
 				this,
+				reqId,
 				placeholders::_1,
 				placeholders::_2));
   });
 }
 
 void
-ShardClient::AuditCallback(uint64_t seq, size_t uid,
+ShardClient::AuditCallback(uint64_t seq, size_t reqId,
                            const std::string& request_str,
                            const std::string& reply_str) {
   /* Replies back from a shard. */
   Reply reply;
   reply.ParseFromString(reply_str);
-  if (verifyPromise[uid] != NULL) {
+  Promise *w = TakePending(reqId);
+  if (w != NULL) {
     tip_block = reply.digest().block();
     VerifyStatus res;
     if (seq <= tip_block) {
@@ -292,10 +346,15 @@ ShardClient::AuditCallback(uint64_t seq, size_t uid,
       auditor.digest = reply_audit.digest();
       auditor.block_seq = reply_audit.block_no();
       auditor.txns = reply_audit.txns();
-      for (int i = 0; i < reply_audit.blocks_size(); ++i) {
-        auditor.blks.emplace_back(reply_audit.blocks(i));
+      auto blk_proof = reply_audit.block_proof();
+      auto& proof = auditor.blk_proof.proof;
+      proof.digest = blk_proof.digest();
+      proof.value = blk_proof.value();
+      for (int i = 0; i < blk_proof.proof_size(); ++i) {
+        proof.proof.emplace_back(blk_proof.proof(i));
+        proof.pos.emplace_back(blk_proof.pos(i));
       }
-      if (auditor.Audit(&db_, &ntxns)) {
+      if (auditor.Audit(&ntxns)) {
         res = VerifyStatus::PASS;
       } else {
         res = VerifyStatus::FAILED;
@@ -315,6 +374,9 @@ ShardClient::AuditCallback(uint64_t seq, size_t uid,
       for (int i = 0; i < reply_audit.blocks_size(); ++i) {
         auditor.blocks.emplace_back(reply_audit.blocks(i));
       }
+      for (int i = 0; i < reply_audit.mt_frontier_size(); ++i) {
+        auditor.mt_frontier.emplace_back(reply_audit.mt_frontier(i));
+      }
       for (int i = 0; i < reply_audit.mptproofs_size(); ++i) {
         auto p = reply_audit.mptproofs(i);
         ledgebase::ledgerdb::MPTProof mptproof;
@@ -326,7 +388,7 @@ ShardClient::AuditCallback(uint64_t seq, size_t uid,
         }
         auditor.mptproofs.emplace_back(mptproof);
       }
-      if (auditor.Audit(&db_)) {
+      if (auditor.Audit()) {
         res = VerifyStatus::PASS;
       } else {
         res = VerifyStatus::FAILED;
@@ -336,21 +398,20 @@ ShardClient::AuditCallback(uint64_t seq, size_t uid,
       std::cout << "# " << nblocks << " " << ntxns << std::endl;
     }
 
-    Promise *w = verifyPromise[uid];
-    verifyPromise.erase(uid);
     w->Reply(reply.status(), res);
   }
 }
 
 void
-ShardClient::GetProofCallback(size_t uid,
+ShardClient::GetProofCallback(size_t reqId,
                               const std::vector<std::string>& keys,
                               const std::string& request_str,
                               const std::string& reply_str) {
   /* Replies back from a shard. */
   Reply reply;
   reply.ParseFromString(reply_str);
-  if (verifyPromise[uid] != NULL) {
+  Promise *w = TakePending(reqId);
+  if (w != NULL) {
     tip_block = reply.digest().block();
     VerifyStatus res = VerifyStatus::PASS;
 
@@ -393,8 +454,12 @@ ShardClient::GetProofCallback(size_t uid,
       auto curr_proof = reply.sproof(i);
 
       ledgebase::sqlledger::BlockProof blk_prover;
-      for (int j = 0; j < curr_proof.blocks_size(); ++j) {
-        blk_prover.blks.emplace_back(curr_proof.blocks(j));
+      auto block_proof = curr_proof.block_proof();
+      blk_prover.proof.digest = block_proof.digest();
+      blk_prover.proof.value = block_proof.value();
+      for (int j = 0; j < block_proof.proof_size(); ++j) {
+        blk_prover.proof.proof.emplace_back(block_proof.proof(j));
+        blk_prover.proof.pos.emplace_back(block_proof.pos(j));
       }
       std::string txn_hash;
       if (!blk_prover.Verify(reply.digest().hash(), &txn_hash)) {
@@ -434,18 +499,18 @@ ShardClient::GetProofCallback(size_t uid,
                     (t1.tv_usec - t0.tv_usec));
     //std::cout << "verify " << elapsed << " " << reply.ByteSizeLong() << " " << keys.size() << " " << res << std::endl;
 
-    Promise *w = verifyPromise[uid];
-    verifyPromise.erase(uid);
     w->Reply(reply.status(), res);
   }
 }
 
 void
-ShardClient::GetRangeCallback(const string &request_str, const string &reply_str)
+ShardClient::GetRangeCallback(size_t reqId, const string &request_str,
+    const string &reply_str)
 {
   Reply reply;
   reply.ParseFromString(reply_str);
-  if (waiting != NULL) {
+  Promise *w = TakePending(reqId);
+  if (w != NULL) {
     std::vector<Timestamp> timestamps;
     std::map<std::string, std::string> values;
     std::vector<std::string> unverified_keys;
@@ -494,18 +559,18 @@ ShardClient::GetRangeCallback(const string &request_str, const string &reply_str
     }
 #endif
 
-    Promise *w = waiting;
-    waiting = NULL;
     w->Reply(reply.status(), timestamps, values, unverified_keys, estimate_blocks);
   }
 }
 
 void
-ShardClient::BatchGetCallback(const string &request_str, const string &reply_str)
+ShardClient::BatchGetCallback(size_t reqId, const string &request_str,
+    const string &reply_str)
 {
   Reply reply;
   reply.ParseFromString(reply_str);
-  if (waiting != NULL) {
+  Promise *w = TakePending(reqId);
+  if (w != NULL) {
     std::vector<Timestamp> timestamps;
     std::map<std::string, std::string> values;
     std::vector<uint64_t> estimate_blocks;
@@ -560,86 +625,135 @@ ShardClient::BatchGetCallback(const string &request_str, const string &reply_str
     // std::cout << "verify " << elapsed << " " << reply.ByteSizeLong() << " " << reply.qproof_size() << " " << vs << std::endl;
 #endif
 
-    Promise *w = waiting;
-    waiting = NULL;
     w->Reply(reply.status(), timestamps, values, unverified_keys, estimate_blocks);
   }
 }
 
 void
-ShardClient::CommitCallback(const string &request_str, const string &reply_str)
+ShardClient::CommitCallback(size_t reqId, const string &request_str,
+    const string &reply_str)
 {
   Reply reply;
   reply.ParseFromString(reply_str);
   ASSERT(reply.status() == REPLY_OK);
 
-  ASSERT(blockingBegin != NULL);
-  blockingBegin->Reply(0);
+  Promise *w = TakePending(reqId);
+  if (w != NULL) {
+    ReplyCommitted(reply, w);
+  }
+}
 
-  if (waiting != NULL) {
-    std::vector<uint64_t> estimate_blocks;
-    std::vector<std::string> unverified_keys;
-    VerifyStatus vs;
+/* Callback from a shard replica on prepare and commit completion. A
+ * transaction that did not commit gets the timestamp to retry above, if
+ * any, like a prepare reply. */
+void
+ShardClient::PrepareCommitCallback(size_t reqId, const string &request_str,
+    const string &reply_str)
+{
+  Reply reply;
+  reply.ParseFromString(reply_str);
+
+  Promise *w = TakePending(reqId);
+  if (w == NULL) {
+    return;
+  }
+  if (reply.status() == REPLY_OK) {
+    ReplyCommitted(reply, w);
+  } else if (reply.has_timestamp()) {
+    w->Reply(reply.status(), Timestamp(reply.timestamp(), 0));
+  } else {
+    w->Reply(reply.status(), Timestamp());
+  }
+}
+
+void
+ShardClient::ReplyCommitted(const Reply &reply, Promise *w)
+{
+  std::vector<uint64_t> estimate_blocks;
+  std::vector<std::string> unverified_keys;
+  VerifyStatus vs;
 #if defined(LEDGERDB) || defined(SQLLEDGER)
-    vs = VerifyStatus::UNVERIFIED;
-    tip_block = reply.digest().block();
-    for (size_t i = 0; i < reply.values_size(); ++i) {
-      auto values = reply.values(i);
-      unverified_keys.emplace_back(values.key());
-      estimate_blocks.push_back(values.estimate_block());
-    }
+  vs = VerifyStatus::UNVERIFIED;
+  tip_block = reply.digest().block();
+  for (size_t i = 0; i < reply.values_size(); ++i) {
+    auto values = reply.values(i);
+    unverified_keys.emplace_back(values.key());
+    estimate_blocks.push_back(values.estimate_block());
+  }
 #endif
 #ifdef AMZQLDB
-    struct timeval t0, t1;
-    gettimeofday(&t0, NULL);
-    vs = VerifyStatus::PASS;
-    std::string ledger = "test";
-    auto digest = ledgebase::Hash::FromBase32(reply.digest().hash());
-    for (int i = 0; i < reply.qproof_size(); ++i) {
-      ledgebase::qldb::QLProofResult prover;
-      auto curr_proof = reply.qproof(i);
-      prover.addr.ledger_name = ledgebase::Slice(ledger);
-      prover.addr.seq_no = curr_proof.blockno();
-      prover.data.key = ledgebase::Slice(curr_proof.key());
-      prover.data.val = ledgebase::Slice(curr_proof.value());
-      prover.meta.doc_seq = curr_proof.doc_seq();
-      prover.meta.version = curr_proof.version();
-      prover.meta.time = curr_proof.time();
-      for (int j = 0; j < curr_proof.hashes_size(); ++j) {
-        prover.proof.emplace_back(curr_proof.hashes(j));
-      }
-      for (int j = 0; j < curr_proof.pos_size(); ++j) {
-        prover.pos.push_back(curr_proof.pos(j));
-      }
-      if (!prover.Verify(digest)) {
-        vs = VerifyStatus::FAILED;
-      }
+  struct timeval t0, t1;
+  gettimeofday(&t0, NULL);
+  vs = VerifyStatus::PASS;
+  std::string ledger = "test";
+  auto digest = ledgebase::Hash::FromBase32(reply.digest().hash());
+  for (int i = 0; i < reply.qproof_size(); ++i) {
+    ledgebase::qldb::QLProofResult prover;
+    auto curr_proof = reply.qproof(i);
+    prover.addr.ledger_name = ledgebase::Slice(ledger);
+    prover.addr.seq_no = curr_proof.blockno();
+    prover.data.key = ledgebase::Slice(curr_proof.key());
+    prover.data.val = ledgebase::Slice(curr_proof.value());
+    prover.meta.doc_seq = curr_proof.doc_seq();
+    prover.meta.version = curr_proof.version();
+    prover.meta.time = curr_proof.time();
+    for (int j = 0; j < curr_proof.hashes_size(); ++j) {
+      prover.proof.emplace_back(curr_proof.hashes(j));
     }
-    gettimeofday(&t1, NULL);
-    auto elapsed = ((t1.tv_sec - t0.tv_sec)*1000000 +
-                    (t1.tv_usec - t0.tv_usec));
-    std::cout << "verify " << elapsed << " " << reply.ByteSizeLong() << " " << reply.qproof_size() << " " << vs << std::endl;
+    for (int j = 0; j < curr_proof.pos_size(); ++j) {
+      prover.pos.push_back(curr_proof.pos(j));
+    }
+    if (!prover.Verify(digest)) {
+      vs = VerifyStatus::FAILED;
+    }
+  }
+  gettimeofday(&t1, NULL);
+  auto elapsed = ((t1.tv_sec - t0.tv_sec)*1000000 +
+                  (t1.tv_usec - t0.tv_usec));
+  std::cout << "verify " << elapsed << " " << reply.ByteSizeLong() << " " << reply.qproof_size() << " " << vs << std::endl;
 #endif
 
-    Promise *w = waiting;
-    waiting = NULL;
-    w->Reply(reply.status(), vs, unverified_keys, estimate_blocks);
-  }
+  w->Reply(reply.status(), vs, unverified_keys, estimate_blocks);
 }
 
 void
-ShardClient::GetTimeout()
+ShardClient::GetTimeout(size_t reqId)
 {
-  if (waiting != NULL) {
-    Promise *w = waiting;
-    waiting = NULL;
+  Promise *w = TakePending(reqId);
+  if (w != NULL) {
     w->Reply(REPLY_TIMEOUT);
   }
 }
 
+/* Requests are matched with their promises by id, so that any number of
+ * them, from any number of transactions, can be outstanding at once. Both
+ * only run on the transport thread. */
+size_t
+ShardClient::AddPending(Promise *promise)
+{
+  size_t reqId = uid++;
+  if (promise != NULL) {
+    pending.emplace(reqId, promise);
+  }
+  return reqId;
+}
+
+Promise *
+ShardClient::TakePending(size_t reqId)
+{
+  auto it = pending.find(reqId);
+  if (it == pending.end()) {
+    return NULL;
+  }
+  Promise *w = it->second;
+  pending.erase(it);
+  return w;
+}
+
 /* Callback from a shard replica on prepare operation completion. */
 void
-ShardClient::PrepareCallback(const string &request_str, const string &reply_str)
+ShardClient::PrepareCallback(size_t reqId, const string &request_str,
+    const string &reply_str)
 {
   Reply reply;
 
@@ -649,9 +763,8 @@ ShardClient::PrepareCallback(const string &request_str, const string &reply_str)
   // std::cout << "pressize " << reply_str.size() << std::endl;
   reply.ParseFromString(reply_str);
 
-  if (waiting != NULL) {
-    Promise *w = waiting;
-    waiting = NULL;
+  Promise *w = TakePending(reqId);
+  if (w != NULL) {
     if (reply.has_timestamp()) {
       w->Reply(reply.status(), Timestamp(reply.timestamp(), 0));
     } else {
@@ -662,19 +775,16 @@ ShardClient::PrepareCallback(const string &request_str, const string &reply_str)
 
 /* Callback from a shard replica on abort operation completion. */
 void
-ShardClient::AbortCallback(const string &request_str, const string &reply_str)
+ShardClient::AbortCallback(size_t reqId, const string &request_str,
+    const string &reply_str)
 {
   // ABORTs always succeed.
   Reply reply;
   reply.ParseFromString(reply_str);
   ASSERT(reply.status() == REPLY_OK);
 
-  ASSERT(blockingBegin != NULL);
-  blockingBegin->Reply(0);
-
-  if (waiting != NULL) {
-    Promise *w = waiting;
-    waiting = NULL;
+  Promise *w = TakePending(reqId);
+  if (w != NULL) {
     w->Reply(reply.status());
   }
   }
@@ -9,7 +9,6 @@
 #include "distributed/store/common/frontend/txnclient.h"
 #include "distributed/store/common/timestamp.h"
 #include "distributed/store/common/transaction.h"
-#include "ledger/common/db.h"
 #include "ledger/ledgerdb/mpt/trie.h"
 #include "ledger/ledgerdb/ledgerdb.h"
 #include "ledger/qldb/qldb.h"
@@ -58,6 +57,12 @@ public:
         const std::vector<std::pair<std::string, size_t>> &versionedKeys,
         uint64_t timestamp,
         Promise *promise = NULL) override;
+    void PrepareCommit(uint64_t id,
+        const Transaction &txn,
+        const std::vector<std::pair<std::string, size_t>> &versionedKeys,
+        uint64_t timestamp,
+        const Timestamp &prepareTimestamp,
+        Promise *promise = NULL) override;
     void Abort(uint64_t id, 
                const Transaction &txn,
                Promise *promise = NULL) override;
@@ -66,30 +71,39 @@ private:
     Transport *transport; // Transport layer.
     uint64_t client_id; // Unique ID for this client.
     int shard; // which shard this client accesses
-    int replica; // which replica to use for reads
+    int replica; // which replica to use for reads, proofs and audits
 
     replication::vr::VRClient *client; // Client proxy.
-    Promise *waiting; // waiting thread
     Promise *blockingBegin; // block until finished 
-    std::map<size_t, Promise*> verifyPromise;
+    std::map<size_t, Promise*> pending; // outstanding requests by id
     uint64_t tip_block;
     long audit_block;
-    size_t uid;
-    ledgebase::DB db_;
+    size_t uid; // next request id
+
+    size_t AddPending(Promise *promise);
+    Promise *TakePending(size_t reqId);
 
-    void GetProofCallback(size_t uid,
+    void GetProofCallback(size_t reqId,
                           const std::vector<std::string>& keys,
                           const std::string& request_str,
                           const std::string& reply_str);
-    void AuditCallback(uint64_t seq, size_t uid,
+    void AuditCallback(uint64_t seq, size_t reqId,
                        const std::string& request_str,
                        const std::string& reply_str);
-    void GetTimeout();
-    void BatchGetCallback(const std::string &, const std::string &);
-    void GetRangeCallback(const std::string &, const std::string &);
-    void PrepareCallback(const std::string &, const std::string &);
-    void CommitCallback(const std::string &, const std::string &);
-    void AbortCallback(const std::string &, const std::string &);
+    void GetTimeout(size_t reqId);
+    void BatchGetCallback(size_t reqId, const std::string &,
+                          const std::string &);
+    void GetRangeCallback(size_t reqId, const std::string &,
+                          const std::string &);
+    void PrepareCallback(size_t reqId, const std::string &,
+                         const std::string &);
+    void CommitCallback(size_t reqId, const std::string &,
+                        const std::string &);
+    void PrepareCommitCallback(size_t reqId, const std::string &,
+                               const std::string &);
+    void ReplyCommitted(const proto::Reply &reply, Promise *w);
+    void AbortCallback(size_t reqId, const std::string &,
+                       const std::string &);
 
     /* Helper Functions for starting and finishing requests */
     void StartRequest();
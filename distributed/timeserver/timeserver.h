@@ -11,6 +11,7 @@
 
 #include "distributed/lib/configuration.h"
 #include "distributed/replication/common/replica.h"
+#include "distributed/lib/shmtransport.h"
 #include "distributed/lib/tcptransport.h"
 #include "distributed/replication/vr/replica.h"
 
@@ -30,7 +31,7 @@ public:
 
 private:
     long ts;
-    string newTimeStamp();
+    string newTimeStamp(const string &count);
 };
 
 #endif /* _TIME_SERVER_H_ */
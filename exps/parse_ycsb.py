@@ -7,7 +7,11 @@ def process(infile, outfile, eol):
       outfile.write(str(tps) + eol)
       break
 
-def print_result(fp, path, wper, servers, clients, t, lineno):
+def read_result(path, wper, s, c, t, m, lineno):
+  infile = open(path + "/" + wper + "_" + s + "_" + c + "_" + t + "_" + m, "r")
+  return infile.read().splitlines()[lineno]
+
+def print_result(fp, path, wper, servers, clients, t, m, lineno):
   fp.write("\"#Servers\"")
   for c in clients:
     fp.write("\t\"" + c + "\"")
@@ -16,9 +20,21 @@ def print_result(fp, path, wper, servers, clients, t, lineno):
   for s in servers:
     fp.write(s)
     for c in clients:
-      infile = open(path + "/" + wper + "_" + s + "_" + c + "_" + t, "r")
-      data = infile.read().splitlines()
-      fp.write("\t\"" + data[lineno] + "\"")
+      fp.write("\t\"" + read_result(path, wper, s, c, t, m, lineno) + "\"")
+    fp.write("\n")
+
+# One row per Zipf factor and one column per mode, to compare concurrency
+# control as skew grows
+def print_skew(fp, path, wper, s, c, thetas, modes, lineno):
+  fp.write("\"#Zipf\"")
+  for m in modes:
+    fp.write("\t\"" + m + "\"")
+  fp.write("\n")
+
+  for t in thetas:
+    fp.write(t)
+    for m in modes:
+      fp.write("\t\"" + read_result(path, wper, s, c, t, m, lineno) + "\"")
     fp.write("\n")
 
 path = sys.argv[1]
@@ -26,26 +42,28 @@ wpers = sys.argv[2].split(",")
 servers = sys.argv[3].split(",")
 clients = sys.argv[4].split(",")
 thetas = sys.argv[5].split(",")
+modes = sys.argv[6].split(",") if len(sys.argv) > 6 else ["occ"]
 
 for wper in wpers:
-  for t in thetas:
-    ftps = open(path + "/tps_" + wper + "_" + t, "w")
-    flat = open(path + "/lat_" + wper + "_" + t, "w")
-    abort = open(path + "/abort_" + wper + "_" + t, "w")
-    rlat = open(path + "/read", "w")
-    wlat = open(path + "/write", "w")
-    hlat = open(path + "/history", "w")
-    vlat = open(path + "/verify", "w")
-    vpk = open(path + "/verifyperkey", "w")
-
-    print_result(ftps, path, wper, servers, clients, t, 0)
-    print_result(flat, path, wper, servers, clients, t, 1)
-    print_result(abort, path, wper, servers, clients, t, 4)
-    print_result(rlat, path, wper, servers, clients, t, 5)
-    print_result(wlat, path, wper, servers, clients, t, 6)
-    print_result(hlat, path, wper, servers, clients, t, 7)
-    print_result(vlat, path, wper, servers, clients, t, 8)
-    print_result(vpk, path, wper, servers, clients, t, 9)
+  for t, m in [(t, m) for t in thetas for m in modes]:
+    suffix = wper + "_" + t + "_" + m
+    ftps = open(path + "/tps_" + suffix, "w")
+    flat = open(path + "/lat_" + suffix, "w")
+    abort = open(path + "/abort_" + suffix, "w")
+    rlat = open(path + "/read_" + m, "w")
+    wlat = open(path + "/write_" + m, "w")
+    hlat = open(path + "/history_" + m, "w")
+    vlat = open(path + "/verify_" + m, "w")
+    vpk = open(path + "/verifyperkey_" + m, "w")
+
+    print_result(ftps, path, wper, servers, clients, t, m, 0)
+    print_result(flat, path, wper, servers, clients, t, m, 1)
+    print_result(abort, path, wper, servers, clients, t, m, 4)
+    print_result(rlat, path, wper, servers, clients, t, m, 5)
+    print_result(wlat, path, wper, servers, clients, t, m, 6)
+    print_result(hlat, path, wper, servers, clients, t, m, 7)
+    print_result(vlat, path, wper, servers, clients, t, m, 8)
+    print_result(vpk, path, wper, servers, clients, t, m, 9)
 
     ftps.close()
     flat.close()
@@ -55,3 +73,14 @@ for wper in wpers:
     hlat.close()
     vlat.close()
     vpk.close()
+
+  # goodput is committed transactions per second
+  for s in servers:
+    for c in clients:
+      suffix = wper + "_" + s + "_" + c
+      fgood = open(path + "/goodput_" + suffix, "w")
+      fabort = open(path + "/aborts_" + suffix, "w")
+      print_skew(fgood, path, wper, s, c, thetas, modes, 0)
+      print_skew(fabort, path, wper, s, c, thetas, modes, 4)
+      fgood.close()
+      fabort.close()
@@ -10,7 +10,10 @@ nshards=(16)
 nclients=(10)
 
 # Zipf factor
-theta=(0)
+theta=(0 0.8 0.9 0.99)
+
+# Concurrency control, occ and/or lock
+modes=(occ lock)
 
 # Experiment duration
 rtime=120
@@ -30,6 +33,7 @@ wpers=$( IFS=$','; echo "${wperc[*]}" )
 servers=$( IFS=$','; echo "${nshards[*]}" )
 clients=$( IFS=$','; echo "${nclients[*]}" )
 thetas=$( IFS=$','; echo "${theta[*]}" )
+modelist=$( IFS=$','; echo "${modes[*]}" )
 
 for i in ${wperc[@]}
 do
@@ -41,25 +45,29 @@ do
     do
       for c in ${nclients[@]}
       do
-        echo =============================================
-        echo -e $i % writes, $j nodes, $k Zipf, $c clients
-        echo =============================================
+        for m in ${modes[@]}
+        do
+          echo =============================================
+          echo -e $i % writes, $j nodes, $k Zipf, $c clients, $m
+          echo =============================================
 
-        sed -i -e "s/tlen=[0-9]*/tlen=${tlen}/g" run_$driver.sh
-        sed -i -e "s/rtime=[0-9]*/rtime=${rtime}/g" run_$driver.sh
-        sed -i -e "s/wper=[0-9]*/wper=$i/g" run_$driver.sh
-        sed -i -e "s/rper=[0-9]*/rper=$rper/g" run_$driver.sh
-        sed -i -e "s/nshard=[0-9]*/nshard=$j/g" run_$driver.sh
-        sed -i -e "s/nclient=[0-9]*/nclient=$c/g" run_$driver.sh
-        sed -i -e "s/zalpha=[0-9\.]*/zalpha=$k/g" run_$driver.sh
-        sed -i -e "s/delay=[0-9\.]*/delay=${delay}/g" run_$driver.sh
+          sed -i -e "s/tlen=[0-9]*/tlen=${tlen}/g" run_$driver.sh
+          sed -i -e "s/rtime=[0-9]*/rtime=${rtime}/g" run_$driver.sh
+          sed -i -e "s/wper=[0-9]*/wper=$i/g" run_$driver.sh
+          sed -i -e "s/rper=[0-9]*/rper=$rper/g" run_$driver.sh
+          sed -i -e "s/nshard=[0-9]*/nshard=$j/g" run_$driver.sh
+          sed -i -e "s/nclient=[0-9]*/nclient=$c/g" run_$driver.sh
+          sed -i -e "s/zalpha=[0-9\.]*/zalpha=$k/g" run_$driver.sh
+          sed -i -e "s/delay=[0-9\.]*/delay=${delay}/g" run_$driver.sh
+          sed -i -e "s/mode=\"[a-z-]*\"/mode=\"$m\"/g" run_$driver.sh
         
-        ./clean.sh
-        ./run_$driver.sh
-        ./clean.sh
+          ./clean.sh
+          ./run_$driver.sh
+          ./clean.sh
+        done
       done
     done
   done
 done
 
-python parse_$driver.py result/ $wpers $servers $clients $thetas
+python parse_$driver.py result/ $wpers $servers $clients $thetas $modelist
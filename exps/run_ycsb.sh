@@ -82,11 +82,11 @@ do
   echo $host
   ssh $host "cat $logdir/client.*.log | sort -g -k 3 > $logdir/client.log; \
              rm -f $logdir/client.*.log; mkdir -p $expdir/result; \
-             source ~/.profile; python $expdir/process_ycsb.py $logdir/client.log $rtime $expdir/result/${wper}_${nshard}_${nclient}_${zalpha};
-             rsync $expdir/result/${wper}_${nshard}_${nclient}_${zalpha} ${master}:$expdir/result/client.$host.log;"
+             source ~/.profile; python $expdir/process_ycsb.py $logdir/client.log $rtime $expdir/result/${wper}_${nshard}_${nclient}_${zalpha}_${mode};
+             rsync $expdir/result/${wper}_${nshard}_${nclient}_${zalpha}_${mode} ${master}:$expdir/result/client.$host.log;"
 done
 
 echo "Processing logs"
-ssh ${master} "source ~/.profile; python $expdir/aggregate_ycsb.py $expdir/result $expdir/result/${wper}_${nshard}_${nclient}_${zalpha}; \
+ssh ${master} "source ~/.profile; python $expdir/aggregate_ycsb.py $expdir/result $expdir/result/${wper}_${nshard}_${nclient}_${zalpha}_${mode}; \
                rm -f $expdir/result/client.*.log;"
 
@@ -5,7 +5,10 @@
 
 #include "rocksdb/db.h"
 #include "rocksdb/filter_policy.h"
+#include "rocksdb/slice_transform.h"
 #include "rocksdb/table.h"
+#include "rocksdb/utilities/checkpoint.h"
+#include "rocksdb/write_batch.h"
 #include "tbb/concurrent_hash_map.h"
 
 #include "ledger/common/chunk.h"
@@ -19,16 +22,20 @@ static const uint64_t kMemtableMemoryBudget(1 << 30);
 
 class DB {
  public:
-  DB() { total_ = 0; };
-  ~DB() = default;
+  DB() : db_(nullptr) { total_ = 0; };
+  ~DB() { delete db_; }
 
-  inline bool Open(const std::string& db_path) {
+  // prefix_extractor enables prefix bloom filters for prefix iterators,
+  // plain iterators keep seeking in total order
+  inline bool Open(const std::string& db_path,
+      const rocksdb::SliceTransform* prefix_extractor = nullptr) {
     rocksdb::Options options_db;
     options_db.error_if_exists = false;
     options_db.create_if_missing = true;
     options_db.IncreaseParallelism(std::thread::hardware_concurrency());
     options_db.OptimizeLevelStyleCompaction(kMemtableMemoryBudget);
     options_db.write_buffer_size = kWriteBufferSize;
+    options_db.prefix_extractor.reset(prefix_extractor);
 
     rocksdb::BlockBasedTableOptions db_blk_tab_opts;
     db_blk_tab_opts.block_cache = rocksdb::NewClockCache(kCacheSizeBytes);
@@ -39,6 +46,22 @@ class DB {
     return rocksdb::DB::Open(options_db, db_path, &db_).ok();
   }
 
+  inline void Close() {
+    delete db_;
+    db_ = nullptr;
+    cache_.clear();
+    m_cache_.clear();
+  }
+
+  // consistent copy of the store in dir, which must not exist yet; files
+  // that do not change anymore are hard-linked rather than copied
+  inline bool CreateCheckpoint(const std::string& dir) {
+    rocksdb::Checkpoint* checkpoint;
+    if (!rocksdb::Checkpoint::Create(db_, &checkpoint).ok()) return false;
+    std::unique_ptr<rocksdb::Checkpoint> guard(checkpoint);
+    return checkpoint->CreateCheckpoint(dir).ok();
+  }
+
   inline void CreateCache(const std::string& id, Chunk&& chunk) {
     tbb::concurrent_hash_map<std::string, Chunk>::accessor a;
     m_cache_.insert(a, std::make_pair(id, std::move(chunk)));
@@ -48,6 +71,23 @@ class DB {
     return db_->Get(rocksdb::ReadOptions(), key, value).ok();
   }
 
+  // reads as of snapshot, see GetSnapshot()
+  inline bool Get(const std::string& key, std::string* value,
+      const rocksdb::Snapshot* snapshot) const {
+    rocksdb::ReadOptions options;
+    options.snapshot = snapshot;
+    return db_->Get(options, key, value).ok();
+  }
+
+  // pins the current state for snapshot reads until released
+  inline const rocksdb::Snapshot* GetSnapshot() {
+    return db_->GetSnapshot();
+  }
+
+  inline void ReleaseSnapshot(const rocksdb::Snapshot* snapshot) {
+    db_->ReleaseSnapshot(snapshot);
+  }
+
   inline Chunk* Get(const std::string& key) {
     tbb::concurrent_hash_map<std::string, Chunk>::accessor a;
     if (m_cache_.find(a, key)) return &(a->second);
@@ -69,7 +109,9 @@ class DB {
 
   inline bool Scan(const std::string& start, const std::string& end,
       std::map<std::string, std::string>& res) {
-    auto iter = db_->NewIterator(rocksdb::ReadOptions());
+    rocksdb::ReadOptions options;
+    options.total_order_seek = true;
+    std::unique_ptr<rocksdb::Iterator> iter(db_->NewIterator(options));
     for (iter->Seek(start); iter->Valid() && iter->key().ToString() < end;
         iter->Next()) {
       res.emplace(iter->key().ToString(), iter->value().ToString());
@@ -121,12 +163,36 @@ class DB {
     return db_->Put(rocksdb::WriteOptions(), key, val).ok();
   }
 
+  // stage a write into batch, applied by Put(batch)
+  inline void Put(rocksdb::WriteBatch* batch, const std::string& key,
+      const Chunk& value) {
+    m_cache_.erase(key);
+    batch->Put(rocksdb::Slice(key),
+        rocksdb::Slice(reinterpret_cast<const char*>(value.head()),
+        value.numBytes()));
+  }
+
+  inline void Put(rocksdb::WriteBatch* batch, const std::string& key,
+      const std::string& val) {
+    batch->Put(key, val);
+  }
+
   inline bool Put(rocksdb::WriteBatch* batch) {
     return db_->Write(rocksdb::WriteOptions(), batch).ok();
   }
 
   inline rocksdb::Iterator* NewIterater() {
-    return db_->NewIterator(rocksdb::ReadOptions());
+    rocksdb::ReadOptions options;
+    options.total_order_seek = true;
+    return db_->NewIterator(options);
+  }
+
+  // only valid while positioned on keys sharing the prefix of the seek
+  // target, the caller owns the iterator
+  inline rocksdb::Iterator* NewPrefixIterator() {
+    rocksdb::ReadOptions options;
+    options.prefix_same_as_start = true;
+    return db_->NewIterator(options);
   }
 
   inline long size() { return total_; }
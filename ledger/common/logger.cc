@@ -1,5 +1,9 @@
 #include "ledger/common/logger.h"
 
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+
 namespace ledgebase {
 
 Chunk TxnEntry::Encode(uint64_t time, const std::vector<std::string>& keys,
@@ -67,17 +71,114 @@ void TxnEntry::Parse() {
   txnid_ = *reinterpret_cast<const uint64_t*>(chunk_->data() + offset);
 }
 
-std::vector<TxnEntry> TxnEntry::ParseTxnEntries(const std::string& data) {
+std::vector<TxnEntry> TxnEntry::ParseTxnEntries(const Slice& slice) {
   std::vector<TxnEntry> result;
-  Slice slice(data);
   size_t offset = 0;
-  while (offset < data.size()) {
+  while (offset < slice.len()) {
     Chunk chunk(slice.data() + offset);
     TxnEntry entry(&chunk);
     offset += chunk.numBytes();
-    result.emplace_back(entry);
+    result.emplace_back(std::move(entry));
   }
   return result;
 }
 
+void Logger::recover() {
+  struct stat st;
+  if (idx_map_ != nullptr && fstat(idx_, &st) == 0) {
+    seq_ = st.st_size / kIdxEntrySize;
+  }
+  if (seq_ > 0) {
+    auto entry = idx_map_ + (seq_ - 1) * kIdxEntrySize;
+    end_ = *reinterpret_cast<const uint64_t*>(entry + sizeof(uint64_t)*3);
+  }
+  start_ = end_;
+
+  if (wal_map_ != nullptr && fstat(wal_, &st) == 0) {
+    const uint64_t size = st.st_size;
+    while (end_ + Chunk::kMetaLength <= size) {
+      auto len = *reinterpret_cast<const uint32_t*>(wal_map_ + end_);
+      if (len < Chunk::kMetaLength || end_ + len > size) break;
+      end_ += len;
+    }
+  }
+  appended_ = end_;
+  durable_ = end_;
+}
+
+namespace {
+
+// pwritev that resumes after short writes; iov is consumed as it goes
+bool writeFully(int fd, iovec* iov, int cnt, uint64_t offset) {
+  while (cnt > 0) {
+    auto n = pwritev(fd, iov, cnt, offset);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    offset += n;
+    auto written = n;
+    while (cnt > 0 && size_t(n) >= iov->iov_len) {
+      n -= iov->iov_len;
+      ++iov;
+      --cnt;
+    }
+    if (cnt == 0) break;
+    // nothing written though data is left, e.g. no space
+    if (written == 0) return false;
+    iov->iov_base = static_cast<char*>(iov->iov_base) + n;
+    iov->iov_len -= n;
+  }
+  return true;
+}
+
+}  // namespace
+
+bool Logger::log(const byte_t* data, size_t size) {
+  std::unique_lock<std::mutex> lk(wal_mu_);
+  if (failed_) return false;
+  pending_.push_back({const_cast<byte_t*>(data), size});
+  appended_ += size;
+  const uint64_t lsn = appended_;
+
+  while (durable_ < lsn) {
+    // whatever is not durable when a write fails never will be
+    if (failed_) return false;
+    if (flushing_) {
+      // a group is in flight, ours is flushed by the next leader
+      flushed_.wait(lk);
+      continue;
+    }
+
+    // lead the group of everything appended so far
+    flushing_ = true;
+    std::vector<iovec> group;
+    group.swap(pending_);
+    const uint64_t offset = durable_;
+    const uint64_t group_end = appended_;
+    lk.unlock();
+
+    bool ok = true;
+    auto pos = offset;
+    for (size_t i = 0; ok && i < group.size(); i += IOV_MAX) {
+      auto cnt = std::min(group.size() - i, size_t(IOV_MAX));
+      size_t bytes = 0;
+      for (size_t j = i; j < i + cnt; ++j) bytes += group[j].iov_len;
+      ok = writeFully(wal_, &group[i], cnt, pos);
+      pos += bytes;
+    }
+    if (ok && sync_) ok = fdatasync(wal_) == 0;
+
+    lk.lock();
+    if (ok) {
+      durable_ = group_end;
+    } else {
+      failed_ = true;
+    }
+    flushing_ = false;
+    flushed_.notify_all();
+  }
+  return true;
+}
+
 }
@@ -8,7 +8,10 @@
 #include <sys/stat.h>                                                              
 #include <fcntl.h>                                                                 
 #include <unistd.h>
+#include <condition_variable>
 #include <mutex>
+#include <sys/mman.h>
+#include <sys/uio.h>
 
 #include "ledger/common/slice.h"
 #include "ledger/common/chunk.h"
@@ -21,7 +24,8 @@ namespace ledgebase {
  */
 class TxnEntry {
  public:
-  static std::vector<TxnEntry> ParseTxnEntries(const std::string& entries);
+  // entries keep pointing into the given bytes
+  static std::vector<TxnEntry> ParseTxnEntries(const Slice& entries);
   static Chunk Encode(uint64_t time, const std::vector<std::string>& keys,
       const std::vector<std::string>& vals, const Hash& signature, 
       uint64_t txnid);
@@ -53,59 +57,101 @@ class TxnEntry {
   uint64_t txnid_;
 };
 
+/*
+ * Write-ahead log with group commit. Concurrent log() calls are gathered
+ * into groups; the first waiter of a group writes it with one pwritev and
+ * one fdatasync while the others wait for it, so a transaction returns
+ * only once it is durable but pays for a fraction of a sync. A failed
+ * write or sync fails its group and every later log() call.
+ *
+ * Groups only form when several threads log at once, as when the ledger
+ * is embedded in a multi-threaded process. A replica applies writes from
+ * its single ordered upcall thread, so there each transaction still
+ * pays for its own sync.
+ */
 class Logger {
  public:
-  Logger(const char* wal_path, const char* idx_path) {
+  // the files are mapped once with a size far beyond what they grow to,
+  // so views handed out by read() stay valid while the files are extended
+  static constexpr size_t kMapSize = size_t(1) << 36;
+  static constexpr size_t kIdxEntrySize = sizeof(uint64_t) * 4;
+
+  Logger(const char* wal_path, const char* idx_path, bool sync = true) {
     wal_ = open(wal_path, O_CREAT|O_RDWR, 0600);
     idx_ = open(idx_path, O_CREAT|O_RDWR, 0600);
     start_ = 0;
     end_ = 0;
     seq_ = 0;
+    sync_ = sync;
+    appended_ = 0;
+    durable_ = 0;
+    flushing_ = false;
+    failed_ = false;
+    wal_map_ = mapFile(wal_);
+    idx_map_ = mapFile(idx_);
+    recover();
   }
   ~Logger() {
+    if (wal_map_ != nullptr) munmap(const_cast<byte_t*>(wal_map_), kMapSize);
+    if (idx_map_ != nullptr) munmap(const_cast<byte_t*>(idx_map_), kMapSize);
     close(wal_);
     close(idx_);
   }
 
-  std::string read(uint64_t seq, uint64_t* block) {
-    auto idxEntrySize = sizeof(uint64_t) * 4;
-    auto idxOffset = seq * idxEntrySize;
-    byte_t buffer[idxEntrySize];
-    pread(idx_, buffer, idxEntrySize, idxOffset);
-    *block = *reinterpret_cast<const uint64_t*>(buffer + sizeof(uint64_t));
-    auto walOffset = *reinterpret_cast<const uint64_t*>(buffer + sizeof(uint64_t)*2);
-    auto end = *reinterpret_cast<const uint64_t*>(buffer + sizeof(uint64_t)*3);
-    auto walSize = end - walOffset;
-    byte_t buf[walSize];
-    pread(wal_, buf, walSize, walOffset);
-    return std::string(reinterpret_cast<const char*>(buf), walSize);
+  // zero-copy view of the wal records of the seq-th indexed block, valid
+  // for the lifetime of the logger; empty if seq is not indexed yet
+  Slice read(uint64_t seq, uint64_t* block) {
+    {
+      std::unique_lock<std::mutex> lock(mu_);
+      if (seq >= seq_ || wal_map_ == nullptr || idx_map_ == nullptr) {
+        return Slice();
+      }
+    }
+    auto entry = idx_map_ + seq * kIdxEntrySize;
+    *block = *reinterpret_cast<const uint64_t*>(entry + sizeof(uint64_t));
+    auto walOffset = *reinterpret_cast<const uint64_t*>(entry + sizeof(uint64_t)*2);
+    auto end = *reinterpret_cast<const uint64_t*>(entry + sizeof(uint64_t)*3);
+    return Slice(wal_map_ + walOffset, end - walOffset);
+  }
+
+  // wal records logged after the last indexed block, they belong to the
+  // block that is indexed next
+  Slice unindexed() {
+    std::unique_lock<std::mutex> lock(mu_);
+    if (wal_map_ == nullptr) return Slice();
+    return Slice(wal_map_ + start_, end_ - start_);
   }
 
-  void log(const byte_t* data, size_t size) {
-    write(wal_, data, size);
+  // number of indexed blocks
+  uint64_t blocks() {
+    std::unique_lock<std::mutex> lock(mu_);
+    return seq_;
   }
 
+  // blocks until data is durable and returns true, or returns false if
+  // the wal can no longer be written; data must stay valid until then
+  bool log(const byte_t* data, size_t size);
+
   void advance(uint64_t size) {
     std::unique_lock<std::mutex> writelock(mu_);
     end_ += size;
   }
 
   void index(uint64_t block) {
-    uint64_t start, end, seq;
-    {
-      std::unique_lock<std::mutex> writelock(mu_);
-      start = start_;
-      end = end_;
-      start_ = end_;
-      seq = seq_++;
-    }
-    auto size = sizeof(uint64_t) * 4;
-    std::unique_ptr<byte_t[]> entry(new byte_t[size]);
+    // written under the lock so read() never sees a counted but
+    // unwritten entry
+    std::unique_lock<std::mutex> writelock(mu_);
+    uint64_t start = start_;
+    uint64_t end = end_;
+    uint64_t seq = seq_;
+    start_ = end_;
+    byte_t entry[kIdxEntrySize];
     memcpy(&entry[0], &seq, sizeof(uint64_t));
     memcpy(&entry[sizeof(uint64_t)], &block, sizeof(uint64_t));
     memcpy(&entry[sizeof(uint64_t)*2], &start, sizeof(uint64_t));
     memcpy(&entry[sizeof(uint64_t)*3], &end, sizeof(uint64_t));
-    write(idx_, entry.get(), size);
+    pwrite(idx_, entry, kIdxEntrySize, seq * kIdxEntrySize);
+    ++seq_;
   }
 
  private:
@@ -116,6 +162,29 @@ class Logger {
   uint64_t start_;
   uint64_t end_;
   std::mutex mu_;
+
+  const byte_t* wal_map_;
+  const byte_t* idx_map_;
+
+  // group commit state, guarded by wal_mu_
+  bool sync_;
+  bool flushing_;
+  bool failed_;
+  uint64_t appended_;
+  uint64_t durable_;
+  std::vector<iovec> pending_;
+  std::mutex wal_mu_;
+  std::condition_variable flushed_;
+
+  // resumes after the last indexed block and the complete records behind
+  // it, a torn record at the end of the wal is overwritten
+  void recover();
+
+  static const byte_t* mapFile(int fd) {
+    auto addr = mmap(nullptr, kMapSize, PROT_READ, MAP_SHARED|MAP_NORESERVE,
+        fd, 0);
+    return addr == MAP_FAILED ? nullptr : static_cast<const byte_t*>(addr);
+  }
 };
 
 }
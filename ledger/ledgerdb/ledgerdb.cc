@@ -3,9 +3,13 @@
 #include <thread>
 #include <chrono>
 #include <atomic>
+#include <fstream>
 #include <iostream>
+#include <iterator>
 #include <sys/time.h>
 
+#include <boost/filesystem.hpp>
+
 #include "ledger/common/utils.h"
 #include "ledger/ledgerdb/types.h"
 
@@ -13,20 +17,29 @@ namespace ledgebase {
 
 namespace ledgerdb {
 
+namespace {
+
+// checkpoint files are read in pieces of at most this size, so that a
+// snapshot can be sent in several bounded messages
+const size_t kSnapshotPieceBytes = 16 << 20;
+
+}  // namespace
+
 LedgerDB::LedgerDB(int timeout,
                    std::string dbpath,
-                   std::string ledgerPath) {
+                   std::string ledgerPath)
+    : db_path_(dbpath), timeout_(timeout), tree_wanted_(false) {
   db_.Open(dbpath);
   mt_.reset(new MerkleTree(&db_));
   sl_.reset(new SkipList(&db_));
-  next_block_seq_ = 0;
-  commit_seq_ = 0;
+  Recover();
   stop_.store(false);
   buildThread_.reset(new std::thread(&LedgerDB::buildTree, this, timeout));
 }
 
 LedgerDB::~LedgerDB() {
   stop_.store(true);
+  tree_cv_.notify_all();
 
   if (buildThread_ != nullptr) {
     if (buildThread_->joinable()) buildThread_->join();
@@ -84,7 +97,7 @@ void LedgerDB::buildTree(int timeout) {
         db_.Get("commit" + prev_commit_seq, &commit_info);
         prev = CommitInfo(commit_info);
         mpt_root = Hash::FromBase32(prev.mptroot);
-        prev_digest = Hash::FromBase32(commit_info).ToBase32();
+        prev_digest = Hash::ComputeFrom(commit_info).ToBase32();
       }
       if (mpt_root.empty()) {
         auto mpt = Trie(&db_, mpt_ks, mpt_vs);
@@ -99,12 +112,19 @@ void LedgerDB::buildTree(int timeout) {
       std::string newdigest = DigestInfo(commit_seq_, last_block,
           Hash::ComputeFrom(commit_entry).ToBase32()).ToString();
       db_.Put("digest", newdigest);
+      {
+        std::lock_guard<std::mutex> lk(tree_mu_);
+      }
+      tree_cv_.notify_all();
       ++commit_seq_;
       gettimeofday(&t1, NULL);
       auto latency = (t1.tv_sec - t0.tv_sec)*1000000 + t1.tv_usec - t0.tv_usec;
       //std::cerr << "persist " << latency << " " << mpt_ks.size() << " " << mt_new_hashes.size() << std::endl;
     }
-    std::this_thread::sleep_for(std::chrono::milliseconds(timeout));
+    std::unique_lock<std::mutex> lk(tree_mu_);
+    tree_cv_.wait_for(lk, std::chrono::milliseconds(timeout),
+        [this] { return tree_wanted_ || stop_.load(); });
+    tree_wanted_ = false;
   }
 }
 
@@ -128,6 +148,7 @@ uint64_t LedgerDB::Set(const std::vector<std::string> &keys,
     mpt_ks.push_back(keys[i]);
     sl_->insert("skiplist_" + keys[i], timestamp,
         blk_seq_str + "@" + values[i]);
+    std::lock_guard<std::mutex> lk(head_mu_);
     skiplist_head_[keys[i]] = timestamp;
   }
 
@@ -136,6 +157,195 @@ uint64_t LedgerDB::Set(const std::vector<std::string> &keys,
   return blk_seq;
 }
 
+// Rebuilds what is only kept in memory from the store, so that an
+// existing one can be reopened. Blocks set after the last commit are
+// not recovered and get overwritten.
+void LedgerDB::Recover() {
+  next_block_seq_ = 0;
+  commit_seq_ = 0;
+  skiplist_head_.clear();
+
+  std::string digestinfo;
+  db_.Get("digest", &digestinfo);
+  if (digestinfo.size() == 0) return;
+  DigestInfo digest(digestinfo);
+  commit_seq_ = digest.commit_seq + 1;
+  next_block_seq_ = digest.tip_block + 1;
+
+  // the MPT maps every key to the timestamp of its latest version
+  auto latest = Trie(&db_, Hash::FromBase32(CurrentMPTRoot()))
+      .Diff(Trie::kNilChunk.hash());
+  for (auto& kv : latest) {
+    skiplist_head_[kv.first] = std::stoul(kv.second);
+  }
+}
+
+std::string LedgerDB::CurrentMPTRoot() {
+  std::string digest, commit;
+  db_.Get("digest", &digest);
+  if (digest.size() == 0) return "";
+  db_.Get("commit" + std::to_string(DigestInfo(digest).commit_seq), &commit);
+  return CommitInfo(commit).mptroot;
+}
+
+// returns once the commits cover every block set so far, waking the
+// tree builder rather than waiting out its timeout
+void LedgerDB::WaitForTree() {
+  std::unique_lock<std::mutex> lk(tree_mu_);
+  tree_cv_.wait(lk, [this] {
+    if (next_block_seq_ == 0) return true;
+    uint64_t tip;
+    std::string digest;
+    GetRootDigest(&tip, &digest);
+    if (digest.size() > 0 && tip + 1 >= next_block_seq_) return true;
+    tree_wanted_ = true;
+    tree_cv_.notify_all();
+    return false;
+  });
+}
+
+void LedgerDB::GetSnapshotBase(uint64_t *next_block, std::string *mpt_root) {
+  *next_block = next_block_seq_;
+  *mpt_root = CurrentMPTRoot();
+}
+
+// Blocks are numbered in the order Set is called, so replicas applying
+// the same operations agree on them and a lagging one misses exactly
+// the blocks from its next_block on. For the state, every version those
+// blocks wrote is sent, found through the keys whose MPT entry differs.
+bool LedgerDB::GetSnapshot(uint64_t next_block, const std::string &mpt_root,
+    Snapshot *snapshot,
+    const std::function<void (const std::string &, std::string &)> &piece) {
+  WaitForTree();
+
+  // a replica without most of the ledger gets a copy of the store
+  if (mpt_root.size() == 0 || next_block > next_block_seq_ ||
+      (next_block_seq_ - next_block) * 2 > next_block_seq_) {
+    auto dir = db_path_ + ".snapshot";
+    boost::filesystem::remove_all(dir);
+    if (!db_.CreateCheckpoint(dir)) return false;
+    snapshot->full = true;
+    for (boost::filesystem::directory_iterator it(dir), end; it != end; ++it) {
+      std::ifstream in(it->path().string(), std::ios::binary);
+      auto name = it->path().filename().string();
+      do {
+        std::string data(kSnapshotPieceBytes, '\0');
+        in.read(&data[0], data.size());
+        data.resize(in.gcount());
+        piece(name, data);
+      } while (in);
+    }
+    boost::filesystem::remove_all(dir);
+    return true;
+  }
+
+  snapshot->first_block = next_block;
+  for (auto seq = next_block; seq < next_block_seq_; ++seq) {
+    std::string block;
+    db_.Get("ledger-" + std::to_string(seq), &block);
+    snapshot->blocks.emplace_back(block);
+  }
+
+  // {blk_seq} -> (key, skiplist node) of the versions written since
+  std::multimap<uint64_t, std::pair<std::string, SkipNode>> versions;
+  auto changed = Trie(&db_, Hash::FromBase32(CurrentMPTRoot()))
+      .Diff(Hash::FromBase32(mpt_root));
+  for (auto& kv : changed) {
+    // skiplists are ordered by timestamp, not block, so walk all of it
+    sl_->scan("skiplist_" + kv.first, [&](const SkipNode& node) {
+      auto blk_seq = std::stoul(node.value.substr(0, node.value.find('@')));
+      if (blk_seq >= next_block) {
+        versions.emplace(blk_seq, std::make_pair(kv.first, node));
+      }
+      return true;
+    });
+  }
+  // in block order, so the receiver's latest version of a key is ours
+  for (auto& v : versions) {
+    snapshot->keys.emplace_back(v.second.first);
+    snapshot->timestamps.emplace_back(v.second.second.key);
+    snapshot->versions.emplace_back(v.second.second.value);
+  }
+  return true;
+}
+
+bool LedgerDB::AddSnapshotPiece(const std::string &name,
+                                const std::string &data) {
+  // names come from another replica, keep them inside the directory
+  if (name.empty() || name == "." || name == ".." ||
+      boost::filesystem::path(name).filename().string() != name) {
+    return false;
+  }
+  auto dir = SnapshotPiecePath();
+  boost::filesystem::create_directories(dir);
+  auto path = boost::filesystem::path(dir) / name;
+  std::ofstream out(path.string(), std::ios::binary | std::ios::app);
+  out.write(data.data(), data.size());
+  return out.good();
+}
+
+void LedgerDB::ClearSnapshotPieces() {
+  boost::filesystem::remove_all(SnapshotPiecePath());
+}
+
+// A partial snapshot carries every version set in its blocks, in block
+// order, so the skiplists end up with the same history as the sender's.
+bool LedgerDB::ApplySnapshot(const Snapshot &snapshot) {
+  if (snapshot.full) {
+    stop_.store(true);
+    tree_cv_.notify_all();
+    if (buildThread_ != nullptr && buildThread_->joinable()) {
+      buildThread_->join();
+    }
+    Tree_Block blk;
+    while (tree_queue_.try_pop(blk)) {}
+
+    db_.Close();
+    boost::filesystem::remove_all(db_path_);
+    boost::filesystem::create_directories(SnapshotPiecePath());
+    boost::system::error_code ec;
+    boost::filesystem::rename(SnapshotPiecePath(), db_path_, ec);
+    if (ec || !db_.Open(db_path_)) return false;
+    Recover();
+
+    stop_.store(false);
+    buildThread_.reset(new std::thread(&LedgerDB::buildTree, this, timeout_));
+    return true;
+  }
+
+  if (snapshot.first_block > next_block_seq_) return false;
+  uint64_t end = snapshot.first_block + snapshot.blocks.size();
+
+  // blocks first, the tree builder reads them from the store
+  std::map<uint64_t, Tree_Block> tree_blocks;
+  for (auto seq = next_block_seq_; seq < end; ++seq) {
+    db_.Put("ledger-" + std::to_string(seq),
+        snapshot.blocks[seq - snapshot.first_block]);
+    tree_blocks[seq].blk_seq = seq;
+  }
+
+  for (size_t i = 0; i < snapshot.keys.size(); ++i) {
+    auto& version = snapshot.versions[i];
+    auto blk_seq = std::stoul(version.substr(0, version.find('@')));
+    if (blk_seq < next_block_seq_) continue;
+    sl_->insert("skiplist_" + snapshot.keys[i], snapshot.timestamps[i],
+        version);
+    {
+      std::lock_guard<std::mutex> lk(head_mu_);
+      skiplist_head_[snapshot.keys[i]] = snapshot.timestamps[i];
+    }
+    auto& blk = tree_blocks[blk_seq];
+    blk.mpt_ks.emplace_back(snapshot.keys[i]);
+    blk.mpt_ts = std::to_string(snapshot.timestamps[i]);
+  }
+
+  for (auto& blk : tree_blocks) {
+    tree_queue_.push(blk.second);
+  }
+  next_block_seq_ = std::max(next_block_seq_, end);
+  return true;
+}
+
 int LedgerDB::binarySearch(std::vector<std::string> &vec, int l, int r, std::string key) {
 	if (r >= l) {
 		int mid = l + (r - l) / 2;
@@ -155,9 +365,14 @@ int LedgerDB::binarySearch(std::vector<std::string> &vec, int l, int r, std::str
 bool LedgerDB::GetValues(const std::vector<std::string> &keys,
                          std::vector<std::pair<uint64_t, std::pair<size_t, std::string>>> &values) {
   for (size_t i = 0; i < keys.size(); i++) {
-    std::string val;
+    long head = 0;
+    {
+      std::lock_guard<std::mutex> lk(head_mu_);
+      auto it = skiplist_head_.find(keys[i]);
+      if (it != skiplist_head_.end()) head = it->second;
+    }
 
-    auto node = sl_->find("skiplist_" + keys[i], skiplist_head_[keys[i]]);
+    auto node = sl_->find("skiplist_" + keys[i], head);
     if (node.size() == 0) {
       values.push_back(std::make_pair(0, std::make_pair(0, "")));
       continue;
@@ -165,7 +380,7 @@ bool LedgerDB::GetValues(const std::vector<std::string> &keys,
     SkipNode skipnode(node);
     auto res = Utils::splitBy(skipnode.value, '@');
 
-    values.push_back(std::make_pair(skiplist_head_[keys[i]],
+    values.push_back(std::make_pair(head,
         std::make_pair(std::stoul(res[0]), res[1])));
   }
 
@@ -174,9 +389,14 @@ bool LedgerDB::GetValues(const std::vector<std::string> &keys,
 
 bool LedgerDB::GetRange(const std::string &start, const std::string &end,
                         std::map<std::string, std::pair<uint64_t, std::pair<size_t, std::string>>> &values) {
-  auto from = skiplist_head_.lower_bound(start);
-  auto to = skiplist_head_.upper_bound(end);
-  for (auto it = from; it != to && it != skiplist_head_.end(); ++it) {
+  std::map<std::string, long> heads;
+  if (end < start) return true;
+  {
+    std::lock_guard<std::mutex> lk(head_mu_);
+    heads.insert(skiplist_head_.lower_bound(start),
+        skiplist_head_.upper_bound(end));
+  }
+  for (auto it = heads.begin(); it != heads.end(); ++it) {
     auto node = sl_->find("skiplist_" + it->first, it->second);
     SkipNode skipnode(node);
     auto res = Utils::splitBy(skipnode.value, '@');
@@ -290,7 +510,7 @@ Auditor LedgerDB::GetAudit(const uint64_t seq) {
   auditor.digest = dinfo.digest;
 
   std::string target_commit;
-  for (size_t i = seq; i <= dinfo.tip_block; ++i) {
+  for (size_t i = seq; i <= dinfo.commit_seq; ++i) {
     std::string c;
     db_.Get("commit"+std::to_string(i), &c);
     auditor.commits.emplace_back(c);
@@ -309,7 +529,12 @@ Auditor LedgerDB::GetAudit(const uint64_t seq) {
   } else {
     auditor.first_block_seq = 0;
   }
-  
+  for (auto& key : MerkleTree::frontierKeys(auditor.first_block_seq)) {
+    std::string node;
+    db_.Get(key, &node);
+    auditor.mt_frontier.emplace_back(node);
+  }
+
   auto mpt_hash = Hash::FromBase32(cinfo.mptroot);
   auto mpt = Trie(&db_, mpt_hash);
   for (size_t i = auditor.first_block_seq; i <= cinfo.tip_block; ++i) {
@@ -341,11 +566,10 @@ std::string LedgerDB::splitAndFind(const std::string &str, char delim, const::st
   return res_val;
 }
 
-bool Auditor::Audit(DB* db) {
+bool Auditor::Audit() {
   bool res = true;
-  MerkleTree mt(db);
   std::string target = digest;
-  std::string mtroot, mptroot, prev_commit_seq;
+  std::string mtroot, mptroot;
   uint64_t last_block;
 
   for (auto it = commits.rbegin(); it != commits.rend(); ++it) {
@@ -355,18 +579,17 @@ bool Auditor::Audit(DB* db) {
     mtroot = cinfo.mtroot;
     mptroot = cinfo.mptroot;
     last_block = cinfo.tip_block;
-    prev_commit_seq = cinfo.commit_seq > 0?
-        std::to_string(cinfo.commit_seq - 1) : "";
   }
+  if (first_block_seq + blocks.size() != last_block + 1) return false;
 
   std::vector<std::string> mt_new_hashes;
   for (size_t i = 0; i < blocks.size(); ++i) {
     mt_new_hashes.emplace_back(Hash::ComputeFrom(blocks[i]).ToBase32());
   }
 
-  std::string root_key, root_hash;
-  mt.update(first_block_seq, mt_new_hashes, prev_commit_seq,
-      &root_key, &root_hash);
+  // the frontier is not trusted, a wrong one cannot reproduce mtroot
+  auto root_hash = MerkleTree::computeRoot(first_block_seq, mt_frontier,
+      mt_new_hashes);
 
   if (root_hash.compare(mtroot) != 0) res = false;
 
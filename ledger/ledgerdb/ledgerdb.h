@@ -2,6 +2,8 @@
 #define LEDGERDB_LEDGERDB_H
 
 #include <algorithm>
+#include <condition_variable>
+#include <functional>
 #include <map>
 #include <memory>
 #include <mutex>
@@ -86,9 +88,28 @@ struct Auditor {
   uint64_t first_block_seq;
   std::vector<std::string> commits;
   std::vector<std::string> blocks;
+  // merkle tree nodes covering the blocks before first_block_seq
+  std::vector<std::string> mt_frontier;
   std::vector<MPTProof> mptproofs;
 
-  bool Audit(DB* db);
+  bool Audit();
+};
+
+// State handed to a replica that fell behind. A full snapshot is a
+// RocksDB checkpoint of the whole store, whose files go separately, see
+// GetSnapshot and AddSnapshotPiece. Otherwise it holds the blocks the
+// replica is missing, and every version those blocks set, in block
+// order.
+struct Snapshot {
+  bool full;
+  uint64_t first_block;
+  std::vector<std::string> blocks;
+  std::vector<std::string> keys;
+  std::vector<uint64_t> timestamps;
+  // skiplist values, {blk_seq}@{value}
+  std::vector<std::string> versions;
+
+  Snapshot() : full(false), first_block(0) {}
 };
 
 class LedgerDB {
@@ -132,18 +153,55 @@ class LedgerDB {
 
   inline size_t size() { return db_.size(); }
 
+  // what this replica holds, for the snapshot another replica sends it
+  void GetSnapshotBase(uint64_t *next_block, std::string *mpt_root);
+
+  // the files of a full snapshot are handed to piece as they are read,
+  // each in one or more consecutive pieces under its name
+  bool GetSnapshot(uint64_t next_block, const std::string &mpt_root,
+                   Snapshot *snapshot,
+                   const std::function<void (const std::string &name,
+                                             std::string &data)> &piece);
+
+  // writes the next piece of a full snapshot's file to a directory next
+  // to the store; ClearSnapshotPieces drops everything written so far
+  bool AddSnapshotPiece(const std::string &name, const std::string &data);
+  void ClearSnapshotPieces();
+
+  // a full snapshot replaces the store with the files written by
+  // AddSnapshotPiece
+  bool ApplySnapshot(const Snapshot &snapshot);
+
  private:
+  void Recover();
+
+  void WaitForTree();
+
+  std::string CurrentMPTRoot();
+
+  std::string SnapshotPiecePath() const { return db_path_ + ".restore"; }
+
   std::string splitAndFind(const std::string &str, char delim, const::std::string &target);
 
   DB db_;
+  std::string db_path_;
+  int timeout_;
   //DB ledger_;
   std::atomic<bool> stop_;
   uint64_t next_block_seq_;
   uint64_t commit_seq_;
   std::unique_ptr<std::thread> buildThread_;
   tbb::concurrent_queue<Tree_Block> tree_queue_;
+  // buildTree signals tree_cv_ after each commit and waits on it between
+  // rounds, which tree_wanted_ cuts short for WaitForTree
+  std::mutex tree_mu_;
+  std::condition_variable tree_cv_;
+  bool tree_wanted_;
   std::unique_ptr<MerkleTree> mt_;
   std::unique_ptr<SkipList> sl_;
+  // guards skiplist_head_, which reads share with Set; a key's head only
+  // moves once its skiplist node is written
+  mutable std::mutex head_mu_;
   std::map<std::string, long> skiplist_head_;
 };
 
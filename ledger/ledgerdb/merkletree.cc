@@ -5,6 +5,72 @@ namespace ledgebase {
 
 namespace ledgerdb {
 
+namespace {
+
+std::string parentHash(const std::string& left, const std::string& right) {
+  auto left_hash = Hash::FromBase32(left);
+  if (right.empty()) {
+    return Hash::ComputeFrom(left_hash.value(), Hash::kByteLength).ToBase32();
+  }
+  auto right_hash = Hash::FromBase32(right);
+  std::unique_ptr<ledgebase::byte_t[]> data(
+      new ledgebase::byte_t[ledgebase::Hash::kByteLength * 2]);
+  memcpy(data.get(), left_hash.value(), Hash::kByteLength);
+  memcpy(data.get() + Hash::kByteLength, right_hash.value(),
+      Hash::kByteLength);
+  return Hash::ComputeFrom(data.get(), Hash::kByteLength*2).ToBase32();
+}
+
+// hash of node idx at level in a tree of nleaves, peaks holds the frontier
+// subtree per level and the remaining leaves start at first
+std::string nodeHash(int level, uint64_t idx, uint64_t first,
+    uint64_t nleaves, const std::map<int, std::string>& peaks,
+    const std::vector<std::string>& leaves) {
+  if (((idx + 1) << level) <= first) {
+    auto it = peaks.find(level);
+    return it == peaks.end() ? "" : it->second;
+  }
+  if (level == 0) return leaves[idx - first];
+  auto left = nodeHash(level - 1, idx * 2, first, nleaves, peaks, leaves);
+  std::string right;
+  if (((idx * 2 + 1) << (level - 1)) < nleaves) {
+    right = nodeHash(level - 1, idx * 2 + 1, first, nleaves, peaks, leaves);
+  }
+  if (left.empty()) return "";
+  return parentHash(left, right);
+}
+
+}  // namespace
+
+std::vector<std::string> MerkleTree::frontierKeys(const uint64_t blk_seq) {
+  std::vector<std::string> keys;
+  for (int level = 63; level >= 0; --level) {
+    if ((blk_seq >> level) & 1) {
+      keys.emplace_back("mt" + std::to_string(level) + "-" +
+          std::to_string((blk_seq >> level) - 1));
+    }
+  }
+  return keys;
+}
+
+std::string MerkleTree::computeRoot(const uint64_t blk_seq,
+    const std::vector<std::string>& frontier,
+    const std::vector<std::string>& blk_hashes) {
+  if (blk_hashes.empty()) return "";
+  std::map<int, std::string> peaks;
+  size_t next = 0;
+  for (int level = 63; level >= 0; --level) {
+    if ((blk_seq >> level) & 1) {
+      if (next == frontier.size()) return "";
+      peaks[level] = frontier[next++];
+    }
+  }
+  uint64_t nleaves = blk_seq + blk_hashes.size();
+  int top = 0;
+  while ((uint64_t(1) << top) < nleaves) ++top;
+  return nodeHash(top, 0, blk_seq, nleaves, peaks, blk_hashes);
+}
+
 void MerkleTree::update(const uint64_t starting_block_seq,
                         const std::vector<std::string> &leaf_block_hashes,
                         const std::string& prev_commit_seq,
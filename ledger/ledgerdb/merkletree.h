@@ -44,6 +44,16 @@ class MerkleTree {
   Proof getProof(const std::string& commit_seq, const std::string& root_key,
       const uint64_t tip, const uint64_t target_block_seq) const;
 
+  // keys of the complete subtrees covering the first blk_seq leaves, left
+  // to right; they are never rewritten once stored
+  static std::vector<std::string> frontierKeys(const uint64_t blk_seq);
+
+  // root that update() produces when appending blk_hashes at blk_seq, given
+  // the hashes stored under frontierKeys(blk_seq); touches no store
+  static std::string computeRoot(const uint64_t blk_seq,
+      const std::vector<std::string>& frontier,
+      const std::vector<std::string>& blk_hashes);
+
  private:
   DB *ledger_;
 };
@@ -21,6 +21,16 @@ class MPTConfig {
     return nibbles;
   }
 
+  // inverse of KeybytesToHex, drops the terminator
+  static std::string HexToKeybytes(const std::string& nibbles) {
+    std::string key;
+    key.resize(nibbles.length() / 2);
+    for (size_t i = 0; i < key.length(); ++i) {
+      key[i] = nibbles[i*2] * 16 + nibbles[i*2+1];
+    }
+    return key;
+  }
+
   static size_t PrefixLen(const std::string& key1, const std::string& key2) {
     size_t i = 0;
     while (i < key1.size() && i < key2.size() && key1[i] == key2[i]) {
@@ -376,6 +376,108 @@ void MPTDelta::Commit(const Chunk* node) {
   }
 }
 
+std::map<std::string, std::string> Trie::Diff(const Hash& rhs) const {
+  Trie other(db_, rhs);
+  std::map<std::string, std::string> encoded, result;
+  std::string key;
+  Compare(root_node_->chunk(), other.root_node_->chunk(), key, encoded);
+  for (auto& kv : encoded) {
+    result.emplace(MPTConfig::HexToKeybytes(kv.first), std::move(kv.second));
+  }
+  return result;
+}
+
+// key is the nibble path to lhs and rhs. Subtrees with equal hashes are
+// skipped without loading them, so the cost follows the size of the
+// difference rather than of the tries.
+void Trie::Compare(const Chunk* lhs, const Chunk* rhs, std::string& key,
+    std::map<std::string, std::string>& result) const {
+  if (lhs->hash() == rhs->hash()) return;
+  if (lhs->type() == ChunkType::kMPTHash) {
+    auto child = GetHashNodeChild(lhs);
+    return Compare(&child, rhs, key, result);
+  }
+  if (rhs->type() == ChunkType::kMPTHash) {
+    auto child = GetHashNodeChild(rhs);
+    return Compare(lhs, &child, key, result);
+  }
+
+  auto prefix_len = key.length();
+  if (lhs->type() == ChunkType::kMPTFull &&
+      rhs->type() == ChunkType::kMPTFull) {
+    MPTFullNode lfull(lhs), rfull(rhs);
+    for (size_t i = 0; i < 17; ++i) {
+      auto lchild = lfull.getChildAtIndex(i);
+      auto rchild = rfull.getChildAtIndex(i);
+      key.push_back(i);
+      Compare(&lchild, &rchild, key, result);
+      key.resize(prefix_len);
+    }
+    return;
+  }
+  if (lhs->type() == ChunkType::kMPTShort &&
+      rhs->type() == ChunkType::kMPTShort) {
+    MPTShortNode lshort(lhs), rshort(rhs);
+    if (lshort.getKey() == rshort.getKey()) {
+      auto lchild = lshort.childNode();
+      auto rchild = rshort.childNode();
+      key += lshort.getKey();
+      Compare(&lchild, &rchild, key, result);
+      key.resize(prefix_len);
+      return;
+    }
+  }
+
+  // the shapes differ, look every key under lhs up in rhs
+  std::map<std::string, std::string> all;
+  std::string suffix;
+  GetAll(lhs, suffix, all);
+  for (auto& kv : all) {
+    if (TryGet(rhs, kv.first, 0) != kv.second) {
+      result[key + kv.first] = kv.second;
+    }
+  }
+}
+
+void Trie::GetAll(const Chunk* root, std::string& key,
+    std::map<std::string, std::string>& result) const {
+  auto prefix_len = key.length();
+  switch (root->type()) {
+    case ChunkType::kMPTFull:
+    {
+      MPTFullNode full_node(root);
+      for (size_t i = 0; i < 17; ++i) {
+        auto child = full_node.getChildAtIndex(i);
+        key.push_back(i);
+        GetAll(&child, key, result);
+        key.resize(prefix_len);
+      }
+      return;
+    }
+    case ChunkType::kMPTShort:
+    {
+      MPTShortNode short_node(root);
+      auto child = short_node.childNode();
+      key += short_node.getKey();
+      GetAll(&child, key, result);
+      key.resize(prefix_len);
+      return;
+    }
+    case ChunkType::kMPTHash:
+    {
+      auto child = GetHashNodeChild(root);
+      return GetAll(&child, key, result);
+    }
+    case ChunkType::kMPTValue:
+    {
+      result[key] = MPTValueNode(root).getVal();
+      return;
+    }
+    default:
+      return;
+  }
+}
+
 MPTProof Trie::GetProof(const std::string& key) const {
   MPTProof proof;
   std::string encoded_key = MPTConfig::KeybytesToHex(key);
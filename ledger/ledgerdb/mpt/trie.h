@@ -67,6 +67,8 @@ class Trie {
   Hash Set(const std::vector<std::string>& keys,
       const std::vector<std::string>& vals) const;
   
+  // keys whose value here differs from the one in the trie rooted at rhs,
+  // with their value here; subtrees missing from the db count as empty
   std::map<std::string, std::string> Diff(const Hash& rhs) const;
 
   Hash Remove(const std::string& key) const;
@@ -93,8 +95,7 @@ class Trie {
 
   Chunk GetHashNodeChild(const Chunk* hash_node) const;
 
-  void Compare(const Chunk* lhs, const Chunk* rhs,
-        size_t lkey_pos, size_t rkey_pos, std::string& key,
+  void Compare(const Chunk* lhs, const Chunk* rhs, std::string& key,
         std::map<std::string, std::string>& result) const;
 
   void GetAll(const Chunk* root, std::string& key,
@@ -170,6 +170,8 @@ void SkipList::insert(const std::string& prefix, long searchKey,
     return;
   }
 
+  // the node and its predecessors are written in one batch, so a
+  // concurrent find never follows a pointer to a missing node
   std::map<std::string, SkipNode> update;
   SkipNode head(headstr);
   std::string fullkey = prefix + "|head";
@@ -193,10 +195,13 @@ void SkipList::insert(const std::string& prefix, long searchKey,
     update[fullkey] = head;
   }
 
+  rocksdb::WriteBatch batch;
   for (auto& entry : update) {
-    db_->Put(entry.first, entry.second.ToString());
+    db_->Put(&batch, entry.first, entry.second.ToString());
   }
-  db_->Put(prefix + "|" + std::to_string(searchKey), newnode.ToString());
+  db_->Put(&batch, prefix + "|" + std::to_string(searchKey),
+      newnode.ToString());
+  db_->Put(&batch);
 }
 
 void SkipList::scan(const std::string& prefix, int n,
@@ -213,6 +218,19 @@ void SkipList::scan(const std::string& prefix, int n,
   }
 }
 
+void SkipList::scan(const std::string& prefix,
+    const std::function<bool(const SkipNode&)>& visit) {
+  std::string nextkey = "head";
+  while (true) {
+    std::string node;
+    db_->Get(prefix + "|" + nextkey, &node);
+    if (node.size() == 0) return;
+    SkipNode skipnode(node);
+    if (!visit(skipnode) || skipnode.forward[0] < 0) return;
+    nextkey = std::to_string(skipnode.forward[0]);
+  }
+}
+
 }  // namespace ledgerdb
 
 }  // namespace ledgebase
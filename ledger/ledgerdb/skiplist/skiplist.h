@@ -1,6 +1,7 @@
 #ifndef LEDGERDB_SKIPLIST_H
 #define LEDGERDB_SKIPLIST_H
 
+#include <functional>
 #include <vector>
 #include <string>
 #include "ledger/common/db.h"
@@ -32,6 +33,9 @@ class SkipList {
   void insert (const std::string& prefix, long searchKey,
       std::string newValue);
   void scan(const std::string& prefix, int n, std::vector<std::string>& res);
+  // visits the nodes from the head on until visit returns false
+  void scan(const std::string& prefix,
+      const std::function<bool(const SkipNode&)>& visit);
 
  private:
   DB* db_;
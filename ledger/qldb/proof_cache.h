@@ -0,0 +1,68 @@
+#ifndef QLDB_PROOF_CACHE_H_
+#define QLDB_PROOF_CACHE_H_
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace ledgebase {
+
+namespace qldb {
+
+// Bounded LRU cache of serialized proof nodes, keyed by their
+// proof_{name}|... storage key.
+class ProofCache {
+ public:
+  explicit ProofCache(size_t capacity) : capacity_(capacity), hits_(0) {}
+  ~ProofCache() = default;
+
+  inline bool Get(const std::string& key, std::string* node) {
+    std::lock_guard<std::mutex> lk(mu_);
+    auto it = index_.find(key);
+    if (it == index_.end()) return false;
+    entries_.splice(entries_.begin(), entries_, it->second);
+    *node = it->second->second;
+    ++hits_;
+    return true;
+  }
+
+  // inserts or overwrites, digest tree nodes are rewritten as it grows
+  inline void Put(const std::string& key, const std::string& node) {
+    std::lock_guard<std::mutex> lk(mu_);
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+      it->second->second = node;
+      entries_.splice(entries_.begin(), entries_, it->second);
+      return;
+    }
+    entries_.emplace_front(key, node);
+    index_[key] = entries_.begin();
+    if (entries_.size() > capacity_) {
+      index_.erase(entries_.back().first);
+      entries_.pop_back();
+    }
+  }
+
+  // number of successful Gets so far
+  inline size_t hits() {
+    std::lock_guard<std::mutex> lk(mu_);
+    return hits_;
+  }
+
+ private:
+  typedef std::list<std::pair<std::string, std::string>> EntryList;
+
+  size_t capacity_;
+  size_t hits_;
+  std::mutex mu_;
+  EntryList entries_;
+  std::unordered_map<std::string, EntryList::iterator> index_;
+};
+
+}  // namespace qldb
+
+}  // namespace ledgebase
+
+#endif  // QLDB_PROOF_CACHE_H_
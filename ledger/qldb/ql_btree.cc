@@ -100,6 +100,48 @@ void QLBTree::TryRange(const Chunk* node, const Slice& start,
   }
 }
 
+std::vector<std::pair<std::string, std::string>> QLBTree::RangeDesc(
+    const Slice& start, const Slice& end, size_t n) const {
+  std::vector<std::pair<std::string, std::string>> result;
+  if (n > 0) TryRangeDesc(root_node_->chunk(), start, end, n, result);
+  return result;
+}
+
+void QLBTree::TryRangeDesc(const Chunk* node, const Slice& start,
+    const Slice& end, size_t n,
+    std::vector<std::pair<std::string, std::string>>& result) const {
+  switch(node->type()) {
+    case ChunkType::kMap:
+    {
+      QLBTreeMap map_node(node);
+      for (size_t i = map_node.numEntries(); i > 0 && result.size() < n; --i) {
+        auto key = map_node.GetKey(i - 1);
+        if (key > end) continue;
+        if (key < start) break;
+        result.emplace_back(key.ToString(), map_node.GetVal(i - 1).ToString());
+      }
+      break;
+    }
+    case ChunkType::kMeta:
+    {
+      QLBTreeMeta meta(node);
+      auto from = meta.BinarySearch(start, 0, meta.numEntries());
+      auto to = meta.BinarySearch(end, 0, meta.numEntries());
+      for (size_t i = to + 1; i > from && result.size() < n; --i) {
+        auto child_id = (i - 1 == meta.numEntries())? "_INFI_" :
+            meta.GetKey(i - 1).ToString();
+        auto child_key = prefix_ + std::to_string(meta.GetLevel() - 1) + "|"
+            + child_id;
+        auto child = db_->Get(child_key);
+        TryRangeDesc(child, start, end, n, result);
+      }
+      break;
+    }
+    default:
+      std::cerr << "Wrong node type!" << std::endl;
+  }
+}
+
 void QLBTree::FindKey(const Chunk* node, const Slice& from,
     const Slice& to, std::map<std::string, std::string>& result) const {
   auto num_entry = *reinterpret_cast<const uint32_t*>(node->data() +
@@ -128,6 +170,15 @@ void QLBTree::FindKey(const Chunk* node, const Slice& from,
 
 bool QLBTree::Set(const std::vector<Slice>& keys,
     const std::vector<Slice>& vals) {
+  rocksdb::WriteBatch batch;
+  if (!Set(keys, vals, &batch)) return false;
+  db_->Put(&batch);
+  Refresh();
+  return true;
+}
+
+bool QLBTree::Set(const std::vector<Slice>& keys,
+    const std::vector<Slice>& vals, rocksdb::WriteBatch* batch) {
   if (keys.size() == 0) return false;
 
   Chunk new_root(root_node_->head());
@@ -147,16 +198,14 @@ bool QLBTree::Set(const std::vector<Slice>& keys,
     }
     new_root = delta_->GetChunk(root_id);
   }
-  delta_->Commit(root_id, true, prefix_);
+  delta_->Commit(root_id, true, prefix_, batch);
   delta_->Clear();
+  return true;
+}
+
+void QLBTree::Refresh() {
   auto root = db_->Get(prefix_ + "ROOT");
-  // if (new_root.type() == ChunkType::kMeta) {
-  //   root_node_.reset(new QLBTreeMeta(&new_root));
-  // } else {
-  //   root_node_.reset(new QLBTreeMap(&new_root));
-  // }
   root_node_ = QLBTreeNode::CreateFromChunk(root);
-  return true;
 }
   
 bool QLBTree::Set(const Slice& key, const Slice& val) {
@@ -171,8 +220,10 @@ bool QLBTree::Set(const Slice& key, const Slice& val) {
   } else {
     root_id = prefix_ + std::to_string(retval.level) + "|_INFI_";
   }
-  delta_->Commit(root_id, true, prefix_);
+  rocksdb::WriteBatch batch;
+  delta_->Commit(root_id, true, prefix_, &batch);
   delta_->Clear();
+  db_->Put(&batch);
   auto root = db_->Get(prefix_ + "ROOT");
   if (new_root.type() == ChunkType::kMeta) {
     root_node_.reset(new QLBTreeMeta(root));
@@ -273,15 +324,15 @@ QLBTreeInsertResult QLBTree::Insert(const Chunk* node, const Slice& key,
 }
 
 void QLBTreeDelta::Commit(const std::string& id, bool isroot,
-    const std::string& prefix) {
+    const std::string& prefix, rocksdb::WriteBatch* batch) {
   auto node = GetChunk(id);
   if (node.empty()) {
     return;
   }
   if (isroot) {
-    db_->Put(prefix + "ROOT", node);
+    db_->Put(batch, prefix + "ROOT", node);
   } else {
-    db_->Put(id, node);
+    db_->Put(batch, id, node);
   }
   if (node.type() == ChunkType::kMeta) {
     // commit child
@@ -289,12 +340,12 @@ void QLBTreeDelta::Commit(const std::string& id, bool isroot,
     for (size_t i = 0; i < meta.numEntries(); ++i) {
       auto childid = prefix + std::to_string(meta.GetLevel() - 1) +
           "|" + meta.GetKey(i).ToString();
-      Commit(childid, false, prefix);
+      Commit(childid, false, prefix, batch);
     }
     if (meta.GetChildElems(meta.numEntries()) > 0) {
       auto childid = prefix + std::to_string(meta.GetLevel() - 1) +
           "|_INFI_";
-      Commit(childid, false, prefix);
+      Commit(childid, false, prefix, batch);
     }
   }
 }
@@ -24,10 +24,23 @@ class QLBTree {
 
   std::map<std::string, std::string> Range(const Slice& start,
       const Slice& end) const;
+
+  // up to n entries in [start, end], largest key first; visits children
+  // right to left and stops descending once n entries are collected
+  std::vector<std::pair<std::string, std::string>> RangeDesc(
+      const Slice& start, const Slice& end, size_t n) const;
   
   bool Set(const Slice& key, const Slice& val);
   
   bool Set(const std::vector<Slice>& keys, const std::vector<Slice>& vals);
+
+  // stages the node updates into batch instead of writing them; the
+  // caller writes the batch and then calls Refresh()
+  bool Set(const std::vector<Slice>& keys, const std::vector<Slice>& vals,
+      rocksdb::WriteBatch* batch);
+
+  // reloads the root node after a staged Set has been written
+  void Refresh();
   
   inline uint64_t numElements() const { return root_node_->numElements(); }
 
@@ -37,6 +50,9 @@ class QLBTree {
   void TryRange(const Chunk* node, const Slice& start, const Slice& end,
       std::map<std::string, std::string>& result) const;
 
+  void TryRangeDesc(const Chunk* node, const Slice& start, const Slice& end,
+      size_t n, std::vector<std::pair<std::string, std::string>>& result) const;
+
   QLBTreeInsertResult Insert(const Chunk* node, const Slice& key,
       const Slice& value) const;
 
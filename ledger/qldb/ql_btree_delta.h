@@ -15,7 +15,9 @@ class QLBTreeDelta {
   QLBTreeDelta(DB* db) : db_(db) {}
   ~QLBTreeDelta() = default;
 
-  void Commit(const std::string& id, bool isroot, const std::string& prefix);
+  // stages the dirty nodes reachable from id into batch
+  void Commit(const std::string& id, bool isroot, const std::string& prefix,
+      rocksdb::WriteBatch* batch);
 
   inline void CreateChunk(const std::string& id, Chunk&& chunk) {
     std::map<std::string, Chunk>::iterator it = dirty_.find(id);
@@ -1,5 +1,6 @@
 #include "ledger/qldb/qldb.h"
 
+#include <algorithm>
 #include <sstream>
 #include <string>
 #include <chrono>
@@ -8,6 +9,37 @@ namespace ledgebase {
 
 namespace qldb {
 
+namespace {
+
+// the B+-trees only store where a document lives in the ledger:
+// | seq_no | doc_seq | ledger_name |
+// | -- 8 - | -- 4 -- | --- var --- |
+std::string documentRef(const std::string& name, uint64_t seqno,
+    uint32_t doc_seq) {
+  std::string ref(sizeof(uint64_t) + sizeof(uint32_t), '\0');
+  memcpy(&ref[0], &seqno, sizeof(uint64_t));
+  memcpy(&ref[sizeof(uint64_t)], &doc_seq, sizeof(uint32_t));
+  return ref + name;
+}
+
+// each document body is also stored on its own, so that reading one does
+// not fetch and parse the whole block it belongs to
+std::string documentKey(const std::string& ref) {
+  return "doc|" + ref;
+}
+
+// key|{version}, with the version as 8 big-endian bytes so that the
+// versions of a key sort numerically in the history tree
+std::string historyKey(const std::string& key, uint64_t version) {
+  std::string hkey = key + "|";
+  for (int shift = 56; shift >= 0; shift -= 8) {
+    hkey.push_back(static_cast<char>((version >> shift) & 0xff));
+  }
+  return hkey;
+}
+
+}  // namespace
+
 bool QLProofResult::Verify(const Hash digest) {
   auto doc = Document::Encode(data.key, data.val, addr, meta);
   auto doc_hash = doc.hash();
@@ -39,72 +71,183 @@ bool QLProofResult::Verify(const Hash digest) {
   return doc_hash == digest;
 }
 
-QLDB::QLDB(std::string dbpath) {
+QLDB::QLDB(std::string dbpath) : proof_cache_(kProofCacheSize) {
   db_.Open(dbpath);
   indexed_.reset(new QLBTree(&db_, "COMMITTED_"));
   history_.reset(new QLBTree(&db_, "HISTORY_"));
+  stop_.store(false);
+  commit_seq_.store(0);
+  indexed_seq_.store(0);
+  indexThread_.reset(new std::thread(&QLDB::buildIndex, this));
+}
+
+QLDB::~QLDB() {
+  {
+    std::lock_guard<std::mutex> lk(queue_mu_);
+    stop_.store(true);
+  }
+  queue_cv_.notify_all();
+
+  if (indexThread_ != nullptr) {
+    if (indexThread_->joinable()) indexThread_->join();
+  }
+}
+
+// drains the queue before exiting so every committed block gets indexed
+void QLDB::buildIndex() {
+  while (true) {
+    std::deque<IndexTask> tasks;
+    {
+      std::unique_lock<std::mutex> lk(queue_mu_);
+      queue_cv_.wait(lk, [this] {
+        return stop_.load() || !index_queue_.empty();
+      });
+      if (index_queue_.empty()) break;
+      tasks.swap(index_queue_);
+    }
+
+    // apply all pending blocks in one pass; later versions of a key
+    // overwrite earlier ones since the inserts keep commit order
+    std::vector<Slice> ks, vs, hist_keys;
+    for (auto& task : tasks) {
+      for (size_t i = 0; i < task.keys.size(); ++i) {
+        ks.emplace_back(task.keys[i]);
+        hist_keys.emplace_back(task.hist_keys[i]);
+        vs.emplace_back(task.refs[i]);
+      }
+    }
+    {
+      // both trees land in one write so they never disagree on disk
+      boost::unique_lock<boost::shared_mutex> lock(index_lock_);
+      rocksdb::WriteBatch batch;
+      indexed_->Set(ks, vs, &batch);
+      history_->Set(hist_keys, vs, &batch);
+      db_.Put(&batch);
+      indexed_->Refresh();
+      history_->Refresh();
+    }
+
+    {
+      std::lock_guard<std::mutex> lk(queue_mu_);
+      indexed_seq_.store(tasks.back().commit_seq + 1);
+    }
+    indexed_cv_.notify_all();
+  }
+}
+
+void QLDB::WaitIndexed(uint64_t seq) const {
+  std::unique_lock<std::mutex> lk(queue_mu_);
+  seq = std::min(seq, commit_seq_.load());
+  indexed_cv_.wait(lk, [this, seq] { return indexed_seq_.load() >= seq; });
+}
+
+Chunk QLDB::loadDocument(const std::string& ref) const {
+  if (ref.size() < sizeof(uint64_t) + sizeof(uint32_t)) return Chunk();
+  // read through rocksdb rather than the DB chunk cache, which would
+  // otherwise end up holding every document ever read
+  std::string docstr;
+  if (!db_.Get(documentKey(ref), &docstr) || docstr.empty()) {
+    return Chunk();
+  }
+  std::unique_ptr<byte_t[]> buf(new byte_t[docstr.size()]);
+  memcpy(buf.get(), docstr.data(), docstr.size());
+  return Chunk(std::move(buf));
 }
 
 void QLDB::CreateLedger(const std::string& name) {
   db_.Put(name, "0");
 }
 
-Slice QLDB::GetData(const std::string& name,
+std::string QLDB::GetData(const std::string& name,
     const std::string& key) const {
   auto result = GetCommitted(name, key);
+  if (result.empty()) return "";
   Document doc(&result);
-  return doc.getData().val;
+  return doc.getData().val.ToString();
 }
 
 Chunk QLDB::GetCommitted(const std::string& name,
-    const std::string& key) const {
+    const std::string& key, bool barrier) const {
   // auto result = db_.Get(key);
   // return Chunk(result->head());
-  auto combined_key = key;
-  auto result = indexed_->Get(Slice(combined_key));
-  return Chunk(result.data());
+  if (barrier) WaitIndexed(commit_seq_.load());
+  std::string ref;
+  {
+    boost::shared_lock<boost::shared_mutex> lock(index_lock_);
+    auto combined_key = key;
+    ref = indexed_->Get(Slice(combined_key)).ToString();
+  }
+  return loadDocument(ref);
 }
 
 std::map<std::string, std::string> QLDB::Range(const std::string& name,
     const std::string& from, const std::string& to) const {
   // auto result = db_.Get(name + "|" + key);
   // return Chunk(result->head());
-  auto result = indexed_->Range(Slice(from), Slice(to));
+  WaitIndexed(commit_seq_.load());
+  std::map<std::string, std::string> result;
+  {
+    boost::shared_lock<boost::shared_mutex> lock(index_lock_);
+    result = indexed_->Range(Slice(from), Slice(to));
+  }
+  for (auto& entry : result) {
+    auto doc = loadDocument(entry.second);
+    entry.second = doc.empty() ? "" : std::string(
+        reinterpret_cast<const char*>(doc.head()), doc.numBytes());
+  }
   return result;
 }
 
 Chunk QLDB::GetVersion(const std::string& name, const std::string& key, 
     const size_t version) const {
-  auto combined_key = key + "|" + std::to_string(version);
+  auto combined_key = historyKey(key, version);
   // auto result = db_.Get(combined_key);
   // return Chunk(result->head());
-  auto result = history_->Get(Slice(combined_key));
-  return Chunk(result.data());
+  std::string ref;
+  {
+    boost::shared_lock<boost::shared_mutex> lock(index_lock_);
+    ref = history_->Get(Slice(combined_key)).ToString();
+  }
+  return loadDocument(ref);
 }
 
 std::vector<Chunk> QLDB::GetHistory(const std::string& name,
     const std::string& key, size_t n) const {
+  // the history tree also holds the latest version, so the latest and
+  // n previous documents come from one descending scan
   std::vector<Chunk> retval;
-  auto result = GetCommitted(name, key);
-  Document doc(&result);
-  auto version = doc.getMetaData().version;
-  retval.emplace_back(std::move(result));
-  for (size_t i = version; (i > 0) && (version - i < n); --i) {
-    result = GetVersion(name, key, i-1);
-    retval.emplace_back(std::move(result));
+  auto from = historyKey(key, 0);
+  auto to = historyKey(key, UINT64_MAX);
+  WaitIndexed(commit_seq_.load());
+  std::vector<std::pair<std::string, std::string>> versions;
+  {
+    boost::shared_lock<boost::shared_mutex> lock(index_lock_);
+    versions = history_->RangeDesc(Slice(from), Slice(to), n + 1);
+  }
+  for (auto& version : versions) {
+    // skip keys that merely start with key| in case key contains '|'
+    if (version.first.size() != from.size()) continue;
+    retval.emplace_back(loadDocument(version.second));
   }
   return retval;
 }
 
 bool QLDB::Set(const std::string& name,
                const std::vector<std::string>& keys,
-               const std::vector<std::string>& vals) {
+               const std::vector<std::string>& vals,
+               uint64_t* block_seq,
+               uint64_t time) {
   if (keys.size() != vals.size()) {
     return false;
   } else if (keys.size() == 0) {
     return true;
   }
 
+  // blocks are appended one at a time so the indexer applies them in
+  // the same order as the ledger
+  std::lock_guard<std::mutex> commit_lk(commit_mu_);
+  pruneVersions();
+
   // get block sequence number and hash
   std::string tip;
   db_.Get(name, &tip);
@@ -123,22 +266,16 @@ bool QLDB::Set(const std::string& name,
   auto block_key = name + "|" + std::to_string(seqno);
 
   // current time
-  uint64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
-      std::chrono::system_clock::now().time_since_epoch()).count();
+  uint64_t now = time > 0 ? time :
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::system_clock::now().time_since_epoch()).count();
 
   // create documents
   std::vector<Chunk> documents;
   std::vector<Hash> proof;
-  std::vector<Slice> ks, vs, hist_keys;
-  std::vector<std::string> hist_key_holder;
+  std::vector<std::string> hist_key_holder, refs;
   for (size_t i = 0; i < keys.size(); ++i) {
-    // get latest
-    auto latest_chunk = GetCommitted(name, keys[i]);
-    size_t version = 0;
-    if (!latest_chunk.empty()) {
-      Document latest_doc(&latest_chunk);
-      version = latest_doc.getMetaData().version + 1;
-    }
+    auto version = nextVersion(name, keys[i]);
     
     auto document = Document::Encode(Slice(keys[i]) ,Slice(vals[i]), 
         {Slice(name), seqno}, {i, version, now});
@@ -152,17 +289,15 @@ bool QLDB::Set(const std::string& name,
     // db_.Put(history_key, document);
 
     documents.emplace_back(std::move(document));
-
-    // use b+ tree
-    ks.emplace_back(keys[i]);
-    vs.emplace_back(documents[i].head(), documents[i].numBytes());
-    hist_key_holder.emplace_back(keys[i] + "|" + std::to_string(version));
+    hist_key_holder.emplace_back(historyKey(keys[i], version));
+    refs.emplace_back(documentRef(name, seqno, i));
   }
-  for (size_t i = 0; i < hist_key_holder.size(); ++i) {
-    hist_keys.emplace_back(hist_key_holder[i]);
+
+  // all writes of the block are applied atomically
+  rocksdb::WriteBatch batch;
+  for (size_t i = 0; i < documents.size(); ++i) {
+    db_.Put(&batch, documentKey(refs[i]), documents[i]);
   }
-  indexed_->Set(ks, vs);
-  history_->Set(hist_keys, vs);
 
   // block hash
   proof.emplace_back(prev_hash.Clone());
@@ -181,28 +316,78 @@ bool QLDB::Set(const std::string& name,
   auto addr_hash = Hash::ComputeFrom(addr.get(), name.size() + 16);
   proof.emplace_back(addr_hash.Clone());
 
-  auto block_hash = calculateBlockHash(proof, name, seqno);
-  calculateDigest(block_hash, prev_hash, name, seqno);
+  auto block_hash = calculateBlockHash(proof, name, seqno, &batch);
+  calculateDigest(block_hash, prev_hash, name, seqno, &batch);
 
   // create block
   auto block = QLBlock::Encode({Slice(name), seqno}, {0, now},
       now, block_hash, prev_hash, documents);
 
   // write to ledger storage
-  db_.Put(block_key, block);
+  db_.Put(&batch, block_key, block);
   std::string new_tip = std::to_string(seqno) + "|" + block_hash.ToBase32();
-  db_.Put(name, new_tip);
+  db_.Put(&batch, name, new_tip);
+  db_.Put(&batch);
+
+  // the block is durable, hand the document refs over to the b+ tree
+  // indexer
+  {
+    std::lock_guard<std::mutex> lk(queue_mu_);
+    index_queue_.push_back({commit_seq_.load(), keys, hist_key_holder,
+        refs});
+    commit_seq_++;
+  }
+  queue_cv_.notify_one();
 
+  if (block_seq != nullptr) *block_seq = seqno;
   return true;
 }
 
+size_t QLDB::nextVersion(const std::string& name, const std::string& key) {
+  // writes the indexer has not applied yet are tracked here; the rest
+  // are read from the committed index
+  auto id = std::make_pair(name, key);
+  auto it = versions_.find(id);
+  size_t version = 0;
+  if (it != versions_.end()) {
+    version = it->second.first;
+  } else {
+    auto latest_chunk = GetCommitted(name, key, false);
+    if (!latest_chunk.empty()) {
+      Document latest_doc(&latest_chunk);
+      // the index is shared by all ledgers
+      if (latest_doc.getAddr().ledger_name == Slice(name)) {
+        version = latest_doc.getMetaData().version + 1;
+      }
+    }
+  }
+  // Set holds commit_mu_, so this write becomes commit commit_seq_
+  auto seq = commit_seq_.load();
+  versions_[id] = std::make_pair(version + 1, seq);
+  version_log_.emplace_back(seq, std::move(id));
+  return version;
+}
+
+void QLDB::pruneVersions() {
+  auto indexed = indexed_seq_.load();
+  while (!version_log_.empty() && version_log_.front().first < indexed) {
+    auto it = versions_.find(version_log_.front().second);
+    // a later write of the key keeps the entry alive
+    if (it != versions_.end() && it->second.second < indexed) {
+      versions_.erase(it);
+    }
+    version_log_.pop_front();
+  }
+}
+
 bool QLDB::Delete(const std::string& name,
                   const std::vector<std::string>& keys) const {
   return true;
 }
 
 Hash QLDB::calculateBlockHash(const std::vector<Hash>& proof,
-    const std::string& name, const uint64_t seqno) {
+    const std::string& name, const uint64_t seqno,
+    rocksdb::WriteBatch* batch) {
   size_t level = 0;
   size_t last = proof.size() - 1;
   std::vector<Hash> current;
@@ -227,7 +412,9 @@ Hash QLDB::calculateBlockHash(const std::vector<Hash>& proof,
       }
       std::string key = "proof_" + name + "|" + std::to_string(seqno) + "|" +
           std::to_string(level) + "|" + std::to_string(i);
-      db_.Put(key, Slice(node.get(), node_size).ToString());
+      auto nodestr = Slice(node.get(), node_size).ToString();
+      db_.Put(batch, key, nodestr);
+      if (level >= kProofCacheLevel) proof_cache_.Put(key, nodestr);
       Hash pr_hash = Hash::ComputeFrom(node.get(), node_size);
       current.emplace_back(pr_hash.Clone());
     }
@@ -238,7 +425,8 @@ Hash QLDB::calculateBlockHash(const std::vector<Hash>& proof,
 }
 
 void QLDB::calculateDigest(const Hash& block_hash, const Hash& prev_block_hash,
-    const std::string& name, const uint64_t seqno) {
+    const std::string& name, const uint64_t seqno,
+    rocksdb::WriteBatch* batch) {
   auto last_seqno = seqno;
   auto curr_hash = block_hash.Clone();
 
@@ -250,16 +438,18 @@ void QLDB::calculateDigest(const Hash& block_hash, const Hash& prev_block_hash,
 
     std::string key = "proof_" + name + "|" + std::to_string(level) + "|" +
         std::to_string(pr_last);
+    std::string nodestr;
     if (pr_last_idx == 0) {
       byte_t node[Hash::kByteLength];
       memcpy(node, curr_hash.value(), Hash::kByteLength);
-      db_.Put(key, Slice(node, Hash::kByteLength).ToString());
+      nodestr = Slice(node, Hash::kByteLength).ToString();
       curr_hash = Hash::ComputeFrom(node, Hash::kByteLength);
     } else {
       Hash prev_hash;
       if (level == 1) {
         prev_hash = prev_block_hash;
-      } else {
+      } else if (!lookupFrontier(name, level - 1, last_seqno - 1,
+          &prev_hash)) {
         std::string prev_key = "proof_" + name + "|" + std::to_string(level-1) +
             "|" + std::to_string(last_seqno - 1);
         std::string prev_node_str;
@@ -270,22 +460,62 @@ void QLDB::calculateDigest(const Hash& block_hash, const Hash& prev_block_hash,
       byte_t node[Hash::kByteLength * 2];
       memcpy(node, prev_hash.value(), Hash::kByteLength);
       memcpy(node + Hash::kByteLength, curr_hash.value(), Hash::kByteLength);
-      db_.Put(key, Slice(node, Hash::kByteLength * 2).ToString());
+      nodestr = Slice(node, Hash::kByteLength * 2).ToString();
       curr_hash = Hash::ComputeFrom(node, Hash::kByteLength * 2);
     }
+    db_.Put(batch, key, nodestr);
+    // digest tree nodes are rewritten as the ledger grows; reads only
+    // take them from the cache once no later block can change them
+    if (level >= kProofCacheLevel) proof_cache_.Put(key, nodestr);
+    updateFrontier(name, level, pr_last, curr_hash);
     last_seqno = pr_last;
   }
 
   std::string key = "digest_" + name;
   std::string digest = curr_hash.ToBase32();
-  db_.Put(key, digest);
+  db_.Put(batch, key, digest);
+}
+
+void QLDB::updateFrontier(const std::string& name, size_t level,
+    uint64_t idx, const Hash& hash) {
+  auto& levels = frontier_[name];
+  if (levels.size() <= level) levels.resize(level + 1);
+  // indexes only grow within a level; keep the node just left of the
+  // right edge, which is what the next odd block needs
+  levels[level][idx] = hash.Clone();
+  if (levels[level].size() > 2) levels[level].erase(levels[level].begin());
 }
 
-DigestInfo QLDB::digest(const std::string& name) {
+bool QLDB::lookupFrontier(const std::string& name, size_t level,
+    uint64_t idx, Hash* hash) const {
+  auto it = frontier_.find(name);
+  if (it == frontier_.end() || it->second.size() <= level) return false;
+  auto node = it->second[level].find(idx);
+  if (node == it->second[level].end()) return false;
+  *hash = node->second;
+  return true;
+}
+
+std::string QLDB::getProofNode(const std::string& key, size_t level,
+    bool immutable, const rocksdb::Snapshot* snapshot) {
+  std::string nodestr;
+  if (immutable && level >= kProofCacheLevel &&
+      proof_cache_.Get(key, &nodestr)) {
+    return nodestr;
+  }
+  db_.Get(key, &nodestr, snapshot);
+  if (immutable && level >= kProofCacheLevel && !nodestr.empty()) {
+    proof_cache_.Put(key, nodestr);
+  }
+  return nodestr;
+}
+
+DigestInfo QLDB::digest(const std::string& name,
+    const rocksdb::Snapshot* snapshot) {
   std::string key = "digest_" + name;
   std::string digest, tip;
-  db_.Get(key, &digest);
-  db_.Get(name, &tip);
+  db_.Get(key, &digest, snapshot);
+  db_.Get(name, &tip, snapshot);
   if (tip.compare("") == 0) {
     return {0, digest};
   } else {
@@ -296,7 +526,8 @@ DigestInfo QLDB::digest(const std::string& name) {
 }
 
 QLProofResult QLDB::getProof(const std::string& name, const uint64_t tip,
-    const uint64_t block_addr, const uint32_t doc_seq) {
+    const uint64_t block_addr, const uint32_t doc_seq,
+    const rocksdb::Snapshot* snapshot) {
   if (block_addr > tip) return {};
   std::string block_key = name + "|" + std::to_string(block_addr);
   auto block = db_.Get(block_key);
@@ -322,8 +553,7 @@ QLProofResult QLDB::getProof(const std::string& name, const uint64_t tip,
     } else {
       std::string key = "proof_" + name + "|" + std::to_string(block_addr) +
           "|" + std::to_string(level) + "|" + std::to_string(pr_seq);
-      std::string nodestr;
-      db_.Get(key, &nodestr);
+      auto nodestr = getProofNode(key, level, true, snapshot);
       Slice node(nodestr);
       Hash hash(node.data() + Hash::kByteLength * pr_seq_idx);
       // std::cerr << level << ", " << pr_seq << ": " << Hash(node.data()) << ", " << Hash(node.data() + Hash::kByteLength) << std::endl;
@@ -347,8 +577,9 @@ QLProofResult QLDB::getProof(const std::string& name, const uint64_t tip,
     if (curr_seq == latest && latest % 2 == 0) {
       result.proof.emplace_back(Hash().ToBase32());
     } else {
-      std::string nodestr;
-      db_.Get(key, &nodestr);
+      // the right edge is rewritten by later blocks
+      bool complete = ((pr_seq + 1) << level) - 1 <= tip;
+      auto nodestr = getProofNode(key, level, complete, snapshot);
       Slice node(nodestr);
       // std::cerr << "block_" << level << ", " << pr_seq << ": " << Hash(node.data()) << ", " << Hash(node.data() + Hash::kByteLength) << std::endl;
       Hash hash(node.data() + pr_seq_idx * Hash::kByteLength);
@@ -1,10 +1,22 @@
 #ifndef QLDB_H_
 #define QLDB_H_
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+#include "boost/thread.hpp"
+
 #include "ledger/common/chunk.h"
 #include "ledger/common/db.h"
 #include "ledger/common/hash.h"
 #include "ledger/common/slice.h"
+#include "ledger/qldb/proof_cache.h"
 #include "ledger/qldb/qlnode.h"
 #include "ledger/qldb/ql_btree.h"
 
@@ -12,6 +24,10 @@ namespace ledgebase {
 
 namespace qldb {
 
+// proof nodes at or above this level are served from memory when possible
+static const size_t kProofCacheLevel = 2;
+static const size_t kProofCacheSize = 1 << 16;
+
 class QLProofResult {
  public:
   Data data;
@@ -28,18 +44,41 @@ struct DigestInfo {
   std::string digest;
 };
 
+// documents of one committed block, waiting to be applied to the indexes
+struct IndexTask {
+  uint64_t commit_seq;
+  std::vector<std::string> keys;
+  std::vector<std::string> hist_keys;
+  // where each document lives in the block, see documentRef()
+  std::vector<std::string> refs;
+};
+
 class QLDB {
  public:
   QLDB(std::string dbpath);
-  ~QLDB() = default;
+  ~QLDB();
+
+  // applies committed blocks to the B+-trees in commit order
+  void buildIndex();
 
   void CreateLedger(const std::string& name);
 
-  Slice GetData(const std::string& name,
+  std::string GetData(const std::string& name,
       const std::string& key) const;
   
+  // with barrier set, waits until all blocks committed before the call
+  // are indexed; otherwise reads whatever the indexer has applied so far
   Chunk GetCommitted(const std::string& name,
-      const std::string& key) const;
+      const std::string& key, bool barrier = true) const;
+
+  // number of commits already applied to the indexes
+  inline uint64_t indexed() const { return indexed_seq_.load(); }
+
+  // number of commits appended to the ledger
+  inline uint64_t committed() const { return commit_seq_.load(); }
+
+  // blocks until the first seq commits are indexed
+  void WaitIndexed(uint64_t seq) const;
 
   std::map<std::string, std::string> Range(const std::string& name,
       const std::string& from, const std::string& to) const;
@@ -47,33 +86,101 @@ class QLDB {
   std::vector<Chunk> GetHistory(const std::string& name,
       const std::string& key, size_t n) const;
   
+  // block_seq, if given, receives the block the documents went into;
+  // key i is document i of that block. time stamps the block and its
+  // documents, the current time in ms if 0
   bool Set(const std::string& name,
            const std::vector<std::string>& keys,
-           const std::vector<std::string>& vals);
+           const std::vector<std::string>& vals,
+           uint64_t* block_seq = nullptr,
+           uint64_t time = 0);
   
   bool Delete(const std::string& name,
               const std::vector<std::string>& keys) const;
   
-  DigestInfo digest(const std::string& name);
+  // a consistent view of the ledgers while blocks are appended; digest
+  // and getProof read from it when given, and it must be released
+  inline const rocksdb::Snapshot* GetSnapshot() { return db_.GetSnapshot(); }
+  inline void ReleaseSnapshot(const rocksdb::Snapshot* snapshot) {
+    db_.ReleaseSnapshot(snapshot);
+  }
+
+  DigestInfo digest(const std::string& name,
+      const rocksdb::Snapshot* snapshot = nullptr);
 
   QLProofResult getProof(const std::string& name, const uint64_t tip,
-      const uint64_t block_addr, const uint32_t seq);
+      const uint64_t block_addr, const uint32_t seq,
+      const rocksdb::Snapshot* snapshot = nullptr);
 
   size_t size() { return db_.size(); }
 
+  // proof nodes served from memory so far
+  inline size_t proofCacheHits() { return proof_cache_.hits(); }
+
  protected:
   Chunk GetVersion(const std::string& name, const std::string& key,
       const size_t version) const;
 
   Hash calculateBlockHash(const std::vector<Hash>& proof,
-      const std::string& name, const uint64_t seqno);
+      const std::string& name, const uint64_t seqno,
+      rocksdb::WriteBatch* batch);
 
   void calculateDigest(const Hash& block_hash, const Hash& prev_hash,
-      const std::string& name, const uint64_t seqno);
+      const std::string& name, const uint64_t seqno,
+      rocksdb::WriteBatch* batch);
+
+  size_t nextVersion(const std::string& name, const std::string& key);
+
+  // forgets versions the indexer has caught up with
+  void pruneVersions();
+
+  // index leaves hold block references; documents are read from their
+  // own copy next to the block, see documentKey()
+  Chunk loadDocument(const std::string& ref) const;
+
+  void updateFrontier(const std::string& name, size_t level, uint64_t idx,
+      const Hash& hash);
+
+  bool lookupFrontier(const std::string& name, size_t level, uint64_t idx,
+      Hash* hash) const;
+
+  // immutable nodes (those inside a block, and digest tree nodes whose
+  // blocks are all at or below the tip) may be cached on read; the rest
+  // are read as of snapshot
+  std::string getProofNode(const std::string& key, size_t level,
+      bool immutable, const rocksdb::Snapshot* snapshot);
 
   DB db_;
   std::unique_ptr<QLBTree> indexed_;
   std::unique_ptr<QLBTree> history_;
+
+  // serializes block appends so the indexer sees commits in order
+  std::mutex commit_mu_;
+  // next document version of each (ledger, key) whose latest write may
+  // not be indexed yet, and the commit that wrote it; guarded by
+  // commit_mu_
+  std::map<std::pair<std::string, std::string>,
+      std::pair<size_t, uint64_t>> versions_;
+  // keys of versions_ in commit order, so pruning stops at the first
+  // write the indexer has not applied
+  std::deque<std::pair<uint64_t,
+      std::pair<std::string, std::string>>> version_log_;
+  // per ledger and level of the digest tree, hashes of the most recently
+  // written nodes; guarded by commit_mu_
+  std::unordered_map<std::string,
+      std::vector<std::map<uint64_t, Hash>>> frontier_;
+  ProofCache proof_cache_;
+
+  std::atomic<bool> stop_;
+  std::atomic<uint64_t> commit_seq_;
+  std::atomic<uint64_t> indexed_seq_;
+  std::unique_ptr<std::thread> indexThread_;
+  std::deque<IndexTask> index_queue_;
+  mutable std::mutex queue_mu_;
+  mutable std::condition_variable queue_cv_;
+  mutable std::condition_variable indexed_cv_;
+  // indexer holds it exclusively while modifying the B+-trees
+  mutable boost::shared_mutex index_lock_;
 };
 
 } // namespace qldb
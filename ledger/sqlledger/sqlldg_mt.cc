@@ -8,6 +8,19 @@ namespace sqlledger {
 void MerkleTree::Build(const std::string& mtid,
     const std::vector<std::string> &leaves, std::string* toplevel,
     std::string* root_hash) {
+  std::vector<std::pair<std::string, std::string>> nodes;
+  Build(mtid, leaves, toplevel, root_hash, &nodes);
+  rocksdb::WriteBatch batch;
+  for (auto& node : nodes) {
+    ledger_->Put(&batch, node.first, node.second);
+  }
+  ledger_->Put(&batch);
+}
+
+void MerkleTree::Build(const std::string& mtid,
+    const std::vector<std::string> &leaves, std::string* toplevel,
+    std::string* root_hash,
+    std::vector<std::pair<std::string, std::string>>* nodes) {
   if (leaves.size() == 0) return;
   // commit leaf hashes
   int level = 0;
@@ -15,28 +28,30 @@ void MerkleTree::Build(const std::string& mtid,
   for (size_t i = 0; i < leaves.size(); ++i) {
     auto leaf_hash = Hash::ComputeFrom(leaves[i]);
     level_hashes.emplace_back(leaf_hash.Clone());
-    ledger_->Put(mtid + "|0|" + std::to_string(i), leaf_hash.ToBase32());
+    if (nodes != nullptr) {
+      nodes->emplace_back(mtid + "|0|" + std::to_string(i),
+          leaf_hash.ToBase32());
+    }
   }
 
   while (level_hashes.size() > 1) {
     std::vector<Hash> parent_hashes;
     for (size_t i = 0; i < level_hashes.size(); i = i + 2) {
-      std::string parent_key = mtid + "|" + std::to_string(level + 1) + "|" +
-          std::to_string(i/2);
       if (i + 1 < level_hashes.size()) {
         std::unique_ptr<ledgebase::byte_t[]> data(
             new ledgebase::byte_t[ledgebase::Hash::kByteLength * 2]);
         memcpy(data.get(), level_hashes[i].value(), Hash::kByteLength);
         memcpy(data.get() + Hash::kByteLength, level_hashes[i+1].value(),
             Hash::kByteLength);
-        auto parent = Hash::ComputeFrom(data.get(), Hash::kByteLength*2);
-        ledger_->Put(parent_key, parent.ToBase32());
-        parent_hashes.emplace_back(parent.Clone());
+        parent_hashes.emplace_back(
+            Hash::ComputeFrom(data.get(), Hash::kByteLength*2));
       } else {
-        auto parent = Hash::ComputeFrom(level_hashes[i].value(),
-            Hash::kByteLength);
-        ledger_->Put(parent_key, parent.ToBase32());
-        parent_hashes.emplace_back(parent.Clone());
+        parent_hashes.emplace_back(Hash::ComputeFrom(level_hashes[i].value(),
+            Hash::kByteLength));
+      }
+      if (nodes != nullptr) {
+        nodes->emplace_back(mtid + "|" + std::to_string(level + 1) + "|" +
+            std::to_string(i/2), parent_hashes.back().ToBase32());
       }
     }
     level_hashes = std::move(parent_hashes);
@@ -40,6 +40,14 @@ class MerkleTree {
 
   void Build(const std::string& mtid, const std::vector<std::string> &leaves,
       std::string* level, std::string* root_hash);
+
+  // computes the tree without writing it, appending every node as a
+  // (key, hash) pair to nodes unless it is null; safe to call from several
+  // threads
+  static void Build(const std::string& mtid,
+      const std::vector<std::string> &leaves, std::string* level,
+      std::string* root_hash,
+      std::vector<std::pair<std::string, std::string>>* nodes);
   Proof GetProof(const std::string& mtid, const int& level,
       const uint64_t& seq) const;
 
@@ -1,91 +1,288 @@
 #include "ledger/sqlledger/sqlledger.h"
 #include "ledger/common/utils.h"
 
+#include <algorithm>
+#include <cstring>
+#include <map>
+
+#include "tbb/parallel_for.h"
+
 namespace ledgebase {
 
 namespace sqlledger {
 
-SQLLedger::SQLLedger(int t, const std::string& dbpath) :
-    logger_("/tmp/wal", "/tmp/index") {
-  db_.Open(dbpath);
+namespace {
+
+const char kAccumulator[] = "blkacc";
+
+inline std::string accumulatorKey(size_t level, uint64_t idx) {
+  return std::string(kAccumulator) + "|" + std::to_string(level) + "|" +
+      std::to_string(idx);
+}
+
+// same node rule as MerkleTree::Build, a node without right sibling is
+// hashed alone
+std::string parentHash(const std::string& left, const std::string& right) {
+  auto left_hash = Hash::FromBase32(left);
+  if (right.empty()) {
+    return Hash::ComputeFrom(left_hash.value(), Hash::kByteLength).ToBase32();
+  }
+  auto right_hash = Hash::FromBase32(right);
+  std::unique_ptr<byte_t[]> data(new byte_t[Hash::kByteLength * 2]);
+  memcpy(data.get(), left_hash.value(), Hash::kByteLength);
+  memcpy(data.get() + Hash::kByteLength, right_hash.value(),
+      Hash::kByteLength);
+  return Hash::ComputeFrom(data.get(), Hash::kByteLength * 2).ToBase32();
+}
+
+// history keys are key|{8 byte big endian block}, so the versions of a key
+// sort by block and application keys never contain '|'
+std::string historyKey(const std::string& key, uint64_t block_seq) {
+  std::string hkey = key + "|";
+  for (int shift = 56; shift >= 0; shift -= 8) {
+    hkey.push_back(static_cast<char>((block_seq >> shift) & 0xff));
+  }
+  return hkey;
+}
+
+// groups every key|... entry by the part up to the first '|', which for
+// history keys is the application key
+class HistoryKeyPrefix : public rocksdb::SliceTransform {
+ public:
+  const char* Name() const override { return "ledgebase.HistoryKeyPrefix"; }
+
+  rocksdb::Slice Transform(const rocksdb::Slice& key) const override {
+    auto sep = static_cast<const char*>(memchr(key.data(), '|', key.size()));
+    return rocksdb::Slice(key.data(), sep - key.data() + 1);
+  }
+
+  bool InDomain(const rocksdb::Slice& key) const override {
+    return memchr(key.data(), '|', key.size()) != nullptr;
+  }
+};
+
+// height of the accumulator over nblocks leaves
+inline size_t accumulatorLevel(uint64_t nblocks) {
+  size_t level = 0;
+  while ((uint64_t(1) << level) < nblocks) ++level;
+  return level;
+}
+
+}  // namespace
+
+SQLLedger::SQLLedger(int t, const std::string& dbpath,
+    const std::string& walpath, const std::string& idxpath) :
+    logger_(walpath.c_str(), idxpath.c_str()) {
+  db_.Open(dbpath, new HistoryKeyPrefix());
   mt_.reset(new MerkleTree(&db_));
   block_seq_ = 0;
   tid_ = 0;
-  buffer_.reset(new std::map<uint64_t, std::vector<std::string>>());
-  buildThread_.reset(new std::thread(&SQLLedger::updateLedger, this, t));
+  stop_.store(false);
+  buffer_.reset(new TxnBuffer());
   indexed_.reset(new qldb::QLBTree(&db_, "COMMITTED_"));
   history_.reset(new qldb::QLBTree(&db_, "HISTORY_"));
   dummy_ = Hash::ComputeFrom("0");
+  recover();
+  buildThread_.reset(new std::thread(&SQLLedger::updateLedger, this, t));
+}
+
+SQLLedger::~SQLLedger() {
+  stop_.store(true);
+
+  if (buildThread_ != nullptr) {
+    if (buildThread_->joinable()) buildThread_->join();
+  }
 }
 
 void SQLLedger::updateLedger(int timeout) {
-  while (true) {
+  while (!stop_.load()) {
     std::this_thread::sleep_for(std::chrono::milliseconds(timeout));
-    if (buffer_->size() == 0) {
-      continue;
-    }
+    Flush();
+  }
+}
 
-    timeval t0, t1;
-    gettimeofday(&t0, NULL);
-    std::unique_ptr<std::map<uint64_t, std::vector<std::string>>> new_txns;
-    uint64_t new_blk_seq;
-    {
-      boost::unique_lock<boost::shared_mutex> blockseqlock(lock_);
-      new_blk_seq = block_seq_ ++;
-      new_txns = std::move(buffer_);
-      buffer_.reset(new std::map<uint64_t, std::vector<std::string>>());
-      logger_.index(new_blk_seq);
+void SQLLedger::Flush() {
+  // blocks are committed one at a time and in order
+  std::lock_guard<std::mutex> lk(flush_mu_);
+  if (buffer_->empty()) {
+    return;
+  }
+
+  timeval t0, t1;
+  gettimeofday(&t0, NULL);
+  std::unique_ptr<TxnBuffer> sealed(new TxnBuffer());
+  uint64_t new_blk_seq;
+  {
+    // seal the block: writers hold the lock shared while appending
+    boost::unique_lock<boost::shared_mutex> blockseqlock(lock_);
+    new_blk_seq = block_seq_ ++;
+    buffer_.swap(sealed);
+    logger_.index(new_blk_seq);
+  }
+  commitBlock(new_blk_seq, sealed->Drain());
+
+  gettimeofday(&t1, NULL);
+  auto lat = (t1.tv_sec - t0.tv_sec)*1000000 + t1.tv_usec - t0.tv_usec;
+  //std::cerr << "persist " << lat << " " << nkey << " " << new_txns->size() << std::endl;
+}
+
+void SQLLedger::commitBlock(const uint64_t new_blk_seq,
+    const std::vector<TxnBuffer::Txn>& new_txns) {
+  // build the per transaction merkle trees in parallel
+  std::vector<std::string> txn_levels(new_txns.size());
+  std::vector<std::string> txn_roots(new_txns.size());
+  std::vector<std::vector<std::pair<std::string, std::string>>> txn_nodes(
+      new_txns.size());
+  tbb::parallel_for(size_t(0), new_txns.size(), [&](size_t i) {
+    std::string txnid = "txn" + std::to_string(new_txns[i].first);
+    MerkleTree::Build(txnid, new_txns[i].second, &txn_levels[i],
+        &txn_roots[i], &txn_nodes[i]);
+  });
+
+  // every write of the block goes into one batch
+  rocksdb::WriteBatch batch;
+  std::vector<std::string> leaves;
+  for (size_t txn_seq = 0; txn_seq < new_txns.size(); ++txn_seq) {
+    std::string txnid = "txn" + std::to_string(new_txns[txn_seq].first);
+    for (auto& node : txn_nodes[txn_seq]) {
+      db_.Put(&batch, node.first, node.second);
     }
 
-    int txn_seq = 0;
-    long nkey = 0;
-    std::vector<std::string> leaves;
-    for (auto& entry : *(new_txns.get())) {
-      std::string txnid = "txn" + std::to_string(entry.first);
-      nkey += entry.second.size();
+    // create transaction entries
+    std::string txn_entry = txnid + "|" + std::to_string(new_blk_seq) + "|" + 
+        std::to_string(txn_seq) + "|" + txn_roots[txn_seq] + "|" +
+        txn_levels[txn_seq];
+    db_.Put(&batch, txnid, txn_entry);
 
-      // build merkle txn merkle tree
-      std::string level, txnroot;
-      mt_->Build(txnid, entry.second, &level, &txnroot);
+    leaves.emplace_back(txn_entry);
+  }
 
-      // create transaction entries
-      std::string txn_entry = txnid + "|" + std::to_string(new_blk_seq) + "|" + 
-          std::to_string(txn_seq) + "|" + txnroot + "|" + level;
-      db_.Put(txnid, txn_entry);
+  std::string block_key = "blk" + std::to_string(new_blk_seq);
+  // build merkle tree
+  std::string level, root_hash;
+  std::vector<std::pair<std::string, std::string>> blk_nodes;
+  MerkleTree::Build(block_key, leaves, &level, &root_hash, &blk_nodes);
+  for (auto& node : blk_nodes) {
+    db_.Put(&batch, node.first, node.second);
+  }
 
-      leaves.emplace_back(txn_entry);
-      txn_seq++;
+  // get prev hash
+  std::string digest;
+  db_.Get("digest", &digest);
+  auto prev_hash = Utils::splitBy(digest, '|')[0];
+
+  // create new block, it links to the accumulator root over all previous
+  // blocks, and the digest is the root including it
+  std::string newblock = prev_hash + "|" + root_hash + "|" + level;
+  std::string newhash = Hash::ComputeFrom(newblock).ToBase32();
+  db_.Put(&batch, block_key, newblock);
+  std::string acc_root;
+  appendBlock(new_blk_seq, newhash, &batch, &acc_root);
+  db_.Put(&batch, "digest", acc_root + "|" + std::to_string(new_blk_seq));
+  db_.Put(&batch);
+}
+
+void SQLLedger::recover() {
+  // the store already holds the blocks committed to the ledger and their
+  // documents, so only the indexed blocks after them and the transactions
+  // logged after the last indexed block are replayed
+  const uint64_t nblocks = logger_.blocks();
+  std::string digest;
+  uint64_t next = 0;
+  if (db_.Get("digest", &digest)) {
+    next = std::min<uint64_t>(
+        std::stoul(Utils::splitBy(digest, '|')[1]) + 1, nblocks);
+  }
+  // the last committed block is read as well, for the highest txn id
+  const uint64_t first = next > 0 ? next - 1 : 0;
+  const size_t nread = nblocks + 1 - first;
+  std::vector<std::vector<TxnBuffer::Txn>> blocks(nread);
+  std::vector<std::vector<std::vector<std::pair<Slice, const std::string*>>>>
+      parts(nread);
+  std::vector<uint64_t> max_tid(nread, 0);
+  const size_t npart = std::max(1u, std::thread::hardware_concurrency());
+
+  // rebuild the documents of each block and bucket them by key
+  tbb::parallel_for(size_t(0), nread, [&](size_t r) {
+    uint64_t b = first + r;
+    uint64_t blk_seq = b;
+    auto wal = b < nblocks ? logger_.read(b, &blk_seq) : logger_.unindexed();
+    auto entries = TxnEntry::ParseTxnEntries(wal);
+    std::sort(entries.begin(), entries.end(),
+        [](const TxnEntry& x, const TxnEntry& y) {
+          return x.txnid() < y.txnid();
+        });
+    auto& txns = blocks[r];
+    for (auto& entry : entries) {
+      std::string txnid = "txn" + std::to_string(entry.txnid());
+      std::vector<std::string> docs;
+      for (size_t i = 0; i < entry.keysize(); ++i) {
+        docs.emplace_back(std::to_string(blk_seq) + "|" + txnid + "|" +
+            std::to_string(i) + "|" + entry.key(i).ToString() + "|" +
+            entry.val(i).ToString() + "|" + std::to_string(entry.time()));
+      }
+      txns.emplace_back(entry.txnid(), std::move(docs));
+      max_tid[r] = std::max(max_tid[r], entry.txnid() + 1);
     }
+    // documents only move with their block from here on
+    parts[r].resize(npart);
+    std::hash<std::string> hasher;
+    for (size_t t = 0; t < txns.size(); ++t) {
+      for (size_t i = 0; i < entries[t].keysize(); ++i) {
+        auto key = entries[t].key(i);
+        parts[r][hasher(key.ToString()) % npart].emplace_back(key,
+            &txns[t].second[i]);
+      }
+    }
+  });
+
+  // replay each key partition in block order, the last version wins
+  std::vector<std::map<std::string, const std::string*>> latest(npart);
+  tbb::parallel_for(size_t(0), npart, [&](size_t p) {
+    rocksdb::WriteBatch batch;
+    for (uint64_t b = next; b <= nblocks; ++b) {
+      for (auto& version : parts[b - first][p]) {
+        auto key = version.first.ToString();
+        db_.Put(&batch, historyKey(key, b), *version.second);
+        latest[p][key] = version.second;
+      }
+    }
+    db_.Put(&batch);
+  });
+
+  std::vector<Slice> ks, ds;
+  for (auto& part : latest) {
+    for (auto& version : part) {
+      ks.emplace_back(version.first);
+      ds.emplace_back(*version.second);
+    }
+  }
+  if (!ks.empty()) indexed_->Set(ks, ds);
+
+  // blocks indexed in the wal but not committed to the ledger yet
+  for (uint64_t b = next; b < nblocks; ++b) {
+    commitBlock(b, blocks[b - first]);
+  }
 
-    std::string block_key = "blk" + std::to_string(new_blk_seq);
-    // build merkle tree
-    std::string level, root_hash;
-    mt_->Build(block_key, leaves, &level, &root_hash);
-
-    // get prev hash
-    std::string digest;
-    db_.Get("digest", &digest);
-    auto prev_hash = Utils::splitBy(digest, '|')[0];
-
-    // create new block
-    std::string newblock = prev_hash + "|" + root_hash + "|" + level;
-    std::string newhash = Hash::ComputeFrom(newblock).ToBase32();
-    db_.Put(block_key, newblock);
-    db_.Put("digest", newhash + "|" + std::to_string(new_blk_seq));
-
-    gettimeofday(&t1, NULL);
-    auto lat = (t1.tv_sec - t0.tv_sec)*1000000 + t1.tv_usec - t0.tv_usec;
-    //std::cerr << "persist " << lat << " " << nkey << " " << new_txns->size() << std::endl;
+  block_seq_ = nblocks;
+  tid_ = *std::max_element(max_tid.begin(), max_tid.end());
+  if (!blocks[nblocks - first].empty()) {
+    for (auto& txn : blocks[nblocks - first]) {
+      buffer_->Append(txn.first, txn.second);
+    }
   }
 }
 
-uint64_t SQLLedger::Set(const std::vector<std::string>& keys,
-                        const std::vector<std::string>& vals) {
+bool SQLLedger::Set(const std::vector<std::string>& keys,
+                    const std::vector<std::string>& vals,
+                    uint64_t* block_seq, uint64_t time) {
   // assign txn id
-  std::string txnid = "txn" + std::to_string(tid_);
+  uint64_t tid = tid_++;
+  std::string txnid = "txn" + std::to_string(tid);
 
-  uint64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
-      std::chrono::system_clock::now().time_since_epoch()).count();
+  uint64_t now = time > 0 ? time :
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::system_clock::now().time_since_epoch()).count();
 
   uint64_t next_blk_seq = 0;
   std::vector<std::string> docs;
@@ -100,29 +297,30 @@ uint64_t SQLLedger::Set(const std::vector<std::string>& keys,
                             vals[i] + "|" + std::to_string(now);
       docs.emplace_back(document);
     }
-    buffer_->emplace(tid_, docs);
-  }
-
-  std::vector<Slice> ks, ds;
-  for (size_t i = 0; i < keys.size(); ++i) {
-    ks.emplace_back(keys[i]);
-    ds.emplace_back(docs[i]);
-    std::string hist_key = keys[i] + "|" + std::to_string(next_blk_seq);
-    db_.Put(hist_key, docs[i]);
-  }
-  indexed_->Set(ks, ds);
-
-  // append to wal log
-  auto txn_chunk = TxnEntry::Encode(now, keys, vals, dummy_, tid_-1);
-  logger_.log(txn_chunk.head(), txn_chunk.numBytes());
 
-  {
-    boost::unique_lock<boost::shared_mutex> exclusive(lock_);
+    // append to wal log before the block can be sealed, so the block's
+    // wal range covers exactly the transactions in its buffer
+    auto txn_chunk = TxnEntry::Encode(now, keys, vals, dummy_, tid);
+    if (!logger_.log(txn_chunk.head(), txn_chunk.numBytes())) return false;
     logger_.advance(txn_chunk.numBytes());
+
+    // the documents reach the store before their block can be committed,
+    // so recovery need not replay blocks the store already has
+    std::vector<Slice> ks, ds;
+    for (size_t i = 0; i < keys.size(); ++i) {
+      ks.emplace_back(keys[i]);
+      ds.emplace_back(docs[i]);
+      db_.Put(historyKey(keys[i], next_blk_seq), docs[i]);
+    }
+    {
+      boost::unique_lock<boost::shared_mutex> exclusive(index_lock_);
+      indexed_->Set(ks, ds);
+    }
+    buffer_->Append(tid, docs);
   }
 
-  ++tid_;
-  return next_blk_seq;
+  if (block_seq != nullptr) *block_seq = next_blk_seq;
+  return true;
 }
 
 void SQLLedger::GetDigest(uint64_t* tip, std::string* hash) {
@@ -134,29 +332,28 @@ void SQLLedger::GetDigest(uint64_t* tip, std::string* hash) {
 }
 
 std::string SQLLedger::GetCommitted(const std::string& key) const {
+  boost::shared_lock<boost::shared_mutex> read(index_lock_);
   auto result = indexed_->Get(Slice(key));
   return result.ToString();
 }
 
 std::string SQLLedger::GetDataAtBlock(const std::string& key,
                                       const uint64_t& block_seq) {
-  // auto iter = db_.NewIterater();
-  // for (iter->Seek(key + "|");
-  //      iter->Valid() && iter->key().starts_with(key + "|");
-  //      iter->Next()) {
-  //   auto blk = std::stoul(Utils::splitBy(iter->key().ToString(), '|')[1]);
-  //   if (blk == block_seq) {
-  //     return iter->value().ToString();
-  //   }
-  // }
-  auto histkey = key + "|" + std::to_string(block_seq);
-  std::string value;
-  db_.Get(histkey, &value);
-  return value;
+  // the version as of block_seq is the last one written at or before it
+  auto hist_key = historyKey(key, block_seq);
+  std::unique_ptr<rocksdb::Iterator> iter(db_.NewPrefixIterator());
+  iter->SeekForPrev(hist_key);
+  if (iter->Valid() && iter->key().size() == hist_key.size() &&
+      iter->key().starts_with(rocksdb::Slice(hist_key.data(),
+          key.size() + 1))) {
+    return iter->value().ToString();
+  }
+  return "";
 }
 
 std::map<std::string, std::string> SQLLedger::Range(const std::string& from,
     const std::string& to) {
+  boost::shared_lock<boost::shared_mutex> read(index_lock_);
   auto result = indexed_->Range(Slice(from), Slice(to));
   return result;
 }
@@ -166,31 +363,25 @@ std::vector<std::string> SQLLedger::GetHistory(const std::string& key,
   std::vector<std::string> retval;
   if (n == 0) return retval;
 
-  auto iter = db_.NewIterater();
-  int cnt = 0;
-  for (iter->Seek(key + "|");
-       iter->Valid() && iter->key().starts_with(key + "|");
-       iter->Next()) {
-    
+  // latest version first
+  auto last = historyKey(key, UINT64_MAX);
+  rocksdb::Slice prefix(last.data(), key.size() + 1);
+  std::unique_ptr<rocksdb::Iterator> iter(db_.NewPrefixIterator());
+  for (iter->SeekForPrev(last);
+       iter->Valid() && iter->key().starts_with(prefix);
+       iter->Prev()) {
+    if (iter->key().size() != last.size()) continue;
     retval.emplace_back(iter->value().ToString());
-    ++cnt;
-    if (cnt >= n) break;
+    if (retval.size() >= n) break;
   }
   return retval;
 }
 
 BlockProof SQLLedger::getBlockProof(const uint64_t block_addr,
     const uint64_t tip, int* level) {
-  BlockProof proof;
-  for (size_t i = block_addr; i <= tip; ++i) {
-    std::string block;
-    db_.Get("blk" + std::to_string(i), &block);
-    proof.blks.push_back(block);
-    if (i == block_addr) {
-      auto blockinfo = Utils::splitBy(block, '|');
-      *level = std::stoul(blockinfo[2]);
-    }
-  }
+  auto proof = accumulatorProof(block_addr, tip);
+  auto blockinfo = Utils::splitBy(proof.proof.value, '|');
+  *level = std::stoul(blockinfo[2]);
   return proof;
 }
 
@@ -198,7 +389,9 @@ DetailProof SQLLedger::getDetailProof(const std::string& key,
     const uint64_t block_addr, int level) {
   DetailProof proof;
 
-  std::string doc = GetDataAtBlock(key, block_addr);
+  // the proof is for the block that wrote the key, not an older version
+  std::string doc;
+  db_.Get(historyKey(key, block_addr), &doc);
   auto docitems = Utils::splitBy(doc, '|');
   auto txnid = docitems[1];
   auto docseq = std::stoul(docitems[2]);
@@ -220,15 +413,11 @@ DetailProof SQLLedger::getDetailProof(const std::string& key,
 }
 
 bool BlockProof::Verify(const std::string& hash, std::string* blk_mt_root) {
-  std::string target = hash;
-  for (auto it = blks.rbegin(); it != blks.rend(); ++it) {
-    if (Hash::ComputeFrom(*it).ToBase32().compare(target) != 0) {
-      return false;
-    }
-    auto block_info = Utils::splitBy(*it, '|');
-    target = block_info[0];
-    *blk_mt_root = block_info[1];
+  if (hash.compare(proof.digest) != 0 || !proof.Verify()) {
+    return false;
   }
+  auto block_info = Utils::splitBy(proof.value, '|');
+  *blk_mt_root = block_info[1];
   return true;
 }
 
@@ -253,7 +442,7 @@ bool DetailProof::Verify(const std::string& hash) {
 Auditor SQLLedger::getAudit(const uint64_t& seq) {
   Auditor auditor;
   uint64_t block_addr;
-  auditor.txns = logger_.read(seq, &block_addr);
+  auditor.txns = logger_.read(seq, &block_addr).ToString();
   auditor.block_seq = block_addr;
 
   // get digest
@@ -261,36 +450,102 @@ Auditor SQLLedger::getAudit(const uint64_t& seq) {
   db_.Get("digest", &value);
   auto digest = Utils::splitBy(value, '|');
   auditor.digest = digest[0];
-  int tip = std::stoul(digest[1]);
+  uint64_t tip = std::stoul(digest[1]);
 
   // get block
-  int level;
-  std::string blkroot;
-  for (size_t i = block_addr; i <= tip; ++i) {
-    std::string block;
-    db_.Get("blk" + std::to_string(i), &block);
-    auditor.blks.emplace_back(block);
-    if (i == block_addr) {
-      auto blockinfo = Utils::splitBy(block, '|');
-      level = std::stoul(blockinfo[2]);
-      blkroot = blockinfo[1];
+  auditor.blk_proof = accumulatorProof(block_addr, tip);
+  return auditor;
+}
+
+void SQLLedger::appendBlock(const uint64_t blk_seq,
+    const std::string& blk_hash, rocksdb::WriteBatch* batch,
+    std::string* root) {
+  // the new leaf completes one subtree per trailing one bit of its index,
+  // their left siblings were completed by earlier blocks
+  std::map<std::string, std::string> staged;
+  std::string node = blk_hash;
+  uint64_t idx = blk_seq;
+  size_t level = 0;
+  staged[accumulatorKey(level, idx)] = node;
+  while (idx % 2 == 1) {
+    std::string left;
+    db_.Get(accumulatorKey(level, idx - 1), &left);
+    node = parentHash(left, node);
+    idx /= 2;
+    ++level;
+    staged[accumulatorKey(level, idx)] = node;
+  }
+  for (auto& n : staged) {
+    db_.Put(batch, n.first, n.second);
+  }
+  *root = accumulatorNode(accumulatorLevel(blk_seq + 1), 0, blk_seq + 1,
+      staged);
+}
+
+std::string SQLLedger::accumulatorNode(size_t level, uint64_t idx,
+    uint64_t nblocks, const std::map<std::string, std::string>& staged) {
+  std::string key = accumulatorKey(level, idx);
+  if (((idx + 1) << level) <= nblocks) {
+    // complete subtrees never change
+    auto it = staged.find(key);
+    if (it != staged.end()) return it->second;
+    std::string node;
+    db_.Get(key, &node);
+    return node;
+  }
+  // on the right edge of a smaller tree, at most one such node per level
+  auto left = accumulatorNode(level - 1, idx * 2, nblocks, staged);
+  std::string right;
+  if (((idx * 2 + 1) << (level - 1)) < nblocks) {
+    right = accumulatorNode(level - 1, idx * 2 + 1, nblocks, staged);
+  }
+  return parentHash(left, right);
+}
+
+BlockProof SQLLedger::accumulatorProof(const uint64_t block_addr,
+    const uint64_t tip) {
+  BlockProof blk_proof;
+  auto& proof = blk_proof.proof;
+  std::map<std::string, std::string> none;
+  uint64_t nblocks = tip + 1;
+  size_t top = accumulatorLevel(nblocks);
+  uint64_t idx = block_addr;
+  for (size_t level = 0; level < top; ++level) {
+    if (idx % 2 == 1) {
+      proof.proof.emplace_back(accumulatorNode(level, idx - 1, nblocks, none));
+      proof.pos.emplace_back(0);
+    } else if (((idx + 1) << level) < nblocks) {
+      proof.proof.emplace_back(accumulatorNode(level, idx + 1, nblocks, none));
+      proof.pos.emplace_back(1);
+    } else {
+      // no right sibling, the node is hashed alone
+      proof.proof.emplace_back("");
+      proof.pos.emplace_back(1);
     }
+    idx /= 2;
   }
-  return auditor;
+  proof.digest = accumulatorNode(top, 0, nblocks, none);
+  db_.Get("blk" + std::to_string(block_addr), &proof.value);
+  return blk_proof;
 }
 
-bool Auditor::Audit(DB* db, size_t* ntxn) {
-  MerkleTree mt(db);
-  std::string target = digest;
+bool Auditor::Audit(size_t* ntxn) {
   std::string blk_mt_root;
-  for (auto it = blks.rbegin(); it != blks.rend(); ++it) {
-    if (Hash::ComputeFrom(*it).ToBase32().compare(target) != 0) return false;
-    auto block_info = Utils::splitBy(*it, '|');
-    target = block_info[0];
-    blk_mt_root = block_info[1];
+  if (!blk_proof.Verify(digest, &blk_mt_root)) return false;
+  // the path must lead to the audited block, not any block in the ledger
+  uint64_t idx = 0;
+  for (size_t i = 0; i < blk_proof.proof.pos.size(); ++i) {
+    if (blk_proof.proof.pos[i] == 0) idx |= uint64_t(1) << i;
   }
-
-  auto entries = TxnEntry::ParseTxnEntries(txns);
+  if (idx != block_seq) return false;
+
+  // blocks order transactions by txn id, concurrent writers may have
+  // appended them to the wal in a different order
+  auto entries = TxnEntry::ParseTxnEntries(Slice(txns));
+  std::sort(entries.begin(), entries.end(),
+      [](const TxnEntry& a, const TxnEntry& b) {
+        return a.txnid() < b.txnid();
+      });
   *ntxn = entries.size();
   std::vector<std::string> buffer;
   for (size_t j = 0; j < entries.size(); ++j) {
@@ -305,7 +560,7 @@ bool Auditor::Audit(DB* db, size_t* ntxn) {
     }
     // build merkle txn merkle tree
     std::string level, txnroot;
-    mt.Build(txnid, documents, &level, &txnroot);
+    MerkleTree::Build(txnid, documents, &level, &txnroot, nullptr);
 
     // create transaction entries
     std::string txn_entry = txnid + "|" + std::to_string(block_seq) + "|" + 
@@ -316,7 +571,7 @@ bool Auditor::Audit(DB* db, size_t* ntxn) {
 
   std::string block_key = "blk" + std::to_string(block_seq);
   std::string level, root_hash;
-  mt.Build(block_key, buffer, &level, &root_hash);
+  MerkleTree::Build(block_key, buffer, &level, &root_hash, nullptr);
 
   return root_hash.compare(blk_mt_root) == 0;
 }
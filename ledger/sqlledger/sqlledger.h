@@ -1,19 +1,23 @@
 #ifndef SQLLEDGER_H_
 #define SQLLEDGER_H_
 
+#include <mutex>
 #include <thread>
 #include "boost/thread.hpp"
 #include "ledger/common/db.h"
 #include "ledger/common/logger.h"
 #include "ledger/qldb/ql_btree.h"
 #include "ledger/sqlledger/sqlldg_mt.h"
+#include "ledger/sqlledger/txn_buffer.h"
 
 namespace ledgebase {
 
 namespace sqlledger {
 
+// Inclusion of one block in the digest: proof.value is the block record and
+// proof.proof its path to the root of the accumulator over all block hashes.
 struct BlockProof {
-  std::vector<std::string> blks;
+  Proof proof;
 
   bool Verify(const std::string& hash, std::string* mt_blk_root);
 };
@@ -26,25 +30,39 @@ struct DetailProof {
 };
 
 struct Auditor {
-  std::vector<std::string> blks;
+  BlockProof blk_proof;
   std::string txns;
   std::string digest;
   uint64_t block_seq;
 
-  bool Audit(DB* db, size_t* ntxn);
+  // recomputes the block from the wal entries in memory
+  bool Audit(size_t* ntxn);
 };
 
 class SQLLedger {
  public:
-  SQLLedger(int t, const std::string& dbpath);
-  ~SQLLedger() = default;
+  // replays the wal at walpath/idxpath before serving, so indexes and
+  // blocks lost in a crash are rebuilt; the wal belongs to dbpath and
+  // must not be shared with another ledger
+  SQLLedger(int t, const std::string& dbpath, const std::string& walpath,
+      const std::string& idxpath);
+  ~SQLLedger();
 
   void updateLedger(int timeout);
 
+  // seals the buffered transactions into a block and returns once it is
+  // committed; the build thread does this every timeout ms
+  void Flush();
+
   void GetDigest(uint64_t* tip, std::string* hash);
   
-  uint64_t Set(const std::vector<std::string>& keys,
-               const std::vector<std::string>& vals);
+  // false if the transaction could not be logged, in which case it is
+  // dropped; block_seq, if given, receives the block it goes into. time
+  // stamps the transaction, the current time in ms if 0
+  bool Set(const std::vector<std::string>& keys,
+           const std::vector<std::string>& vals,
+           uint64_t* block_seq = nullptr,
+           uint64_t time = 0);
 
   std::string GetCommitted(const std::string& key) const;
 
@@ -67,17 +85,37 @@ class SQLLedger {
   size_t size() { return db_.size(); }
 
  private:
+  // builds the trees of a sealed block and writes it with the new digest
+  void commitBlock(const uint64_t blk_seq,
+      const std::vector<TxnBuffer::Txn>& txns);
+
+  // rebuilds the indexes, counters and uncommitted blocks from the wal,
+  // parsing blocks and replaying key partitions in parallel
+  void recover();
+
+  // append-only merkle accumulator over block hashes, nodes are stored as
+  // blkacc|level|index and only written once their subtree is complete
+  void appendBlock(const uint64_t blk_seq, const std::string& blk_hash,
+      rocksdb::WriteBatch* batch, std::string* root);
+
+  std::string accumulatorNode(size_t level, uint64_t idx, uint64_t nblocks,
+      const std::map<std::string, std::string>& staged);
+
+  BlockProof accumulatorProof(const uint64_t block_addr, const uint64_t tip);
 
   Logger logger_;
   DB db_;
   std::unique_ptr<std::thread> buildThread_;
   std::unique_ptr<MerkleTree> mt_;
   //std::vector<std::string> *buffer_;
-  std::unique_ptr<std::map<uint64_t, std::vector<std::string>>> buffer_;
+  std::unique_ptr<TxnBuffer> buffer_;
   uint64_t block_seq_;
-  uint64_t tid_;
+  std::atomic<uint64_t> tid_;
+  std::atomic<bool> stop_;
   boost::shared_mutex lock_;
-  boost::shared_mutex buffer_lock_;
+  std::mutex flush_mu_;
+  // guards indexed_, which is not safe for concurrent updates
+  mutable boost::shared_mutex index_lock_;
   std::unique_ptr<qldb::QLBTree> indexed_;
   std::unique_ptr<qldb::QLBTree> history_;
   Hash dummy_;
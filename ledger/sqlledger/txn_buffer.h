@@ -0,0 +1,59 @@
+#ifndef SQLLEDGER_TXN_BUFFER_H_
+#define SQLLEDGER_TXN_BUFFER_H_
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "tbb/enumerable_thread_specific.h"
+
+namespace ledgebase {
+
+namespace sqlledger {
+
+// Transactions waiting for the next block. Every writer thread appends to
+// its own segment, so concurrent Set calls never touch a shared container.
+// The owner swaps in a fresh buffer to seal a block, and merges the
+// segments by txn id afterwards.
+class TxnBuffer {
+ public:
+  typedef std::pair<uint64_t, std::vector<std::string>> Txn;
+
+  TxnBuffer() : empty_(true) {}
+  ~TxnBuffer() = default;
+
+  inline void Append(uint64_t tid, const std::vector<std::string>& docs) {
+    segments_.local().emplace_back(tid, docs);
+    // read first so that writers only share the cache line while it is
+    // clean
+    if (empty_.load(std::memory_order_relaxed)) {
+      empty_.store(false, std::memory_order_relaxed);
+    }
+  }
+
+  inline bool empty() const { return empty_.load(); }
+
+  // must only be called once no writer can append anymore
+  std::vector<Txn> Drain() {
+    std::vector<Txn> txns;
+    for (auto& segment : segments_) {
+      std::move(segment.begin(), segment.end(), std::back_inserter(txns));
+      segment.clear();
+    }
+    std::sort(txns.begin(), txns.end(),
+        [](const Txn& a, const Txn& b) { return a.first < b.first; });
+    return txns;
+  }
+
+ private:
+  tbb::enumerable_thread_specific<std::vector<Txn>> segments_;
+  std::atomic<bool> empty_;
+};
+
+}  // namespace sqlledger
+
+}  // namespace ledgebase
+
+#endif  // SQLLEDGER_TXN_BUFFER_H_
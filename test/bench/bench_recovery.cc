@@ -0,0 +1,60 @@
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "ledger/qldb/bplus_config.h"
+#include "ledger/sqlledger/sqlledger.h"
+#include "../ledger/test_util.h"
+
+namespace {
+
+uint64_t fileSize(const std::string& path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0 ? st.st_size : 0;
+}
+
+// microseconds taken to open a SQLLedger on dbpath, including recovery
+uint64_t timeOpen(const std::string& dbpath, const std::string& wal,
+    const std::string& idx) {
+  timeval t0, t1;
+  gettimeofday(&t0, NULL);
+  {
+    ledgebase::sqlledger::SQLLedger sql(5, dbpath, wal, idx);
+    gettimeofday(&t1, NULL);
+  }
+  return (t1.tv_sec - t0.tv_sec)*1000000 + t1.tv_usec - t0.tv_usec;
+}
+
+}  // namespace
+
+// SQLLedger recovery time against wal size: restarting on the store that
+// wrote the wal, and rebuilding an empty store from it
+int main() {
+  ledgebase::qldb::BPlusConfig::Init(45, 15);
+  std::cout << "txns wal_bytes restart_us rebuild_us" << std::endl;
+  for (size_t ntxns : {1000, 4000, 16000, 64000, 256000}) {
+    auto suffix = std::to_string(ntxns);
+    auto db = freshPath("benchdb" + suffix);
+    auto wal = freshPath("benchwal" + suffix);
+    auto idx = freshPath("benchidx" + suffix);
+    {
+      ledgebase::sqlledger::SQLLedger sql(5, db, wal, idx);
+      for (size_t i = 0; i < ntxns; ++i) {
+        std::vector<std::string> keys, vals;
+        keys.emplace_back("k" + std::to_string(i % 500));
+        vals.emplace_back("v" + std::to_string(i));
+        sql.Set(keys, vals);
+      }
+      sql.Flush();
+    }
+
+    auto restart = timeOpen(db, wal, idx);
+    auto rebuild = timeOpen(freshPath("benchdb_rebuild" + suffix), wal, idx);
+    std::cout << ntxns << " " << fileSize(wal) << " " << restart << " "
+              << rebuild << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,71 @@
+#include "gtest/gtest.h"
+
+#include "distributed/replication/vr/clienttable.h"
+
+namespace {
+
+replication::Request request(uint64_t reqid, uint64_t oldest) {
+  replication::Request req;
+  req.set_op("op" + std::to_string(reqid));
+  req.set_clientid(7);
+  req.set_clientreqid(reqid);
+  req.set_oldestreqid(oldest);
+  return req;
+}
+
+replication::vr::proto::ReplyMessage reply(uint64_t reqid) {
+  replication::vr::proto::ReplyMessage rep;
+  rep.set_reply("res" + std::to_string(reqid));
+  rep.set_clientreqid(reqid);
+  return rep;
+}
+
+}  // namespace
+
+// Requests 1 to 3 are in flight at once and request 2 is lost on its way;
+// its resend arrives after request 3 has been executed.
+TEST(ClientTable, ResendWithDepth) {
+  replication::vr::ClientTable table;
+
+  table.Add(request(1, 1));
+  table.Add(request(3, 1));
+  ASSERT_TRUE(table.Seen(request(1, 1)));
+  ASSERT_TRUE(table.Seen(request(3, 1)));
+  ASSERT_FALSE(table.Seen(request(2, 1)));
+
+  table.Add(request(2, 1));
+  table.SetReply(request(3, 1), reply(3));
+  table.SetReply(request(1, 1), reply(1));
+
+  // a resend of an earlier request gets its own reply, not the latest
+  auto entry = table.Find(request(1, 1));
+  ASSERT_NE(entry, nullptr);
+  ASSERT_TRUE(entry->replied);
+  ASSERT_EQ(entry->reply.reply(), "res1");
+
+  // one still waiting for the other replicas has nothing to resend
+  entry = table.Find(request(2, 1));
+  ASSERT_NE(entry, nullptr);
+  ASSERT_FALSE(entry->replied);
+
+  // once the client waits for nothing before 3, the rest is forgotten
+  // but still counts as executed
+  table.Add(request(4, 3));
+  ASSERT_TRUE(table.Seen(request(1, 1)));
+  ASSERT_EQ(table.Find(request(1, 1)), nullptr);
+  ASSERT_EQ(table.Find(request(2, 1)), nullptr);
+  entry = table.Find(request(3, 1));
+  ASSERT_NE(entry, nullptr);
+  ASSERT_EQ(entry->reply.reply(), "res3");
+}
+
+// a late request carrying an older bound does not bring entries back
+TEST(ClientTable, OldestNeverMovesBack) {
+  replication::vr::ClientTable table;
+
+  table.Add(request(5, 5));
+  table.Add(request(4, 2));
+  ASSERT_TRUE(table.Seen(request(4, 2)));
+  ASSERT_EQ(table.Find(request(4, 2)), nullptr);
+  ASSERT_NE(table.Find(request(5, 5)), nullptr);
+}
@@ -40,4 +40,33 @@ TEST(MPT, TPS) {
   gettimeofday(&t1, NULL);
   auto elapsed_time = (t1.tv_sec - t0.tv_sec) * 1000000 + t1.tv_usec - t0.tv_usec;
   std::cerr << "# Latency: " << elapsed_time << std::endl;
-}
\ No newline at end of file
+}
+TEST(MPT, Diff) {
+  ledgebase::DB db;
+  db.Open("testdb");
+
+  std::vector<std::string> keys, vals;
+  for (size_t i = 0; i < 1000; ++i) {
+    keys.emplace_back("k" + std::to_string(i));
+    vals.emplace_back("v" + std::to_string(i));
+  }
+  auto base = ledgebase::ledgerdb::Trie(&db, keys, vals).hash().Clone();
+
+  // a few updates, some of them on keys that share long prefixes
+  std::vector<std::string> new_keys{"k7", "k77", "k777", "k1000"};
+  std::vector<std::string> new_vals{"x7", "x77", "x777", "x1000"};
+  auto head = ledgebase::ledgerdb::Trie(&db, base).Set(new_keys,
+      new_vals).Clone();
+
+  auto diff = ledgebase::ledgerdb::Trie(&db, head).Diff(base);
+  ASSERT_EQ(diff.size(), new_keys.size());
+  for (size_t i = 0; i < new_keys.size(); ++i) {
+    EXPECT_EQ(diff[new_keys[i]], new_vals[i]);
+  }
+  EXPECT_TRUE(ledgebase::ledgerdb::Trie(&db, head).Diff(head).empty());
+
+  auto all = ledgebase::ledgerdb::Trie(&db, base).Diff(
+      ledgebase::ledgerdb::Trie::kNilChunk.hash());
+  EXPECT_EQ(all.size(), keys.size());
+  EXPECT_EQ(all["k123"], "v123");
+}
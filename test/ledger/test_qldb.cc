@@ -0,0 +1,80 @@
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "ledger/qldb/qldb.h"
+#include "ledger/qldb/bplus_config.h"
+#include "test_util.h"
+
+TEST(QLDB, index) {
+  ledgebase::qldb::BPlusConfig::Init(45, 8);
+  ledgebase::qldb::QLDB qldb(freshPath("testdb_index"));
+
+  // more than ten versions per key, so history keys cross a decimal digit
+  for (size_t i = 0; i < 150; ++i) {
+    std::vector<std::string> keys, vals;
+    keys.emplace_back("k" + std::to_string(i % 10));
+    vals.emplace_back("v" + std::to_string(i));
+    qldb.Set("test", keys, vals);
+  }
+
+  // reads wait for the background indexer to catch up with the ledger
+  EXPECT_EQ(qldb.GetData("test", "k3"), "v143");
+  EXPECT_EQ(qldb.indexed(), qldb.committed());
+
+  auto history = qldb.GetHistory("test", "k7", 3);
+  ASSERT_EQ(history.size(), 4u);
+  for (size_t i = 0; i < history.size(); ++i) {
+    ledgebase::qldb::Document doc(&history[i]);
+    EXPECT_EQ(doc.getData().val.ToString(),
+        "v" + std::to_string(147 - i * 10));
+  }
+
+  auto range = qldb.Range("test", "k2", "k4");
+  EXPECT_EQ(range.size(), 3u);
+}
+
+TEST(QLDB, version) {
+  ledgebase::qldb::BPlusConfig::Init(45, 8);
+  ledgebase::qldb::QLDB qldb(freshPath("testdb_version"));
+
+  // each ledger numbers the versions of a key on its own
+  for (size_t i = 0; i < 3; ++i) {
+    qldb.Set("first", {"shared"}, {"v" + std::to_string(i)});
+  }
+  uint64_t block;
+  qldb.Set("second", {"shared"}, {"w0"}, &block);
+
+  auto chunk = qldb.GetCommitted("second", "shared");
+  ledgebase::qldb::Document doc(&chunk);
+  EXPECT_EQ(doc.getAddr().seq_no, block);
+  EXPECT_EQ(doc.getMetaData().version, 0u);
+}
+
+TEST(QLDB, proof) {
+  ledgebase::qldb::BPlusConfig::Init(45, 8);
+  ledgebase::qldb::QLDB qldb(freshPath("testdb_proof"));
+
+  for (size_t i = 0; i < 37; ++i) {
+    std::vector<std::string> keys, vals;
+    keys.emplace_back("p" + std::to_string(i));
+    vals.emplace_back("v" + std::to_string(i));
+    qldb.Set("proof", keys, vals);
+  }
+
+  auto digest = qldb.digest("proof");
+  auto root = ledgebase::Hash::FromBase32(digest.digest);
+  for (auto key : {"p0", "p17", "p36"}) {
+    auto chunk = qldb.GetCommitted("proof", key);
+    ledgebase::qldb::Document doc(&chunk);
+    // the upper proof nodes of both lookups are served from the cache
+    for (int round = 0; round < 2; ++round) {
+      auto hits = qldb.proofCacheHits();
+      auto proof = qldb.getProof("proof", digest.tip,
+          doc.getAddr().seq_no, doc.getMetaData().doc_seq);
+      EXPECT_TRUE(proof.Verify(root));
+      EXPECT_GT(qldb.proofCacheHits(), hits);
+    }
+  }
+}
@@ -0,0 +1,62 @@
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "ledger/qldb/bplus_config.h"
+#include "ledger/sqlledger/sqlledger.h"
+#include "test_util.h"
+
+// each round restarts on the same store, which replays only the wal past
+// its last committed block, and from an empty store, which rebuilds the
+// blocks from the wal as well
+TEST(SQL, recovery) {
+  ledgebase::qldb::BPlusConfig::Init(45, 15);
+  for (size_t ntxns : {1000, 4000, 16000}) {
+    auto suffix = std::to_string(ntxns);
+    auto wal = freshPath("testwal" + suffix);
+    auto idx = freshPath("testidx" + suffix);
+
+    uint64_t tip;
+    std::string digest;
+    std::vector<std::string> history;
+    {
+      ledgebase::sqlledger::SQLLedger sql(5, freshPath("testdb_log" + suffix),
+          wal, idx);
+      for (size_t i = 0; i < ntxns; ++i) {
+        std::vector<std::string> keys, vals;
+        keys.emplace_back("k" + std::to_string(i % 500));
+        vals.emplace_back("v" + std::to_string(i));
+        sql.Set(keys, vals);
+      }
+      // seal the last block before stopping
+      sql.Flush();
+      sql.GetDigest(&tip, &digest);
+      history = sql.GetHistory("k7", ntxns);
+    }
+
+    {
+      ledgebase::sqlledger::SQLLedger sql(5, "testdb_log" + suffix, wal, idx);
+      uint64_t new_tip;
+      std::string new_digest;
+      sql.GetDigest(&new_tip, &new_digest);
+      EXPECT_EQ(new_tip, tip);
+      EXPECT_EQ(new_digest, digest);
+      EXPECT_EQ(sql.GetHistory("k7", ntxns), history);
+    }
+
+    ledgebase::sqlledger::SQLLedger sql(5,
+        freshPath("testdb_recovery" + suffix), wal, idx);
+
+    uint64_t new_tip;
+    std::string new_digest;
+    sql.GetDigest(&new_tip, &new_digest);
+    EXPECT_EQ(new_tip, tip);
+    EXPECT_EQ(new_digest, digest);
+
+    auto doc = sql.GetCommitted("k7");
+    EXPECT_NE(doc.find("|k7|v" + std::to_string(ntxns - 500 + 7) + "|"),
+        std::string::npos);
+    EXPECT_EQ(sql.GetHistory("k7", ntxns), history);
+  }
+}
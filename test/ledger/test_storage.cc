@@ -7,6 +7,7 @@
 #include "ledger/sqlledger/sqlledger.h"
 #include "ledger/qldb/qldb.h"
 #include "ledger/qldb/bplus_config.h"
+#include "test_util.h"
 
 void millisleep(size_t t) {
   timespec req;
@@ -47,7 +48,8 @@ TEST(LDB, storage) {
 
 TEST(SQL, storage) {
   ledgebase::qldb::BPlusConfig::Init(45, 15);
-  ledgebase::sqlledger::SQLLedger sql(0, "testdb");
+  ledgebase::sqlledger::SQLLedger sql(0, freshPath("testdb_sql"),
+      freshPath("testdb_sql.wal"), freshPath("testdb_sql.index"));
   size_t repeat = 160000;
   for (size_t i = 0; i < repeat; ++i) {
     std::vector<std::string> keys, vals;
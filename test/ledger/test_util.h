@@ -0,0 +1,14 @@
+#ifndef TEST_LEDGER_TEST_UTIL_H
+#define TEST_LEDGER_TEST_UTIL_H
+
+#include <cstdlib>
+#include <string>
+
+// removes whatever an earlier test or run left at path
+inline std::string freshPath(const std::string& path) {
+  int rc = std::system(("rm -rf " + path).c_str());
+  (void) rc;
+  return path;
+}
+
+#endif